@@ -0,0 +1,442 @@
+/* microbenchmarks for libsourdough and the datagrump wire format,
+   printed as CSV (benchmark,parameter,metric,value,unit) so that
+   runs can be collected and compared over time */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "socket.hh"
+#include "poller.hh"
+#include "io_uring.hh"
+#include "packet_pool.hh"
+#include "timestamp.hh"
+#include "contest_message.hh"
+#include "controller.hh"
+#include "scoreboard.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* length of a full-sized datagram, as the sender sends */
+static const size_t DATAGRAM_LENGTH = 1472;
+
+/* keeps the compiler from optimizing away what is being measured */
+static volatile uint64_t sink;
+
+/* print one result */
+static void report( const string & benchmark, const string & parameter,
+		    const string & metric, const double value, const string & unit )
+{
+  cout << benchmark << "," << parameter << "," << metric << "," << value << "," << unit << endl;
+}
+
+/* a UDP socket bound to an ephemeral port on the loopback interface */
+static void bind_loopback( UDPSocket & socket )
+{
+  socket.bind( Address( "::1", 0 ) );
+}
+
+/* writing a datagram's header, turning it into an ack, and parsing the ack */
+static void bench_header( void )
+{
+  const unsigned int ITERATIONS = 10000000;
+
+  string datagram( DATAGRAM_LENGTH, 'x' );
+  datagram.resize( ContestMessageView::MAX_ACK_LENGTH + DATAGRAM_LENGTH );
+
+  SackBlock sack;
+  sack.cumulative_ack = 0;
+  sack.range_count = 2;
+  sack.ranges[ 0 ] = { 10, 20 };
+  sack.ranges[ 1 ] = { 30, 40 };
+
+  /* serialize: fill in a new datagram's header */
+  uint64_t start = timestamp_ns();
+  for ( unsigned int i = 0; i < ITERATIONS; i++ ) {
+    ContestMessageView message( &datagram[ 0 ], DATAGRAM_LENGTH );
+    message.init_header( i );
+    message.set_send_timestamp( start + i );
+  }
+  report( "header", "", "serialize", double( timestamp_ns() - start ) / ITERATIONS, "ns/op" );
+
+  /* ack: turn it into an ack with a SACK block, in place */
+  start = timestamp_ns();
+  for ( unsigned int i = 0; i < ITERATIONS; i++ ) {
+    ContestMessageView message( &datagram[ 0 ], DATAGRAM_LENGTH, datagram.size() );
+    message.set_sequence_number( i );
+    message.transform_into_ack( i, start + i );
+    sack.cumulative_ack = i;
+    sink = message.set_sack( sack );
+  }
+  report( "header", "", "ack", double( timestamp_ns() - start ) / ITERATIONS, "ns/op" );
+
+  /* parse: read every header field and the SACK block back */
+  const size_t ack_length = sink;
+  uint64_t total = 0;
+  start = timestamp_ns();
+  for ( unsigned int i = 0; i < ITERATIONS; i++ ) {
+    const ContestMessageView ack( &datagram[ 0 ], ack_length );
+    total += ack.sequence_number() + ack.send_timestamp() + ack.ack_sequence_number()
+      + ack.ack_send_timestamp() + ack.ack_recv_timestamp() + ack.ack_payload_length();
+    if ( ack.is_ack() and ack.has_sack() ) {
+      total += ack.sack().cumulative_ack;
+    }
+  }
+  sink = total;
+  report( "header", "", "parse", double( timestamp_ns() - start ) / ITERATIONS, "ns/op" );
+}
+
+/* a congestion controller's cost per ack (the interpolation
+   controller's should grow with its order, not its history) */
+static void bench_controller( const string & name, const vector<string> & settings )
+{
+  const unsigned int ITERATIONS = 10000000;
+
+  ControllerParams params;
+  string parameter;
+  for ( const auto & setting : settings ) {
+    params.set( setting );
+    parameter += (parameter.empty() ? "" : " ") + setting;
+  }
+  unique_ptr<Controller> controller = Controller::make( name, false, params );
+
+  /* RTTs that wander between 40 and 140 ms */
+  const uint64_t start = timestamp_ns();
+  for ( unsigned int i = 0; i < ITERATIONS; i++ ) {
+    const uint64_t now = 1000000000 + uint64_t( i ) * 100000;
+    controller->ack_received( i, now - 40000000 - (i % 1000) * 100000, now, now, 1400 );
+    sink = controller->window_size();
+  }
+  report( "controller", name + " " + parameter, "ack",
+	  double( timestamp_ns() - start ) / ITERATIONS, "ns/op" );
+}
+
+/* a window of datagrams in flight, one in every window of them
+   arriving half a window late (and the sender tolerating that much
+   reordering), with SACK blocks from a ReceiveHistory as the receiver
+   makes them: while the late one is outstanding, each ack's SACK range
+   reaches back to it, but should only cost what it newly acks */
+static void bench_scoreboard( const unsigned int window )
+{
+  const unsigned int ITERATIONS = 1000000;
+
+  Scoreboard scoreboard( window );
+  ReceiveHistory history;
+  vector<LostDatagram> lost;
+
+  uint64_t next = 0;
+  while ( next < window ) {
+    scoreboard.sent( next++, 1 );
+  }
+
+  /* (acked 1 ns after being sent, and losses looked for before that
+     long has gone by, so none are presumed lost by time) */
+  auto arrive = [&] ( const uint64_t sequence_number ) {
+    history.received( sequence_number );
+    scoreboard.ack_received( sequence_number, 1, 2, history.sack( sequence_number ) );
+    scoreboard.detect_losses( 1, lost );
+  };
+
+  const uint64_t start = timestamp_ns();
+  for ( unsigned int i = 0; i < ITERATIONS; i++ ) {
+    const uint64_t oldest = next - window;
+    if ( oldest % window ) {
+      arrive( oldest );
+    }
+    if ( oldest >= window / 2 and (oldest - window / 2) % window == 0 ) {
+      arrive( oldest - window / 2 );
+    }
+    scoreboard.sent( next++, 1 );
+  }
+  sink = scoreboard.in_flight();
+
+  report( "scoreboard", "window=" + to_string( window ), "sack",
+	  double( timestamp_ns() - start ) / ITERATIONS, "ns/ack" );
+}
+
+/* one ready fd among idle_count idle ones: the cost of a poll() that
+   dispatches one event (including sending and receiving the datagram
+   that makes the fd ready) should not grow with the idle fds */
+static void bench_poller( const unsigned int idle_count )
+{
+  const unsigned int ITERATIONS = 200000;
+
+  vector<UDPSocket> idle( idle_count );
+
+  Poller poller;
+  for ( auto & socket : idle ) {
+    bind_loopback( socket );
+    poller.add_action( Action( socket, Direction::In, [] () {
+	  throw runtime_error( "idle socket became readable" );
+	  return ResultType::Continue;
+	} ) );
+  }
+
+  UDPSocket active, writer;
+  bind_loopback( active );
+  writer.connect( active.local_address() );
+
+  char buffer[ 64 ];
+  poller.add_action( Action( active, Direction::In, [&] () {
+	sink = active.recv( buffer, sizeof( buffer ) ).length;
+	return ResultType::Continue;
+      } ) );
+
+  const string payload( 32, 'x' );
+  const uint64_t start = timestamp_ns();
+  for ( unsigned int i = 0; i < ITERATIONS; i++ ) {
+    writer.send( payload );
+    poller.poll( -1 );
+  }
+
+  report( "poller", "idle_fds=" + to_string( idle_count ), "dispatch",
+	  double( timestamp_ns() - start ) / ITERATIONS, "ns/event" );
+}
+
+/* count timers, as the sender keeps one per flow: moving one's
+   deadline (as each ack moves a flow's retransmission deadline)
+   should cost O(log count), as should firing one from poll() */
+static void bench_timers( const unsigned int count )
+{
+  const unsigned int ITERATIONS = 1000000;
+  const uint64_t FAR = 1000000000000; /* (never reached) */
+
+  Poller poller;
+  vector<Poller::TimerId> timers;
+  unsigned int fired = 0;
+  for ( unsigned int i = 0; i < count; i++ ) {
+    timers.push_back( poller.add_timer( [&] () {
+	  fired++;
+	  return ResultType::Continue;
+	} ) );
+    poller.set_timer( timers.back(), FAR + i );
+  }
+
+  /* move the deadlines, in a scrambled order */
+  uint64_t start = timestamp_ns();
+  for ( unsigned int i = 0; i < ITERATIONS; i++ ) {
+    poller.set_timer( timers[ uint64_t( i ) * 7919 % count ],
+		      FAR + uint64_t( i ) * 104729 % (count * 16) );
+  }
+  report( "timers", "timers=" + to_string( count ), "set",
+	  double( timestamp_ns() - start ) / ITERATIONS, "ns/op" );
+
+  /* make them all due, and fire them with one poll */
+  const uint64_t now = timestamp_ns();
+  for ( unsigned int i = 0; i < count; i++ ) {
+    poller.set_timer( timers[ i ], now - (i * 7919) % count );
+  }
+  start = timestamp_ns();
+  poller.poll( 0 );
+  if ( fired != count ) {
+    throw runtime_error( "not every due timer fired" );
+  }
+  report( "timers", "timers=" + to_string( count ), "fire",
+	  double( timestamp_ns() - start ) / count, "ns/timer" );
+}
+
+/* round trips of a datagram to an echo thread that turns it into
+   an ack (as the receiver does), one at a time */
+static void bench_ping_pong( void )
+{
+  const unsigned int WARMUP = 1000, ITERATIONS = 100000;
+
+  UDPSocket server, client;
+  server.set_timestamps();
+  bind_loopback( server );
+  client.connect( server.local_address() );
+
+  thread echo( [&server] () {
+      char buffer[ ContestMessageView::MAX_ACK_LENGTH + DATAGRAM_LENGTH ];
+      uint64_t sequence_number = 0;
+      while ( true ) {
+	const auto datagram = server.recv( buffer, sizeof( buffer ) );
+	if ( datagram.length == 0 ) {
+	  return;
+	}
+
+	ContestMessageView message( datagram.payload, datagram.length );
+	const size_t length = message.transform_into_ack( sequence_number++, datagram.timestamp );
+	message.set_send_timestamp();
+	server.sendto( datagram.source_address, string( buffer, length ) );
+      }
+    } );
+
+  string datagram( DATAGRAM_LENGTH, 'x' );
+  char ack[ ContestMessageView::MAX_ACK_LENGTH ];
+  vector<uint64_t> rtts;
+  rtts.reserve( ITERATIONS );
+
+  for ( unsigned int i = 0; i < WARMUP + ITERATIONS; i++ ) {
+    ContestMessageView message( datagram );
+    message.init_header( i );
+    message.set_send_timestamp();
+    client.send( datagram );
+
+    client.recv( ack, sizeof( ack ) );
+    const uint64_t rtt = timestamp_ns() - message.send_timestamp();
+    if ( i >= WARMUP ) {
+      rtts.push_back( rtt );
+    }
+  }
+
+  /* an empty datagram stops the echo thread */
+  client.send( string() );
+  echo.join();
+
+  sort( rtts.begin(), rtts.end() );
+  const vector<pair<double, string>> quantiles = { { 0.5, "p50" }, { 0.99, "p99" }, { 0.999, "p99.9" } };
+  for ( const auto & quantile : quantiles ) {
+    const size_t index = min( rtts.size() - 1, size_t( quantile.first * rtts.size() ) );
+    report( "ping_pong", "length=" + to_string( DATAGRAM_LENGTH ), quantile.second,
+	    rtts[ index ] / 1000.0, "us" );
+  }
+}
+
+/* how fast datagrams can be received, with a sender thread keeping
+   the receiver supplied with batches of full-sized datagrams (as the
+   sender does) for a second */
+static void bench_packet_rate( const bool use_io_uring )
+{
+  const uint64_t DURATION = 1000000000;
+  const unsigned int BATCH_SIZE = 32;
+
+  UDPSocket receiver;
+  receiver.set_timestamps();
+  bind_loopback( receiver );
+
+  /* the sender keeps at most this many datagrams ahead of the receiver
+     (well within its socket buffer), so what is measured is how fast
+     the receiver takes datagrams in, not how many the kernel drops */
+  const uint64_t MAX_IN_FLIGHT = 2 * BATCH_SIZE;
+
+  atomic<bool> sending( true );
+  atomic<uint64_t> received( 0 );
+  uint64_t sent = 0;
+
+  thread sender_thread( [&] () {
+      UDPSocket sender;
+      sender.connect( receiver.local_address() );
+
+      PacketPool pool( BATCH_SIZE );
+      vector<Packet> datagrams;
+      for ( unsigned int i = 0; i < BATCH_SIZE; i++ ) {
+	datagrams.push_back( pool.get() );
+	datagrams.back().set_length( DATAGRAM_LENGTH );
+      }
+
+      const uint64_t start = timestamp_ns();
+      while ( timestamp_ns() - start < DURATION ) {
+	if ( sent + BATCH_SIZE > received + MAX_IN_FLIGHT ) {
+	  this_thread::yield();
+	  continue;
+	}
+
+	for ( auto & datagram : datagrams ) {
+	  ContestMessageView message( datagram );
+	  message.init_header( sent++ );
+	  message.set_send_timestamp();
+	}
+	sender.send_batch( datagrams, datagrams.size() );
+      }
+      sending = false;
+    } );
+
+  const uint64_t start = timestamp_ns();
+  uint64_t last_arrival = start;
+
+  if ( use_io_uring ) {
+    UringPoller poller;
+    poller.add_receiver( receiver, [&] ( const UDPSocket::received_datagram_view & ) {
+	received.fetch_add( 1 );
+	return ResultType::Continue;
+      } );
+
+    /* run until the sender has stopped and the socket has drained */
+    while ( poller.poll( 100 ).result != PollResult::Timeout or sending ) {
+      last_arrival = timestamp_ns();
+    }
+  } else {
+    DatagramBatch batch( BATCH_SIZE );
+    Poller poller;
+    poller.add_action( Action( receiver, Direction::In, [&] () {
+	  received.fetch_add( receiver.recv_batch( batch ) );
+	  return ResultType::Continue;
+	} ) );
+
+    while ( poller.poll( 100 ).result != PollResult::Timeout or sending ) {
+      last_arrival = timestamp_ns();
+    }
+  }
+
+  sender_thread.join();
+
+  const string parameter = use_io_uring ? "io_uring" : "recvmmsg";
+  report( "packet_rate", parameter, "sent", sent * 1e9 / DURATION, "datagrams/s" );
+  report( "packet_rate", parameter, "received", received * 1e9 / (last_arrival - start), "datagrams/s" );
+  report( "packet_rate", parameter, "delivered", 100.0 * received / sent, "%" );
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  /* run the benchmarks named on the command line, or all of them */
+  const vector<string> all = { "header", "controller", "scoreboard", "poller", "timers",
+			       "ping_pong", "packet_rate" };
+  vector<string> selected( argv + 1, argv + argc );
+  if ( selected.empty() ) {
+    selected = all;
+  }
+
+  for ( const auto & name : selected ) {
+    if ( find( all.begin(), all.end(), name ) == all.end() ) {
+      cerr << "Usage: " << argv[ 0 ] << " [header] [controller] [scoreboard] [poller] [timers] [ping_pong] [packet_rate]" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  try {
+    cout << "benchmark,parameter,metric,value,unit" << endl;
+
+    for ( const auto & name : selected ) {
+      if ( name == "header" ) {
+	bench_header();
+      } else if ( name == "controller" ) {
+	bench_controller( "interpolation", { "order=3", "stride=3" } );
+	bench_controller( "interpolation", { "order=3", "stride=20" } );
+	bench_controller( "interpolation", { "order=6", "stride=10" } );
+      } else if ( name == "scoreboard" ) {
+	for ( const unsigned int window : { 16, 256, 4096 } ) {
+	  bench_scoreboard( window );
+	}
+      } else if ( name == "poller" ) {
+	for ( const unsigned int idle_count : { 0, 16, 256, 1000 } ) {
+	  bench_poller( idle_count );
+	}
+      } else if ( name == "timers" ) {
+	for ( const unsigned int count : { 1, 64, 1000, 100000 } ) {
+	  bench_timers( count );
+	}
+      } else if ( name == "ping_pong" ) {
+	bench_ping_pong();
+      } else if ( name == "packet_rate" ) {
+	bench_packet_rate( false );
+	bench_packet_rate( true );
+      }
+    }
+  } catch ( const exception & e ) {
+    print_exception( e );
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#include <iostream>
+
+#include "aimd_controller.hh"
+
+using namespace std;
+
+/* nanoseconds per millisecond */
+const static double kNanosPerMilli = 1e6;
+
+AIMDController::AIMDController( const bool debug, const ControllerParams & params )
+  : Controller( debug ),
+    increase_( params.get( "increase", 1.0 ) ),
+    decrease_( params.get( "decrease", 0.5 ) ),
+    delay_threshold_ms_( params.get( "delay_threshold_ms", 100 ) ),
+    grace_ms_( params.get( "grace_ms", 50 ) ),
+    min_window_( params.get( "min_window", 1 ) ),
+    pacing_gain_( params.get( "pacing_gain", 1.25 ) ),
+    the_window_size( params.get( "initial_window", 4 ) ),
+    srtt_ms( 0 ),
+    grace_end( 0 )
+{}
+
+/* Get current window size, in datagrams */
+unsigned int AIMDController::window_size( void )
+{
+  return (unsigned int)the_window_size;
+}
+
+/* Get current pacing rate, in datagrams per second */
+double AIMDController::pacing_rate( void )
+{
+  return window_pacing_rate( the_window_size, srtt_ms, pacing_gain_ );
+}
+
+void AIMDController::decrease( void )
+{
+  the_window_size = max( min_window_, the_window_size * decrease_ );
+
+  if ( debug_ ) {
+    cerr << "window decreased to " << the_window_size << endl;
+  }
+}
+
+/* An ack was received */
+void AIMDController::ack_received( const uint64_t sequence_number_acked,
+				   const uint64_t send_timestamp_acked,
+				   const uint64_t recv_timestamp_acked __attribute__((unused)),
+				   const uint64_t timestamp_ack_received,
+				   const uint64_t payload_length_acked __attribute__((unused)) )
+{
+  const double rtt_ms = (timestamp_ack_received - send_timestamp_acked) / kNanosPerMilli;
+  srtt_ms = srtt_ms == 0 ? rtt_ms : 0.875 * srtt_ms + 0.125 * rtt_ms;
+
+  if ( rtt_ms > delay_threshold_ms_ ) {
+    if ( timestamp_ack_received >= grace_end ) {
+      decrease();
+      grace_end = timestamp_ack_received + grace_ms_ * kNanosPerMilli;
+    }
+  } else {
+    the_window_size += increase_ / the_window_size;
+  }
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_ack_received
+	 << " received ack for datagram " << sequence_number_acked
+	 << " (rtt " << rtt_ms << " ms), window " << the_window_size << endl;
+  }
+}
+
+/* A datagram was presumed lost */
+void AIMDController::loss_detected( const uint64_t sequence_number,
+				    const uint64_t send_timestamp __attribute__((unused)),
+				    const uint64_t timestamp )
+{
+  if ( timestamp >= grace_end ) {
+    decrease();
+    grace_end = timestamp + grace_ms_ * kNanosPerMilli;
+  }
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp
+	 << " datagram " << sequence_number << " presumed lost" << endl;
+  }
+}
+
+void AIMDController::timeout_occurred( void )
+{
+  decrease();
+}
@@ -0,0 +1,48 @@
+#ifndef AIMD_CONTROLLER_HH
+#define AIMD_CONTROLLER_HH
+
+#include "controller.hh"
+
+/* Additive-increase, multiplicative-decrease window controller.
+   Grows by increase/window per ack (so by `increase` per RTT) and
+   shrinks by `decrease` when an RTT sample exceeds the delay
+   threshold, a datagram is lost or a timeout occurs (at most
+   once per grace period, except for timeouts) */
+class AIMDController : public Controller
+{
+private:
+  /* tunables */
+  double increase_;            /* datagrams per RTT */
+  double decrease_;            /* multiplicative factor */
+  double delay_threshold_ms_;  /* RTT that counts as congestion */
+  double grace_ms_;            /* hold-off after each decrease */
+  double min_window_;          /* in datagrams */
+  double pacing_gain_;         /* 0 disables pacing */
+
+  double the_window_size;
+  double srtt_ms;
+  uint64_t grace_end; /* in nanoseconds */
+
+  void decrease( void );
+
+public:
+  AIMDController( const bool debug, const ControllerParams & params );
+
+  unsigned int window_size( void ) override;
+
+  double pacing_rate( void ) override;
+
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received,
+		     const uint64_t payload_length_acked ) override;
+
+  void loss_detected( const uint64_t sequence_number,
+		      const uint64_t send_timestamp,
+		      const uint64_t timestamp ) override;
+
+  void timeout_occurred( void ) override;
+};
+
+#endif
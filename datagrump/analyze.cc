@@ -0,0 +1,133 @@
+/* local scoring of a mahimahi link log: throughput, delay and power */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "link_stats.hh"
+
+using namespace std;
+
+/* nanoseconds per millisecond */
+static const uint64_t MILLION = 1000000;
+
+/* parse an unsigned decimal number, advancing the cursor past it */
+static bool parse_number( const char * & cursor, uint64_t & value )
+{
+  while ( *cursor == ' ' ) {
+    cursor++;
+  }
+
+  if ( *cursor < '0' or *cursor > '9' ) {
+    return false;
+  }
+
+  value = 0;
+  while ( *cursor >= '0' and *cursor <= '9' ) {
+    value = value * 10 + (*cursor - '0');
+    cursor++;
+  }
+
+  return true;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc != 2 and argc != 3 ) {
+    cerr << "Usage: " << argv[ 0 ] << " LOGFILE [WINDOW_MS]" << endl;
+    cerr << "With WINDOW_MS, also prints \"time_s capacity_mbps throughput_mbps\""
+	 << " for each window to stdout." << endl;
+    return EXIT_FAILURE;
+  }
+
+  ifstream log( argv[ 1 ] );
+  if ( not log ) {
+    cerr << argv[ 1 ] << ": could not open" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const uint64_t window_ms = argc == 3 ? stoull( argv[ 2 ] ) : 0;
+
+  uint64_t base_timestamp = 0;
+
+  cout << fixed << setprecision( 3 );
+  LinkStats stats( window_ms * MILLION,
+		   [&] ( const uint64_t start, const double capacity, const double throughput ) {
+		     cout << double( start ) / 1e9 << " " << capacity << " " << throughput << "\n";
+		   } );
+
+  /* stream the log: "TIME # BYTES" is a delivery opportunity,
+     "TIME + BYTES" an arrival and "TIME - BYTES DELAY" a departure */
+  string line;
+  uint64_t line_number = 0;
+  while ( getline( log, line ) ) {
+    line_number++;
+
+    if ( line.compare( 0, 17, "# base timestamp:" ) == 0 ) {
+      base_timestamp = stoull( line.substr( 17 ) );
+      continue;
+    } else if ( line.empty() or line[ 0 ] == '#' ) {
+      continue;
+    }
+
+    const char * cursor = line.c_str();
+    uint64_t timestamp, bytes, delay;
+
+    if ( not parse_number( cursor, timestamp ) ) {
+      cerr << argv[ 1 ] << ":" << line_number << ": unparseable line" << endl;
+      return EXIT_FAILURE;
+    }
+
+    while ( *cursor == ' ' ) {
+      cursor++;
+    }
+    const char event = *cursor++;
+
+    if ( not parse_number( cursor, bytes ) ) {
+      cerr << argv[ 1 ] << ":" << line_number << ": missing byte count" << endl;
+      return EXIT_FAILURE;
+    }
+
+    const uint64_t time = (timestamp - base_timestamp) * MILLION;
+
+    switch ( event ) {
+    case '#':
+      stats.opportunity( time, bytes );
+      break;
+    case '-':
+      if ( not parse_number( cursor, delay ) ) {
+	cerr << argv[ 1 ] << ":" << line_number << ": departure without delay" << endl;
+	return EXIT_FAILURE;
+      }
+      stats.delivery( time, bytes, delay );
+      break;
+    case '+':
+      stats.finish( time );
+      break;
+    default:
+      cerr << argv[ 1 ] << ":" << line_number << ": unknown event '" << event << "'" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  cout << flush;
+
+  cerr << fixed << setprecision( 2 )
+       << "Duration: " << stats.duration_seconds() << " s" << endl
+       << "Average capacity: " << stats.capacity_mbps() << " Mbits/s" << endl
+       << "Average throughput: " << stats.throughput_mbps() << " Mbits/s ("
+       << (stats.capacity_mbps() > 0 ? 100 * stats.throughput_mbps() / stats.capacity_mbps() : 0)
+       << "% utilization)" << endl
+       << "95th percentile per-packet queueing delay: " << stats.delay_percentile_ms( 0.95 ) << " ms" << endl
+       << "Power: " << stats.power() << " (Mbits/s per second of delay)" << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "bbr_controller.hh"
+#include "event_trace.hh"
+
+using namespace std;
+
+/* nanoseconds per millisecond and per second */
+const static double kNanosPerMilli = 1e6;
+const static double kNanosPerSecond = 1e9;
+
+/* ProbeBW pacing gains, one phase per minimum RTT */
+static const unsigned int PROBE_BW_PHASES = 8;
+static const double PROBE_BW_GAINS[ PROBE_BW_PHASES ] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+/* Startup is over when the bandwidth grows less than this much ... */
+static const double FULL_BANDWIDTH_GROWTH = 1.25;
+/* ... for this many round trips in a row */
+static const unsigned int FULL_BANDWIDTH_ROUNDS = 3;
+
+BbrController::BbrController( const bool debug, const ControllerParams & params )
+  : Controller( debug ),
+    high_gain_( params.get( "high_gain", 2.885 ) ),
+    cwnd_gain_( params.get( "cwnd_gain", 2 ) ),
+    min_rtt_window_( params.get( "min_rtt_window_s", 10 ) * kNanosPerSecond ),
+    probe_rtt_time_( params.get( "probe_rtt_ms", 200 ) * kNanosPerMilli ),
+    min_window_( params.get( "min_window", 4 ) ),
+    initial_window_( params.get( "initial_window", 10 ) ),
+    max_bandwidth_( params.get( "bw_window_rounds", 10 ) ),
+    min_rtt_( 0 ),
+    min_rtt_stamp_( 0 ),
+    datagram_bytes_( 0 ),
+    delivered_( 0 ),
+    delivered_time_( 0 ),
+    first_sent_time_( 0 ),
+    sent_( 64 ),
+    base_( 0 ),
+    next_sequence_number_( 0 ),
+    in_flight_( 0 ),
+    round_count_( 0 ),
+    next_round_delivered_( 0 ),
+    round_start_( false ),
+    filled_pipe_( false ),
+    full_bandwidth_( 0 ),
+    full_bandwidth_rounds_( 0 ),
+    mode_( Mode::Startup ),
+    pacing_gain_( high_gain_ ),
+    cycle_index_( 0 ),
+    cycle_stamp_( 0 ),
+    probe_rtt_done_( 0 ),
+    probe_rtt_round_done_( false ),
+    prior_window_( 0 ),
+    the_window_size( initial_window_ )
+{}
+
+/* Get current window size, in datagrams */
+unsigned int BbrController::window_size( void )
+{
+  if ( mode_ == Mode::ProbeRTT ) {
+    return (unsigned int)min( the_window_size, min_window_ );
+  }
+
+  return (unsigned int)the_window_size;
+}
+
+/* Get current pacing rate, in datagrams per second
+   (unpaced until there is a bandwidth sample) */
+double BbrController::pacing_rate( void )
+{
+  if ( datagram_bytes_ == 0 ) {
+    return 0;
+  }
+
+  return pacing_gain_ * bandwidth() / datagram_bytes_;
+}
+
+/* the bandwidth-delay product, in datagrams, times gain */
+double BbrController::bdp( const double gain ) const
+{
+  if ( min_rtt_ == 0 or bandwidth() == 0 or datagram_bytes_ == 0 ) {
+    return initial_window_;
+  }
+
+  return gain * bandwidth() * (min_rtt_ / kNanosPerSecond) / datagram_bytes_;
+}
+
+BbrController::SentDatagram * BbrController::find( const uint64_t sequence_number )
+{
+  if ( sequence_number < base_ or sequence_number >= next_sequence_number_ ) {
+    return nullptr;
+  }
+
+  return &at( sequence_number );
+}
+
+/* forget the datagrams at the front that are no longer in flight */
+void BbrController::trim( void )
+{
+  while ( base_ < next_sequence_number_ and at( base_ ).state != SentDatagram::State::InFlight ) {
+    base_++;
+  }
+}
+
+/* A datagram was sent */
+void BbrController::datagram_was_sent( const uint64_t sequence_number,
+				       const uint64_t send_timestamp )
+{
+  Controller::datagram_was_sent( sequence_number, send_timestamp );
+
+  if ( sequence_number != next_sequence_number_ ) {
+    throw runtime_error( "BbrController: datagrams must be sent in sequence" );
+  }
+
+  /* after an idle spell, the rate is measured from now */
+  if ( in_flight_ == 0 ) {
+    first_sent_time_ = delivered_time_ = send_timestamp;
+  }
+
+  /* double the ring when it is full */
+  if ( next_sequence_number_ - base_ == sent_.size() ) {
+    vector<SentDatagram> bigger( 2 * sent_.size() );
+    for ( uint64_t n = base_; n < next_sequence_number_; n++ ) {
+      bigger[ n & (bigger.size() - 1) ] = at( n );
+    }
+    sent_.swap( bigger );
+  }
+
+  at( sequence_number ) = { send_timestamp, delivered_, delivered_time_, first_sent_time_,
+			    SentDatagram::State::InFlight };
+  next_sequence_number_++;
+  in_flight_++;
+}
+
+/* one delivery-rate sample: the bytes delivered while the datagram
+   was in flight, over the longer of the time it took to send them
+   and the time it took to ack them (the shorter can be compressed
+   by bursts) */
+void BbrController::sample_delivery_rate( const SentDatagram & datagram, const uint64_t now )
+{
+  const uint64_t delivered = delivered_ - datagram.delivered;
+  const uint64_t send_elapsed = datagram.send_timestamp - datagram.first_sent_time;
+  const uint64_t ack_elapsed = now - datagram.delivered_time;
+  const uint64_t interval = max( send_elapsed, ack_elapsed );
+
+  first_sent_time_ = datagram.send_timestamp;
+
+  /* an interval shorter than the minimum RTT can't be trusted */
+  if ( interval == 0 or interval < min_rtt_ ) {
+    return;
+  }
+
+  max_bandwidth_.update( delivered * kNanosPerSecond / interval, round_count_ );
+}
+
+/* the minimum RTT over its window (updated when a sample is as low,
+   or the old one has expired) */
+void BbrController::update_min_rtt( const uint64_t rtt, const uint64_t now )
+{
+  /* (there is nothing to expire before the first sample) */
+  const bool expired = min_rtt_ != 0 and now > min_rtt_stamp_ + min_rtt_window_;
+  if ( min_rtt_ == 0 or rtt <= min_rtt_ or expired ) {
+    min_rtt_ = rtt;
+    min_rtt_stamp_ = now;
+  }
+
+  /* the queue has to drain for a fresh measurement */
+  if ( expired and mode_ != Mode::ProbeRTT ) {
+    mode_ = Mode::ProbeRTT;
+    pacing_gain_ = 1;
+    prior_window_ = the_window_size;
+    probe_rtt_done_ = 0;
+  }
+}
+
+/* the pipe is full once the bandwidth stops growing */
+void BbrController::check_full_pipe( void )
+{
+  if ( filled_pipe_ or not round_start_ ) {
+    return;
+  }
+
+  if ( bandwidth() >= full_bandwidth_ * FULL_BANDWIDTH_GROWTH ) {
+    full_bandwidth_ = bandwidth();
+    full_bandwidth_rounds_ = 0;
+    return;
+  }
+
+  if ( ++full_bandwidth_rounds_ >= FULL_BANDWIDTH_ROUNDS ) {
+    filled_pipe_ = true;
+  }
+}
+
+void BbrController::enter_probe_bw( const uint64_t now )
+{
+  /* start cruising, rather than by probing up or draining */
+  mode_ = Mode::ProbeBW;
+  cycle_index_ = 2;
+  pacing_gain_ = PROBE_BW_GAINS[ cycle_index_ ];
+  cycle_stamp_ = now;
+}
+
+/* move between the modes, and through the ProbeBW phases */
+void BbrController::update_mode( const uint64_t now )
+{
+  if ( mode_ == Mode::Startup and filled_pipe_ ) {
+    mode_ = Mode::Drain;
+    pacing_gain_ = 1 / high_gain_;
+  }
+
+  if ( mode_ == Mode::Drain and in_flight_ <= bdp( 1 ) ) {
+    enter_probe_bw( now );
+  }
+
+  if ( mode_ == Mode::ProbeBW ) {
+    /* probing up lasts until the extra data is in flight;
+       draining ends early once the queue is gone */
+    const bool full_length = now - cycle_stamp_ > min_rtt_;
+    bool next_phase = full_length;
+    if ( pacing_gain_ > 1 ) {
+      next_phase = full_length and in_flight_ >= bdp( pacing_gain_ );
+    } else if ( pacing_gain_ < 1 ) {
+      next_phase = full_length or in_flight_ <= bdp( 1 );
+    }
+
+    if ( next_phase ) {
+      cycle_index_ = (cycle_index_ + 1) % PROBE_BW_PHASES;
+      pacing_gain_ = PROBE_BW_GAINS[ cycle_index_ ];
+      cycle_stamp_ = now;
+    }
+  }
+
+  if ( mode_ == Mode::ProbeRTT ) {
+    if ( probe_rtt_done_ == 0 and in_flight_ <= min_window_ ) {
+      /* hold the window down for probe_rtt_ms and a round trip */
+      probe_rtt_done_ = now + probe_rtt_time_;
+      probe_rtt_round_done_ = false;
+      next_round_delivered_ = delivered_;
+    } else if ( probe_rtt_done_ ) {
+      if ( round_start_ ) {
+	probe_rtt_round_done_ = true;
+      }
+
+      if ( probe_rtt_round_done_ and now >= probe_rtt_done_ ) {
+	min_rtt_stamp_ = now;
+	the_window_size = max( the_window_size, prior_window_ );
+	if ( filled_pipe_ ) {
+	  enter_probe_bw( now );
+	} else {
+	  mode_ = Mode::Startup;
+	  pacing_gain_ = high_gain_;
+	}
+      }
+    }
+  }
+}
+
+/* grow the window towards the model's target, by at most
+   what was just acked (so it recovers gradually after a timeout) */
+void BbrController::update_window( const uint64_t acked )
+{
+  const double gain = mode_ == Mode::Startup or mode_ == Mode::Drain ? high_gain_ : cwnd_gain_;
+  const double target = bdp( gain );
+
+  if ( filled_pipe_ ) {
+    the_window_size = min( the_window_size + acked, target );
+  } else if ( the_window_size < target ) {
+    the_window_size += acked;
+  }
+
+  the_window_size = max( min_window_, the_window_size );
+}
+
+/* An ack was received */
+void BbrController::ack_received( const uint64_t sequence_number_acked,
+				  const uint64_t send_timestamp_acked,
+				  const uint64_t recv_timestamp_acked __attribute__((unused)),
+				  const uint64_t timestamp_ack_received,
+				  const uint64_t payload_length_acked )
+{
+  SentDatagram * const datagram = find( sequence_number_acked );
+  if ( not datagram or datagram->state == SentDatagram::State::Acked
+       or timestamp_ack_received < send_timestamp_acked ) {
+    return; /* already acked, or long forgotten */
+  }
+
+  if ( datagram->state == SentDatagram::State::InFlight ) {
+    in_flight_--;
+  }
+  datagram->state = SentDatagram::State::Acked;
+
+  datagram_bytes_ = max( datagram_bytes_, payload_length_acked );
+  delivered_ += payload_length_acked;
+  delivered_time_ = timestamp_ack_received;
+
+  /* a round trip ends when a datagram sent after it began is acked */
+  round_start_ = datagram->delivered >= next_round_delivered_;
+  if ( round_start_ ) {
+    next_round_delivered_ = delivered_;
+    round_count_++;
+  }
+
+  sample_delivery_rate( *datagram, timestamp_ack_received );
+  trim();
+
+  update_min_rtt( timestamp_ack_received - send_timestamp_acked, timestamp_ack_received );
+  check_full_pipe();
+  update_mode( timestamp_ack_received );
+  update_window( 1 );
+
+  if ( round_start_ ) {
+    EventTracer::record( TraceEvent::PathModel, timestamp_ack_received,
+			 bandwidth(), min_rtt_ / kNanosPerMilli, pacing_gain_ );
+  }
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_ack_received
+	 << " received ack for datagram " << sequence_number_acked
+	 << " (bandwidth " << bandwidth() << " bytes/s, min rtt "
+	 << min_rtt_ / kNanosPerMilli << " ms, pacing gain " << pacing_gain_
+	 << "), window " << the_window_size << endl;
+  }
+}
+
+/* A datagram was presumed lost: it no longer counts as in flight
+   (the model itself doesn't react to loss) */
+void BbrController::loss_detected( const uint64_t sequence_number,
+				   const uint64_t send_timestamp __attribute__((unused)),
+				   const uint64_t timestamp __attribute__((unused)) )
+{
+  SentDatagram * const datagram = find( sequence_number );
+  if ( datagram and datagram->state == SentDatagram::State::InFlight ) {
+    datagram->state = SentDatagram::State::Lost;
+    in_flight_--;
+    trim();
+  }
+}
+
+/* everything in flight is presumed lost: start again from the
+   minimum window, growing back towards the model's target */
+void BbrController::timeout_occurred( void )
+{
+  for ( uint64_t n = base_; n < next_sequence_number_; n++ ) {
+    if ( at( n ).state == SentDatagram::State::InFlight ) {
+      at( n ).state = SentDatagram::State::Lost;
+    }
+  }
+  in_flight_ = 0;
+  trim();
+
+  the_window_size = min_window_;
+}
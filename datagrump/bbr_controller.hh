@@ -0,0 +1,128 @@
+#ifndef BBR_CONTROLLER_HH
+#define BBR_CONTROLLER_HH
+
+#include <vector>
+
+#include "controller.hh"
+#include "windowed_filter.hh"
+
+/* BBR-style model-based controller. Each ack yields a delivery-rate
+   sample (bytes delivered between the acked datagram's departure and
+   its ack, over the longer of the send and ack intervals, as in
+   draft-cheng-iccrg-delivery-rate-estimation). The bottleneck
+   bandwidth is the windowed maximum of those samples over the last
+   bw_window_rounds round trips, and the propagation delay the minimum
+   RTT over the last min_rtt_window_s seconds. The window is cwnd_gain
+   times their product (the BDP), and the pacing rate the bandwidth
+   times a gain that cycles through probe phases:
+
+     Startup:  double the rate each round trip until the bandwidth
+               stops growing by 25% for three rounds
+     Drain:    pace below the bandwidth until the queue Startup
+               built is gone
+     ProbeBW:  cruise at the bandwidth, probing up (1.25) and then
+               draining (0.75) once every eight minimum RTTs
+     ProbeRTT: when the minimum RTT is stale, shrink to min_window
+               for probe_rtt_ms so the queue empties and it can be
+               measured again
+
+   Nothing depends on the path's RTT or rate being known in advance. */
+class BbrController : public Controller
+{
+private:
+  enum class Mode { Startup, Drain, ProbeBW, ProbeRTT };
+
+  /* what was known when a datagram was sent, for its rate sample */
+  struct SentDatagram
+  {
+    enum class State : uint8_t { InFlight, Acked, Lost };
+
+    uint64_t send_timestamp;
+    uint64_t delivered;       /* bytes delivered before it was sent */
+    uint64_t delivered_time;  /* when the last of those was */
+    uint64_t first_sent_time; /* when the datagram acked last was sent */
+    State state;
+  };
+
+  /* tunables */
+  double high_gain_;          /* Startup pacing gain (and cwnd gain) */
+  double cwnd_gain_;          /* window, in BDPs, after Startup */
+  uint64_t min_rtt_window_;   /* in nanoseconds */
+  uint64_t probe_rtt_time_;   /* in nanoseconds */
+  double min_window_;         /* in datagrams */
+  double initial_window_;     /* in datagrams */
+
+  /* the model */
+  WindowedFilter<double> max_bandwidth_; /* in bytes per second, windowed over round trips */
+  uint64_t min_rtt_;                     /* in nanoseconds (0 until the first sample) */
+  uint64_t min_rtt_stamp_;               /* when it was measured */
+  uint64_t datagram_bytes_;              /* largest payload acked */
+
+  /* delivery-rate sampling */
+  uint64_t delivered_;        /* bytes acked so far */
+  uint64_t delivered_time_;   /* when the last of them was acked */
+  uint64_t first_sent_time_;  /* send time of the datagram acked last */
+
+  /* sent datagrams from base_ on, in a ring that doubles when full */
+  std::vector<SentDatagram> sent_;
+  uint64_t base_, next_sequence_number_;
+  uint64_t in_flight_;        /* in datagrams */
+
+  /* round trips, each ending when a datagram sent after it began is acked */
+  uint64_t round_count_;
+  uint64_t next_round_delivered_;
+  bool round_start_;
+
+  /* Startup ends when the bandwidth stops growing */
+  bool filled_pipe_;
+  double full_bandwidth_;
+  unsigned int full_bandwidth_rounds_;
+
+  Mode mode_;
+  double pacing_gain_;
+  unsigned int cycle_index_;  /* ProbeBW phase */
+  uint64_t cycle_stamp_;      /* when the phase began */
+  uint64_t probe_rtt_done_;   /* when ProbeRTT may end (0 until the queue has drained) */
+  bool probe_rtt_round_done_;
+  double prior_window_;       /* to restore after ProbeRTT */
+
+  double the_window_size;
+
+  SentDatagram & at( const uint64_t sequence_number ) { return sent_[ sequence_number & (sent_.size() - 1) ]; }
+  SentDatagram * find( const uint64_t sequence_number );
+  void trim( void );
+
+  double bandwidth( void ) const { return max_bandwidth_.best(); }
+  double bdp( const double gain ) const;
+
+  void sample_delivery_rate( const SentDatagram & datagram, const uint64_t now );
+  void update_min_rtt( const uint64_t rtt, const uint64_t now );
+  void check_full_pipe( void );
+  void update_mode( const uint64_t now );
+  void enter_probe_bw( const uint64_t now );
+  void update_window( const uint64_t acked );
+
+public:
+  BbrController( const bool debug, const ControllerParams & params );
+
+  unsigned int window_size( void ) override;
+
+  double pacing_rate( void ) override;
+
+  void datagram_was_sent( const uint64_t sequence_number,
+			  const uint64_t send_timestamp ) override;
+
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received,
+		     const uint64_t payload_length_acked ) override;
+
+  void loss_detected( const uint64_t sequence_number,
+		      const uint64_t send_timestamp,
+		      const uint64_t timestamp ) override;
+
+  void timeout_occurred( void ) override;
+};
+
+#endif
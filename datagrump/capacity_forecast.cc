@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "capacity_forecast.hh"
+
+using namespace std;
+
+/* how long the least one-way delay is remembered (the clocks' drift
+   over it has to be well under forecast_busy_ms) */
+static const uint64_t MIN_DELAY_WINDOW = 10000000000;
+
+ForecastModel::ForecastModel( const ControllerParams & params )
+  : tick_( params.get( "forecast_tick_ms", 20 ) * 1e6 ),
+    busy_queueing_( params.get( "forecast_busy_ms", 2 ) * 1e6 ),
+    horizon_ticks_( 0 ),
+    percentile_( params.get( "forecast_percentile", 5 ) / 100 ),
+    max_idle_ticks_( 0 ),
+    bin_rate_( 0 ),
+    expected_arrivals_( unsigned( params.get( "forecast_bins", 256 ) ) ),
+    log_expected_arrivals_( expected_arrivals_.size() ),
+    kernel_()
+{
+  const double tick_s = tick_ / 1e9;
+  const double max_rate = params.get( "forecast_max_rate", 4000 ); /* datagrams per second */
+  const double volatility = params.get( "forecast_volatility", 200 ); /* per second, per sqrt(second) */
+
+  if ( tick_ == 0 or expected_arrivals_.size() < 2 or max_rate <= 0 or volatility < 0
+       or percentile_ <= 0 or percentile_ >= 1 ) {
+    throw runtime_error( "ForecastModel: tick, bins, max rate and percentile must be positive"
+			 " (and the percentile below 100)" );
+  }
+
+  horizon_ticks_ = max( 1.0, round( params.get( "forecast_ms", 160 ) * 1e6 / tick_ ) );
+  max_idle_ticks_ = max( 1.0, round( params.get( "forecast_idle_ms", 1000 ) * 1e6 / tick_ ) );
+
+  bin_rate_ = max_rate / (bins() - 1);
+  for ( unsigned int i = 0; i < bins(); i++ ) {
+    expected_arrivals_[ i ] = i * bin_rate_ * tick_s;
+    log_expected_arrivals_[ i ] = i ? log( expected_arrivals_[ i ] ) : 0;
+  }
+
+  /* a tick's Gaussian step, truncated at three standard deviations */
+  const double sigma = volatility * sqrt( tick_s ) / bin_rate_;
+  const int radius = ceil( 3 * sigma );
+  kernel_.resize( 2 * radius + 1 );
+  double total = 0;
+  for ( int d = -radius; d <= radius; d++ ) {
+    kernel_[ d + radius ] = sigma > 0 ? exp( -0.5 * d * d / (sigma * sigma) ) : 1;
+    total += kernel_[ d + radius ];
+  }
+  for ( auto & x : kernel_ ) {
+    x /= total;
+  }
+}
+
+/* the distribution a tick later (mass that would step past either
+   end stays at that end) */
+void ForecastModel::evolve( const vector<double> & from, vector<double> & to ) const
+{
+  const int radius = kernel_.size() / 2;
+  const int last = bins() - 1;
+
+  fill( to.begin(), to.end(), 0.0 );
+  for ( int i = 0; i <= last; i++ ) {
+    if ( from[ i ] == 0 ) {
+      continue;
+    }
+    for ( int d = -radius; d <= radius; d++ ) {
+      to[ min( last, max( 0, i + d ) ) ] += from[ i ] * kernel_[ d + radius ];
+    }
+  }
+}
+
+/* weigh by the Poisson likelihood of the arrivals */
+void ForecastModel::observe( vector<double> & distribution, const unsigned int arrivals,
+			     const bool busy ) const
+{
+  if ( not busy ) {
+    /* P(at least `arrivals`) = 1 - P(fewer) */
+    double total = 0;
+    for ( unsigned int i = 0; i < bins(); i++ ) {
+      double term = exp( -expected_arrivals_[ i ] ), fewer = 0;
+      for ( unsigned int k = 0; k < arrivals; k++ ) {
+	fewer += term;
+	term *= expected_arrivals_[ i ] / (k + 1);
+      }
+      distribution[ i ] *= max( 0.0, 1 - fewer );
+      total += distribution[ i ];
+    }
+
+    /* (the top bin always has some chance, unless arrivals are far
+       past max_rate, so there's nothing better to go by) */
+    if ( total == 0 ) {
+      distribution.back() = total = 1;
+    }
+
+    for ( auto & x : distribution ) {
+      x /= total;
+    }
+    return;
+  }
+
+  /* (in logs, less the largest, so the weights don't underflow) */
+  double best = -numeric_limits<double>::infinity();
+  for ( unsigned int i = arrivals ? 1 : 0; i < bins(); i++ ) {
+    best = max( best, arrivals * log_expected_arrivals_[ i ] - expected_arrivals_[ i ] );
+  }
+
+  double total = 0;
+  for ( unsigned int i = 0; i < bins(); i++ ) {
+    const double weight = (i == 0 and arrivals)
+      ? 0 : exp( arrivals * log_expected_arrivals_[ i ] - expected_arrivals_[ i ] - best );
+    distribution[ i ] *= weight;
+    total += distribution[ i ];
+  }
+
+  /* nothing believed was possible: go by the arrivals alone */
+  if ( total == 0 ) {
+    for ( unsigned int i = 0; i < bins(); i++ ) {
+      distribution[ i ] = (i == 0 and arrivals)
+	? 0 : exp( arrivals * log_expected_arrivals_[ i ] - expected_arrivals_[ i ] - best );
+      total += distribution[ i ];
+    }
+  }
+
+  for ( auto & x : distribution ) {
+    x /= total;
+  }
+}
+
+/* average over the horizon of each tick's cautious rate */
+double ForecastModel::forecast( const vector<double> & distribution,
+				vector<double> & scratch, vector<double> & next ) const
+{
+  scratch = distribution;
+
+  double sum = 0;
+  for ( unsigned int tick = 0; tick < horizon_ticks_; tick++ ) {
+    evolve( scratch, next );
+    swap( scratch, next );
+
+    double cumulative = 0;
+    unsigned int bin = 0;
+    while ( bin < bins() - 1 and (cumulative += scratch[ bin ]) < percentile_ ) {
+      bin++;
+    }
+    sum += bin * bin_rate_;
+  }
+
+  return sum / horizon_ticks_;
+}
+
+CapacityForecast::CapacityForecast()
+  : distribution_(), scratch_(), next_(),
+    tick_end_( 0 ), arrivals_( 0 ), bytes_( 0 ), busy_( true ), was_busy_( false ),
+    min_delay_( MIN_DELAY_WINDOW, numeric_limits<int64_t>::max() ),
+    datagram_bytes_( 0 ),
+    forecast_( 0 )
+{}
+
+/* the tick is over: step the distribution and weigh it by the arrivals */
+void CapacityForecast::finish_tick( const ForecastModel & model )
+{
+  const bool busy = arrivals_ ? busy_ : was_busy_;
+
+  model.evolve( distribution_, next_ );
+  swap( distribution_, next_ );
+  model.observe( distribution_, arrivals_, busy );
+
+  if ( arrivals_ ) {
+    const double average = double( bytes_ ) / arrivals_;
+    datagram_bytes_ = datagram_bytes_ ? 0.875 * datagram_bytes_ + 0.125 * average : average;
+  }
+
+  arrivals_ = 0;
+  bytes_ = 0;
+  busy_ = true;
+  was_busy_ = busy;
+}
+
+/* a datagram arrived */
+void CapacityForecast::arrival( const ForecastModel & model, const uint64_t send_timestamp,
+				const uint64_t recv_timestamp, const uint64_t payload_length )
+{
+  if ( tick_end_ == 0 ) {
+    /* nothing known yet: every rate is as likely */
+    distribution_.assign( model.bins(), 1.0 / model.bins() );
+    scratch_.resize( model.bins() );
+    next_.resize( model.bins() );
+    tick_end_ = recv_timestamp + model.tick();
+  } else if ( recv_timestamp >= tick_end_ ) {
+    /* the tick being counted is over, and maybe some empty ones after it
+       (a long silence says no more than max_idle_ticks of it) */
+    const uint64_t empty_ticks = (recv_timestamp - tick_end_) / model.tick();
+    finish_tick( model );
+    for ( uint64_t i = 0; i < min<uint64_t>( empty_ticks, model.max_idle_ticks() ); i++ ) {
+      finish_tick( model );
+    }
+    tick_end_ += (empty_ticks + 1) * model.tick();
+
+    forecast_ = model.forecast( distribution_, scratch_, next_ ) * datagram_bytes_;
+  }
+
+  /* did it queue? (the clocks' difference can have either sign) */
+  const int64_t delay = int64_t( recv_timestamp - send_timestamp );
+  min_delay_.update( delay, recv_timestamp );
+  busy_ = busy_ and uint64_t( delay - min_delay_.best() ) >= model.busy_queueing();
+
+  arrivals_++;
+  bytes_ += payload_length;
+}
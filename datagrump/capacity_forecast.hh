@@ -0,0 +1,103 @@
+#ifndef CAPACITY_FORECAST_HH
+#define CAPACITY_FORECAST_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "controller.hh"
+#include "windowed_filter.hh"
+
+/* Sprout-style model of a link's delivery rate, for forecasting its
+   capacity at the receiver from when datagrams arrive (Winstein et
+   al., "Stochastic Forecasts Achieve High Throughput and Low Delay
+   over Cellular Networks", NSDI 2013). The rate is a random walk:
+   each tick it takes a Gaussian step (volatility * sqrt(tick)), and
+   the number of datagrams that arrive in the tick is a Poisson draw
+   at the rate. A distribution over the rate, in bins from zero to
+   max_rate, is evolved each tick and weighed by the likelihood of
+   the tick's arrivals.
+
+   The forecast is cautious: stepping the distribution over the
+   horizon, it averages the rate the link beats with probability
+   1 - percentile in each tick.
+
+   Arrivals only measure the link while the sender keeps it busy.
+   Sprout's sender says when it will go quiet; here the receiver
+   instead looks at the one-way delay (send to receive timestamp,
+   less its recent minimum): a tick in which every datagram queued
+   for at least forecast_busy_ms saw the link busy, and so did an empty tick
+   right after one (an outage). Otherwise, the arrivals only show the
+   link could deliver at least that many.
+
+   The model is fixed (and may be shared by any number of flows);
+   each flow's distribution is in a CapacityForecast. */
+class ForecastModel
+{
+private:
+  uint64_t tick_;               /* in nanoseconds */
+  uint64_t busy_queueing_;      /* one-way queueing that shows the link was busy */
+  unsigned int horizon_ticks_;
+  double percentile_;           /* the forecast is this quantile of the rate */
+  unsigned int max_idle_ticks_; /* longest silence taken as an outage */
+
+  double bin_rate_;             /* datagrams per second between bins */
+  std::vector<double> expected_arrivals_; /* per tick, in each bin */
+  std::vector<double> log_expected_arrivals_;
+  std::vector<double> kernel_;  /* one tick's step, from -radius to +radius bins */
+
+public:
+  ForecastModel( const ControllerParams & params );
+
+  uint64_t tick( void ) const { return tick_; }
+  unsigned int bins( void ) const { return expected_arrivals_.size(); }
+  unsigned int max_idle_ticks( void ) const { return max_idle_ticks_; }
+  uint64_t busy_queueing( void ) const { return busy_queueing_; }
+
+  /* the distribution a tick later */
+  void evolve( const std::vector<double> & from, std::vector<double> & to ) const;
+
+  /* weigh by the likelihood of `arrivals` in a tick (and renormalize):
+     exactly that many, or (if the link was not busy) at least */
+  void observe( std::vector<double> & distribution, const unsigned int arrivals,
+		const bool busy ) const;
+
+  /* cautious average rate over the horizon, in datagrams per second
+     (scratch space is passed in, so this doesn't allocate) */
+  double forecast( const std::vector<double> & distribution,
+		   std::vector<double> & scratch, std::vector<double> & next ) const;
+};
+
+/* One flow's capacity forecast, made as its datagrams arrive */
+class CapacityForecast
+{
+private:
+  std::vector<double> distribution_, scratch_, next_;
+
+  uint64_t tick_end_;       /* end of the tick being counted (0 before the first arrival) */
+  unsigned int arrivals_;   /* in the tick being counted */
+  uint64_t bytes_;
+  bool busy_;               /* so far, every arrival in it queued */
+  bool was_busy_;           /* the link was busy in the last tick */
+
+  /* one-way delay (receiver's clock less sender's) with no queue */
+  WindowedFilter<int64_t, std::less<int64_t>> min_delay_;
+  double datagram_bytes_;   /* average payload */
+
+  uint64_t forecast_;       /* in bytes per second */
+
+  void finish_tick( const ForecastModel & model );
+
+public:
+  CapacityForecast();
+
+  /* a datagram with payload_length bytes, sent at send_timestamp
+     (by the sender's clock), arrived at recv_timestamp */
+  void arrival( const ForecastModel & model, const uint64_t send_timestamp,
+		const uint64_t recv_timestamp, const uint64_t payload_length );
+
+  /* payload bytes per second the link should deliver over the horizon
+     (0 until the first tick is over) */
+  uint64_t forecast( void ) const { return forecast_; }
+};
+
+#endif /* CAPACITY_FORECAST_HH */
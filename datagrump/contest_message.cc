@@ -1,21 +1,35 @@
 #include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+#include <endian.h>
 
 #include "contest_message.hh"
 #include "timestamp.hh"
 
 using namespace std;
 
-/* helper to get the nth uint64_t field (in network byte order) */
+/* helpers to get and put the nth uint64_t field (in network byte order) */
+static uint64_t read_header_field( const size_t n, const char * const buffer )
+{
+  uint64_t network_order;
+  memcpy( &network_order, buffer + n * sizeof( uint64_t ), sizeof( network_order ) );
+  return be64toh( network_order );
+}
+
+static void write_header_field( const size_t n, char * const buffer, const uint64_t value )
+{
+  const uint64_t network_order = htobe64( value );
+  memcpy( buffer + n * sizeof( uint64_t ), &network_order, sizeof( network_order ) );
+}
+
 uint64_t get_header_field( const size_t n, const string & str )
 {
   if ( str.size() < (n + 1) * sizeof( uint64_t ) ) {
     throw runtime_error( "contest message too small to contain header" );
   }
 
-  const uint64_t * const data_ptr
-    = reinterpret_cast<const uint64_t *>( str.data() ) + n;
-
-  return be64toh( *data_ptr );
+  return read_header_field( n, str.data() );
 }
 
 /* Parse header from wire */
@@ -25,7 +39,9 @@ ContestMessage::Header::Header( const string & str )
     ack_sequence_number( get_header_field( 2, str ) ),
     ack_send_timestamp( get_header_field( 3, str ) ),
     ack_recv_timestamp( get_header_field( 4, str ) ),
-    ack_payload_length( get_header_field( 5, str ) )
+    ack_payload_length( get_header_field( 5, str ) ),
+    flow_id( get_header_field( 6, str ) ),
+    ack_forecast( get_header_field( 7, str ) )
 {}
 
 /* Parse incoming message from wire */
@@ -37,32 +53,31 @@ ContestMessage::ContestMessage( const string & str )
 /* Fill in the send_timestamp for an outgoing message */
 void ContestMessage::set_send_timestamp( void )
 {
-  header.send_timestamp = timestamp_ms();
-}
-
-/* helper to put a uint64_t field (in network byte order) */
-string put_header_field( const uint64_t n )
-{
-  const uint64_t network_order = htobe64( n );
-  return string( reinterpret_cast<const char *>( &network_order ),
-		 sizeof( network_order ) );
+  header.send_timestamp = timestamp_ns();
 }
 
 /* Make wire representation of header */
 string ContestMessage::Header::to_string( void ) const
 {
-  return put_header_field( sequence_number )
-    + put_header_field( send_timestamp )
-    + put_header_field( ack_sequence_number )
-    + put_header_field( ack_send_timestamp )
-    + put_header_field( ack_recv_timestamp )
-    + put_header_field( ack_payload_length );
+  string ret( ContestMessageView::HEADER_LENGTH, 0 );
+  ContestMessageView view( ret );
+  view.set_sequence_number( sequence_number );
+  view.set_send_timestamp( send_timestamp );
+  view.set_ack_sequence_number( ack_sequence_number );
+  view.set_ack_send_timestamp( ack_send_timestamp );
+  view.set_ack_recv_timestamp( ack_recv_timestamp );
+  view.set_ack_payload_length( ack_payload_length );
+  view.set_flow_id( flow_id );
+  view.set_ack_forecast( ack_forecast );
+  return ret;
 }
 
 /* Make wire representation of message */
 string ContestMessage::to_string( void ) const
 {
-  return header.to_string() + payload;
+  string ret = header.to_string();
+  ret.append( payload );
+  return ret;
 }
 
 /* Transform into an ack of the ContestMessage */
@@ -79,6 +94,7 @@ void ContestMessage::transform_into_ack( const uint64_t sequence_number,
   header.ack_send_timestamp = header.send_timestamp;
   header.ack_recv_timestamp = recv_timestamp;
   header.ack_payload_length = payload.length();
+  header.ack_forecast = 0;
 
   /* delete the payload */
   payload.clear();
@@ -92,13 +108,15 @@ ContestMessage::ContestMessage( const uint64_t s_sequence_number,
 {}
 
 /* Header for new message */
-ContestMessage::Header::Header( const uint64_t s_sequence_number )
+ContestMessage::Header::Header( const uint64_t s_sequence_number, const uint64_t s_flow_id )
   : sequence_number( s_sequence_number ),
     send_timestamp( -1 ),
     ack_sequence_number( -1 ),
     ack_send_timestamp( -1 ),
     ack_recv_timestamp( -1 ),
-    ack_payload_length( -1 )
+    ack_payload_length( -1 ),
+    flow_id( s_flow_id ),
+    ack_forecast( 0 )
 {}
 
 /* Is this message an ack? */
@@ -106,3 +124,266 @@ bool ContestMessage::is_ack( void ) const
 {
   return header.ack_sequence_number != uint64_t( -1 );
 }
+
+/* View an existing datagram (or an empty buffer to be filled in) */
+ContestMessageView::ContestMessageView( char * const buffer, const size_t size )
+  : ContestMessageView( buffer, size, size )
+{}
+
+ContestMessageView::ContestMessageView( char * const buffer, const size_t size,
+					const size_t capacity )
+  : buffer_( buffer ),
+    size_( size ),
+    capacity_( capacity )
+{
+  if ( size_ < HEADER_LENGTH ) {
+    throw runtime_error( "contest message too small to contain header" );
+  }
+
+  if ( capacity_ < size_ ) {
+    throw runtime_error( "contest message larger than its buffer" );
+  }
+}
+
+ContestMessageView::ContestMessageView( string & str )
+  : ContestMessageView( &str[ 0 ], str.size() )
+{}
+
+/* (an ack assembled in the packet may grow to the packet's capacity) */
+ContestMessageView::ContestMessageView( Packet & packet )
+  : ContestMessageView( packet.data(), packet.length(), packet.capacity() )
+{}
+
+uint64_t ContestMessageView::get_field( const size_t n ) const
+{
+  return read_header_field( n, buffer_ );
+}
+
+void ContestMessageView::put_field( const size_t n, const uint64_t value )
+{
+  write_header_field( n, buffer_, value );
+}
+
+/* Write a header for a new (non-ack) message */
+void ContestMessageView::init_header( const uint64_t s_sequence_number, const uint64_t s_flow_id )
+{
+  set_sequence_number( s_sequence_number );
+  set_send_timestamp( -1 );
+  set_ack_sequence_number( -1 );
+  set_ack_send_timestamp( -1 );
+  set_ack_recv_timestamp( -1 );
+  set_ack_payload_length( -1 );
+  set_flow_id( s_flow_id );
+  set_ack_forecast( 0 );
+}
+
+/* Fill in the send_timestamp for an outgoing datagram */
+void ContestMessageView::set_send_timestamp( void )
+{
+  set_send_timestamp( timestamp_ns() );
+}
+
+/* Transform into an ack in place */
+size_t ContestMessageView::transform_into_ack( const uint64_t sequence_number,
+					       const uint64_t recv_timestamp )
+{
+  /* ack the old sequence number, then assign a new one for the outgoing ack */
+  set_ack_sequence_number( get_field( 0 ) );
+  set_sequence_number( sequence_number );
+
+  /* ack the other fields */
+  set_ack_send_timestamp( get_field( 1 ) );
+  set_ack_recv_timestamp( recv_timestamp );
+  set_ack_payload_length( payload_length() );
+  set_ack_forecast( 0 );
+
+  /* the ack carries no payload */
+  size_ = HEADER_LENGTH;
+  return size_;
+}
+
+/* Is this message an ack? */
+bool ContestMessageView::is_ack( void ) const
+{
+  return ack_sequence_number() != uint64_t( -1 );
+}
+
+/* the SACK block follows the header as more uint64_t fields */
+static const size_t SACK_FIELD = ContestMessageView::HEADER_LENGTH / sizeof( uint64_t );
+
+static size_t sack_length( const unsigned int range_count )
+{
+  return ContestMessageView::HEADER_LENGTH + (2 + 2 * range_count) * sizeof( uint64_t );
+}
+
+/* Append a SACK block to an ack */
+size_t ContestMessageView::set_sack( const SackBlock & sack )
+{
+  if ( not is_ack() ) {
+    throw runtime_error( "only acks carry a SACK block" );
+  }
+
+  if ( sack.range_count > SackBlock::MAX_RANGES ) {
+    throw runtime_error( "too many SACK ranges" );
+  }
+
+  const size_t length = sack_length( sack.range_count );
+  if ( length > capacity_ ) {
+    throw runtime_error( "no room in buffer for SACK block" );
+  }
+
+  put_field( SACK_FIELD, sack.cumulative_ack );
+  put_field( SACK_FIELD + 1, sack.range_count );
+  for ( unsigned int i = 0; i < sack.range_count; i++ ) {
+    put_field( SACK_FIELD + 2 + 2 * i, sack.ranges[ i ].start );
+    put_field( SACK_FIELD + 3 + 2 * i, sack.ranges[ i ].end );
+  }
+
+  size_ = length;
+  return size_;
+}
+
+/* Does this ack carry a SACK block? */
+bool ContestMessageView::has_sack( void ) const
+{
+  return is_ack() and size_ >= sack_length( 0 );
+}
+
+/* Parse the SACK block */
+SackBlock ContestMessageView::sack( void ) const
+{
+  if ( not has_sack() ) {
+    throw runtime_error( "ack has no SACK block" );
+  }
+
+  SackBlock ret = SackBlock();
+  ret.cumulative_ack = get_field( SACK_FIELD );
+
+  const uint64_t range_count = get_field( SACK_FIELD + 1 );
+  if ( range_count > SackBlock::MAX_RANGES or size_ < sack_length( range_count ) ) {
+    throw runtime_error( "malformed SACK block" );
+  }
+
+  ret.range_count = range_count;
+  for ( unsigned int i = 0; i < ret.range_count; i++ ) {
+    ret.ranges[ i ].start = get_field( SACK_FIELD + 2 + 2 * i );
+    ret.ranges[ i ].end = get_field( SACK_FIELD + 3 + 2 * i );
+  }
+
+  return ret;
+}
+
+/* an aggregated ack lists its further datagrams after the SACK block */
+static size_t aggregate_offset( const SackBlock & sack )
+{
+  return sack_length( sack.range_count ) + sizeof( uint64_t ); /* (after the count) */
+}
+
+/* does a difference fit in an int32_t offset? */
+static bool fits_offset( const uint64_t base, const uint64_t value )
+{
+  const int64_t offset = value - base;
+  return offset >= INT32_MIN and offset <= INT32_MAX;
+}
+
+static void write_uint32( char * const buffer, const uint32_t value )
+{
+  const uint32_t network_order = htobe32( value );
+  memcpy( buffer, &network_order, sizeof( network_order ) );
+}
+
+static uint32_t read_uint32( const char * const buffer )
+{
+  uint32_t network_order;
+  memcpy( &network_order, buffer, sizeof( network_order ) );
+  return be32toh( network_order );
+}
+
+/* Can this datagram be listed in the same ack as the first one? */
+bool ContestMessageView::can_aggregate( const AckedDatagram & first, const AckedDatagram & other )
+{
+  return fits_offset( first.sequence_number, other.sequence_number )
+    and fits_offset( first.send_timestamp, other.send_timestamp )
+    and fits_offset( first.recv_timestamp, other.recv_timestamp )
+    and other.payload_length <= UINT32_MAX;
+}
+
+/* Make this an ack of datagrams.front(), listing the rest */
+size_t ContestMessageView::set_acked_datagrams( const vector<AckedDatagram> & datagrams )
+{
+  if ( datagrams.empty() ) {
+    throw runtime_error( "an ack must cover at least one datagram" );
+  }
+
+  const AckedDatagram & first = datagrams.front();
+  set_ack_sequence_number( first.sequence_number );
+  set_ack_send_timestamp( first.send_timestamp );
+  set_ack_recv_timestamp( first.recv_timestamp );
+  set_ack_payload_length( first.payload_length );
+
+  const size_t offset = aggregate_offset( sack() );
+  const size_t length = offset + (datagrams.size() - 1) * AGGREGATE_ENTRY_LENGTH;
+  if ( length > capacity_ ) {
+    throw runtime_error( "no room in buffer for aggregated ack" );
+  }
+
+  write_header_field( 0, buffer_ + offset - sizeof( uint64_t ), datagrams.size() - 1 );
+
+  char * entry = buffer_ + offset;
+  for ( auto it = datagrams.begin() + 1; it != datagrams.end(); it++ ) {
+    if ( not can_aggregate( first, *it ) ) {
+      throw runtime_error( "datagram too far from the first to aggregate" );
+    }
+
+    write_uint32( entry, it->sequence_number - first.sequence_number );
+    write_uint32( entry + 4, it->send_timestamp - first.send_timestamp );
+    write_uint32( entry + 8, it->recv_timestamp - first.recv_timestamp );
+    write_uint32( entry + 12, it->payload_length );
+    entry += AGGREGATE_ENTRY_LENGTH;
+  }
+
+  size_ = length;
+  return size_;
+}
+
+/* The datagrams this ack covers */
+AckedDatagrams ContestMessageView::acked_datagrams( void ) const
+{
+  const AckedDatagram first = { ack_sequence_number(), ack_send_timestamp(),
+				ack_recv_timestamp(), ack_payload_length() };
+
+  if ( not has_sack() ) {
+    return AckedDatagrams( first, false, SackBlock(), nullptr, 1 );
+  }
+
+  const SackBlock the_sack = sack();
+  const size_t offset = aggregate_offset( the_sack );
+  if ( size_ < offset ) {
+    return AckedDatagrams( first, true, the_sack, nullptr, 1 ); /* not aggregated */
+  }
+
+  const uint64_t further = read_header_field( 0, buffer_ + offset - sizeof( uint64_t ) );
+  if ( further > (size_ - offset) / AGGREGATE_ENTRY_LENGTH ) {
+    throw runtime_error( "malformed aggregated ack" );
+  }
+
+  return AckedDatagrams( first, true, the_sack, buffer_ + offset, 1 + further );
+}
+
+/* The nth datagram the ack covers */
+AckedDatagram AckedDatagrams::operator[]( const unsigned int n ) const
+{
+  if ( n == 0 ) {
+    return first_;
+  }
+
+  if ( n >= count_ ) {
+    throw runtime_error( "ack does not cover that many datagrams" );
+  }
+
+  const char * const entry = entries_ + (n - 1) * ContestMessageView::AGGREGATE_ENTRY_LENGTH;
+  return { first_.sequence_number + int32_t( read_uint32( entry ) ),
+	   first_.send_timestamp + int32_t( read_uint32( entry + 4 ) ),
+	   first_.recv_timestamp + int32_t( read_uint32( entry + 8 ) ),
+	   read_uint32( entry + 12 ) };
+}
@@ -2,10 +2,15 @@
 #define CONTEST_MESSAGE_HH
 
 #include <string>
+#include <vector>
 #include <cstdint>
+#include <cstddef>
+
+#include "packet_pool.hh"
 
 struct ContestMessage
 {
+  /* timestamps are in nanoseconds (see timestamp_ns()) */
   struct Header {
     uint64_t sequence_number;
     uint64_t send_timestamp;
@@ -15,8 +20,15 @@ struct ContestMessage
     uint64_t ack_recv_timestamp;
     uint64_t ack_payload_length;
 
+    /* which of the sender's flows this belongs to (acks echo it) */
+    uint64_t flow_id;
+
+    /* in an ack: the payload bytes per second the receiver forecasts
+       the link will deliver (0 if it doesn't forecast) */
+    uint64_t ack_forecast;
+
     /* Header for new message */
-    Header( const uint64_t s_sequence_number );
+    Header( const uint64_t s_sequence_number, const uint64_t s_flow_id = 0 );
 
     /* Parse header from wire */
     Header( const std::string & str );
@@ -48,4 +60,163 @@ struct ContestMessage
   bool is_ack( void ) const;
 };
 
+/* Selective acknowledgment, carried after the header of an ack:
+   which datagrams the receiver has seen from this sender so far */
+struct SackBlock
+{
+  /* most ranges one ack carries */
+  static const unsigned int MAX_RANGES = 4;
+
+  struct Range
+  {
+    uint64_t start, end; /* sequence numbers [start, end) */
+  };
+
+  /* every datagram before this has arrived
+     (or been given up on by the receiver) */
+  uint64_t cumulative_ack;
+
+  /* datagrams above cumulative_ack that have arrived,
+     starting with the range that was most recently extended */
+  unsigned int range_count;
+  Range ranges[ MAX_RANGES ];
+};
+
+/* One datagram covered by an ack: the ack's own header describes
+   the first, and an aggregated ack lists the rest after its SACK block */
+struct AckedDatagram
+{
+  uint64_t sequence_number;
+  uint64_t send_timestamp; /* sender's clock */
+  uint64_t recv_timestamp; /* receiver's clock */
+  uint64_t payload_length;
+};
+
+/* The datagrams an ack covers, parsed once (the SACK block, and
+   where the aggregated entries start) so that each is then read
+   straight from its entry */
+class AckedDatagrams
+{
+  friend class ContestMessageView;
+
+private:
+  AckedDatagram first_;   /* from the ack's header */
+  bool has_sack_;
+  SackBlock sack_;
+  const char * entries_;  /* the rest, after the SACK block */
+  unsigned int count_;
+
+  AckedDatagrams( const AckedDatagram & first, const bool has_sack, const SackBlock & sack,
+		  const char * const entries, const unsigned int count )
+    : first_( first ), has_sack_( has_sack ), sack_( sack ), entries_( entries ), count_( count ) {}
+
+public:
+  /* covering nothing (until assigned) */
+  AckedDatagrams() : first_(), has_sack_( false ), sack_(), entries_( nullptr ), count_( 0 ) {}
+
+  AckedDatagrams( const AckedDatagrams & other ) = default;
+  AckedDatagrams & operator=( const AckedDatagrams & other ) = default;
+
+  /* how many (1 unless aggregated), and the nth (0 is the one in the header) */
+  unsigned int size( void ) const { return count_; }
+  AckedDatagram operator[]( const unsigned int n ) const;
+
+  /* the ack's SACK block, if it has one */
+  bool has_sack( void ) const { return has_sack_; }
+  const SackBlock & sack( void ) const { return sack_; }
+};
+
+/* Non-owning view of a ContestMessage in a caller-provided buffer.
+   Header fields are read and written in place (in network byte order),
+   so a received datagram can be turned into an ack without copying. */
+class ContestMessageView
+{
+private:
+  char * buffer_;
+  size_t size_;
+  size_t capacity_; /* room in the buffer, for growing an ack */
+
+  uint64_t get_field( const size_t n ) const;
+  void put_field( const size_t n, const uint64_t value );
+
+public:
+  /* Length of the wire header */
+  static const size_t HEADER_LENGTH = 8 * sizeof( uint64_t );
+
+  /* Longest ack: the header, then the SACK block
+     (cumulative ack, range count, and a start and end per range) */
+  static const size_t MAX_ACK_LENGTH = HEADER_LENGTH + (2 + 2 * SackBlock::MAX_RANGES) * sizeof( uint64_t );
+
+  /* Each further datagram in an aggregated ack takes this much: its
+     sequence number and timestamps as signed 32-bit offsets from the
+     first datagram's, then its payload length (also 32 bits) */
+  static const size_t AGGREGATE_ENTRY_LENGTH = 4 * sizeof( uint32_t );
+
+  /* Can this datagram be listed in the same ack as the first one? */
+  static bool can_aggregate( const AckedDatagram & first, const AckedDatagram & other );
+
+  /* View an existing datagram (or an empty buffer to be filled in) */
+  ContestMessageView( char * const buffer, const size_t size );
+  ContestMessageView( char * const buffer, const size_t size, const size_t capacity );
+  ContestMessageView( std::string & str );
+  ContestMessageView( Packet & packet );
+
+  ContestMessageView( const ContestMessageView & other ) = default;
+  ContestMessageView & operator=( const ContestMessageView & other ) = default;
+
+  /* header accessors */
+  uint64_t sequence_number( void ) const { return get_field( 0 ); }
+  uint64_t send_timestamp( void ) const { return get_field( 1 ); }
+  uint64_t ack_sequence_number( void ) const { return get_field( 2 ); }
+  uint64_t ack_send_timestamp( void ) const { return get_field( 3 ); }
+  uint64_t ack_recv_timestamp( void ) const { return get_field( 4 ); }
+  uint64_t ack_payload_length( void ) const { return get_field( 5 ); }
+  uint64_t flow_id( void ) const { return get_field( 6 ); }
+  uint64_t ack_forecast( void ) const { return get_field( 7 ); }
+
+  void set_sequence_number( const uint64_t x ) { put_field( 0, x ); }
+  void set_send_timestamp( const uint64_t x ) { put_field( 1, x ); }
+  void set_ack_sequence_number( const uint64_t x ) { put_field( 2, x ); }
+  void set_ack_send_timestamp( const uint64_t x ) { put_field( 3, x ); }
+  void set_ack_recv_timestamp( const uint64_t x ) { put_field( 4, x ); }
+  void set_ack_payload_length( const uint64_t x ) { put_field( 5, x ); }
+  void set_flow_id( const uint64_t x ) { put_field( 6, x ); }
+  void set_ack_forecast( const uint64_t x ) { put_field( 7, x ); }
+
+  /* Whole datagram and payload sizes */
+  size_t size( void ) const { return size_; }
+  size_t payload_length( void ) const { return size_ - HEADER_LENGTH; }
+
+  /* Write a header for a new (non-ack) message */
+  void init_header( const uint64_t s_sequence_number, const uint64_t s_flow_id = 0 );
+
+  /* Fill in the send_timestamp for an outgoing datagram */
+  void set_send_timestamp( void );
+
+  /* Transform into an ack in place (keeping the flow ID, with no forecast);
+     returns the wire length of the ack */
+  size_t transform_into_ack( const uint64_t sequence_number,
+			     const uint64_t recv_timestamp );
+
+  /* Is this message an ack? */
+  bool is_ack( void ) const;
+
+  /* Append a SACK block to an ack; returns the new wire length */
+  size_t set_sack( const SackBlock & sack );
+
+  /* Does this ack carry a SACK block? */
+  bool has_sack( void ) const;
+
+  /* Parse the SACK block (throws if it is malformed) */
+  SackBlock sack( void ) const;
+
+  /* Make this an ack of datagrams.front(), listing the rest after the
+     SACK block (which must already be set); returns the new wire length */
+  size_t set_acked_datagrams( const std::vector<AckedDatagram> & datagrams );
+
+  /* The datagrams this ack covers (throws if its SACK block
+     or list of aggregated datagrams is malformed) */
+  AckedDatagrams acked_datagrams( void ) const;
+};
+
 #endif /* CONTEST_MESSAGE_HH */
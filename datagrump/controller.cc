@@ -1,49 +1,95 @@
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <stdexcept>
 
 #include "controller.hh"
-#include "timestamp.hh"
+#include "aimd_controller.hh"
+#include "bbr_controller.hh"
+#include "delay_gradient_controller.hh"
+#include "forecast_controller.hh"
+#include "interpolation_controller.hh"
 
 using namespace std;
 
-#define DEBUG(X) if (debug_) { cerr << X << endl; }
+/* parse one "key=value" setting */
+void ControllerParams::set( const string & setting )
+{
+  const size_t equals = setting.find( '=' );
+  if ( equals == string::npos or equals == 0 ) {
+    throw runtime_error( "controller setting \"" + setting + "\" is not of the form key=value" );
+  }
 
-// const static unsigned int kDelayThresh = 100;
-const static double kGamma = 0.15;
-const static double kWindowDecay = 0.8;
-const static double kWindowGrow = 1.2;
-const static unsigned int kGraceMillis = 50;
-const static unsigned int kMinWindowSize = 4;
+  values_[ setting.substr( 0, equals ) ] = setting.substr( equals + 1 );
+}
 
-const static unsigned int kMaxRTT = 100;
-const static unsigned int kMinRTT = 50;
+/* read settings from a file */
+void ControllerParams::load_file( const string & filename )
+{
+  ifstream file( filename );
+  if ( not file ) {
+    throw runtime_error( "could not open controller config file " + filename );
+  }
 
-// const static unsigned int kWindowSizeRTTProduct = 1000;
+  string line;
+  while ( getline( file, line ) ) {
+    /* strip comments and whitespace */
+    line = line.substr( 0, line.find( '#' ) );
+    const size_t first = line.find_first_not_of( " \t\r" );
+    if ( first == string::npos ) {
+      continue;
+    }
+    line = line.substr( first, line.find_last_not_of( " \t\r" ) - first + 1 );
 
-/* Default constructor */
-Controller::Controller( const bool debug )
-  : debug_( debug ), the_window_size( kMinWindowSize ), rtt_ewma ( 0.0 ), grace_end( 0 )
-{
-  for (int i = 0; i < NUM_TIMESTAMPS; ++i) {
-    rtt[i] = 0;
+    set( line );
   }
 }
 
-/* Get current window size, in datagrams */
-unsigned int Controller::window_size( void ) {
+/* look up a setting, falling back to the default */
+double ControllerParams::get( const string & key, const double default_value ) const
+{
+  const auto it = values_.find( key );
+  if ( it == values_.end() ) {
+    return default_value;
+  }
 
-  if ( debug_ ) {
-    cerr << "At time " << timestamp_ms()
-	 << " window size is " << the_window_size << endl;
+  used_.insert( key );
+
+  try {
+    return stod( it->second );
+  } catch ( const exception & e ) {
+    throw runtime_error( "controller setting " + key + " is not a number: " + it->second );
   }
+}
+
+string ControllerParams::get( const string & key, const string & default_value ) const
+{
+  const auto it = values_.find( key );
+  if ( it == values_.end() ) {
+    return default_value;
+  }
+
+  used_.insert( key );
+  return it->second;
+}
 
-  return (unsigned int)the_window_size;
+/* settings that no one has looked up */
+vector<string> ControllerParams::unused( void ) const
+{
+  vector<string> ret;
+  for ( const auto & x : values_ ) {
+    if ( not used_.count( x.first ) ) {
+      ret.push_back( x.first );
+    }
+  }
+  return ret;
 }
 
 /* A datagram was sent */
 void Controller::datagram_was_sent( const uint64_t sequence_number,
 				    /* of the sent datagram */
 				    const uint64_t send_timestamp )
-                                    /* in milliseconds */
+                                    /* in nanoseconds */
 {
   if ( debug_ ) {
     cerr << "At time " << send_timestamp
@@ -51,102 +97,44 @@ void Controller::datagram_was_sent( const uint64_t sequence_number,
   }
 }
 
-double Controller::interpolate( void )
-{
-  double total[NUM_TIMESTAMPS];
-  for(int i = 0; i < NUM_TIMESTAMPS; ++i) {
-    total[i] = 1;
-  }
-  
-  for(int i = 0; i < NUM_TIMESTAMPS; ++i) {
-    for(int j = 0; j < NUM_TIMESTAMPS; ++j) {
-      if(i == j) {
-	total[i] *= rtt[INTERVAL_LEN * i];
-      } else {
-	total[i] *= 1.0 * (NUM_TIMESTAMPS - j) / (i - j);
-      }
-    }
-  }
-
-  double sum = 0;
-  for(int i = 0; i < NUM_TIMESTAMPS; ++i) {
-    sum += total[i];
-  }
+typedef function<unique_ptr<Controller>( const bool, const ControllerParams & )> ControllerFactory;
 
-  return sum;
-  //return rtt_ewma + (rtt_ewma - rtt[0]) / NUM_TIMESTAMPS;
+/* every available congestion controller, by name */
+static const map<string, ControllerFactory> & registry( void )
+{
+  static const map<string, ControllerFactory> controllers = {
+    { "aimd", [] ( const bool debug, const ControllerParams & params ) {
+	return unique_ptr<Controller>( new AIMDController( debug, params ) ); } },
+    { "bbr", [] ( const bool debug, const ControllerParams & params ) {
+	return unique_ptr<Controller>( new BbrController( debug, params ) ); } },
+    { "delay-gradient", [] ( const bool debug, const ControllerParams & params ) {
+	return unique_ptr<Controller>( new DelayGradientController( debug, params ) ); } },
+    { "forecast", [] ( const bool debug, const ControllerParams & params ) {
+	return unique_ptr<Controller>( new ForecastController( debug, params ) ); } },
+    { "interpolation", [] ( const bool debug, const ControllerParams & params ) {
+	return unique_ptr<Controller>( new InterpolationController( debug, params ) ); } },
+  };
+
+  return controllers;
 }
 
-/* An ack was received */
-void Controller::ack_received( const uint64_t sequence_number_acked,
-			       /* what sequence number was acknowledged */
-			       const uint64_t send_timestamp_acked,
-			       /* when the acknowledged datagram was sent (sender's clock) */
-			       const uint64_t recv_timestamp_acked,
-			       /* when the acknowledged datagram was received (receiver's clock)*/
-			       const uint64_t timestamp_ack_received )
-                               /* when the ack was received (by sender) */
+unique_ptr<Controller> Controller::make( const string & name,
+					 const bool debug,
+					 const ControllerParams & params )
 {
-  unsigned int delta = timestamp_ack_received - send_timestamp_acked;
-
-  // Update list of rtts. Lower index -> earlier in time.
-  for(int i = 0; i < NUM_TIMESTAMPS * INTERVAL_LEN - 1; ++i) {
-    rtt[i] = rtt[i+1];
-  }
-  rtt_ewma = kGamma*delta + (1.0 - kGamma)*rtt_ewma;
-  rtt[NUM_TIMESTAMPS * INTERVAL_LEN - 1] = rtt_ewma;
-  double predicted_rtt = interpolate();
-
-  for(int i = 0; i < NUM_TIMESTAMPS * INTERVAL_LEN; i++) {
-    cout << rtt[i] << ' ';
-  }
-  cout << predicted_rtt << endl;
-
-  if (timestamp_ack_received < grace_end) {
-    // do nothing
-  } else if (predicted_rtt >= double(kMaxRTT)) {
-    the_window_size *= kWindowDecay;
-    grace_end = timestamp_ack_received + kGraceMillis;
-  } else if (predicted_rtt <= double(kMinRTT)) {
-    the_window_size *= kWindowGrow;
-    grace_end = timestamp_ack_received + kGraceMillis;
+  const auto it = registry().find( name );
+  if ( it == registry().end() ) {
+    throw runtime_error( "unknown congestion controller \"" + name + "\"" );
   }
 
-  if (the_window_size < double(kMinWindowSize)) {
-    the_window_size = kMinWindowSize;
-  }
-
-  /*if (timestamp_ack_received < grace_end) {
-    // do nothing
-  } else if (rtt_ewma >= double(kDelayThresh)) {
-    the_window_size *= kWindowDecay;
-    grace_end = timestamp_ack_received + kGraceMillis;
-  } else {
-    the_window_size += 1.0 / the_window_size;
-    }*/
-
-
-  if ( debug_ ) {
-    cerr << "At time " << timestamp_ack_received
-	 << " received ack for datagram " << sequence_number_acked
-	 << " (send @ time " << send_timestamp_acked
-	 << ", received @ time " << recv_timestamp_acked << " by receiver's clock)"
-	 << endl;
-  }
+  return it->second( debug, params );
 }
 
-void Controller::timeout_occurred( void )
+vector<string> Controller::names( void )
 {
-//  if ( debug_ ) {
-//    cerr << "timeout occurring" << endl;
-//  }
-//
-//  the_window_size >>= 1;
-}
-
-/* How long to wait (in milliseconds) if there are no acks
-   before sending one more datagram */
-unsigned int Controller::timeout_ms( void )
-{
-  return 300; /* timeout of one second */
+  vector<string> ret;
+  for ( const auto & x : registry() ) {
+    ret.push_back( x.first );
+  }
+  return ret;
 }
@@ -2,22 +2,50 @@
 #define CONTROLLER_HH
 
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
 
-/* Congestion controller interface */
+/* Tunables for a congestion controller, given as key=value settings
+   on the command line or (one per line) in a config file */
+class ControllerParams
+{
+private:
+  std::map<std::string, std::string> values_;
+  mutable std::set<std::string> used_;
+
+public:
+  ControllerParams() : values_(), used_() {}
+
+  /* parse one "key=value" setting (later settings win) */
+  void set( const std::string & setting );
+
+  /* read settings from a file: one "key=value" per line, '#' starts a comment */
+  void load_file( const std::string & filename );
+
+  /* look up a setting, falling back to the default */
+  double get( const std::string & key, const double default_value ) const;
+  std::string get( const std::string & key, const std::string & default_value ) const;
 
-#define NUM_TIMESTAMPS 3
-#define INTERVAL_LEN 3
+  /* settings that no one has looked up (probably typos) */
+  std::vector<std::string> unused( void ) const;
+};
 
+/* Congestion controller interface */
 class Controller
 {
-private:
+protected:
   bool debug_; /* Enables debugging output */
 
-  double the_window_size;
-  double rtt_ewma;
-  unsigned int grace_end;
-
-  unsigned int rtt[NUM_TIMESTAMPS * INTERVAL_LEN];
+  /* pacing rate (datagrams per second) that spreads a window
+     over one RTT, scaled by gain */
+  static double window_pacing_rate( const double window, const double rtt_ms,
+				    const double gain )
+  {
+    return rtt_ms > 0 ? gain * window * 1000.0 / rtt_ms : 0;
+  }
 
 public:
   /* Public interface for the congestion controller */
@@ -25,28 +53,51 @@ public:
      the call site as well (in sender.cc) */
 
   /* Default constructor */
-  Controller( const bool debug );
+  Controller( const bool debug ) : debug_( debug ) {}
+
+  virtual ~Controller() {}
 
   /* Get current window size, in datagrams */
-  unsigned int window_size( void );
+  virtual unsigned int window_size( void ) = 0;
+
+  /* Get current pacing rate, in datagrams per second (0 means unpaced) */
+  virtual double pacing_rate( void ) { return 0; }
+
+  /* All timestamps are in nanoseconds (see timestamp_ns()) */
 
   /* A datagram was sent */
-  void datagram_was_sent( const uint64_t sequence_number,
-			  const uint64_t send_timestamp );
+  virtual void datagram_was_sent( const uint64_t sequence_number,
+				  const uint64_t send_timestamp );
+
+  /* An ack was received (for a datagram with payload_length_acked
+     bytes after the header) */
+  virtual void ack_received( const uint64_t sequence_number_acked,
+			     const uint64_t send_timestamp_acked,
+			     const uint64_t recv_timestamp_acked,
+			     const uint64_t timestamp_ack_received,
+			     const uint64_t payload_length_acked ) = 0;
 
-  double interpolate( void );
+  /* A datagram was presumed lost (a later one was acked first,
+     and it did not turn up in time) */
+  virtual void loss_detected( const uint64_t sequence_number __attribute__((unused)),
+			      const uint64_t send_timestamp __attribute__((unused)),
+			      const uint64_t timestamp __attribute__((unused)) ) {}
 
-  /* An ack was received */
-  void ack_received( const uint64_t sequence_number_acked,
-		     const uint64_t send_timestamp_acked,
-		     const uint64_t recv_timestamp_acked,
-		     const uint64_t timestamp_ack_received );
+  /* An ack carried the receiver's forecast that the link will deliver
+     `forecast` payload bytes per second (see capacity_forecast.hh) */
+  virtual void forecast_received( const uint64_t forecast __attribute__((unused)),
+				  const uint64_t timestamp __attribute__((unused)) ) {}
 
-  void timeout_occurred(void);
+  /* The retransmission timer expired: the oldest datagram in flight
+     went unacked for a whole RTO, and everything in flight is now
+     presumed lost */
+  virtual void timeout_occurred( void ) {}
 
-  /* How long to wait (in milliseconds) if there are no acks
-     before sending one more datagram */
-  unsigned int timeout_ms( void );
+  /* Registry of implementations, selectable at runtime by name */
+  static std::unique_ptr<Controller> make( const std::string & name,
+					   const bool debug,
+					   const ControllerParams & params );
+  static std::vector<std::string> names( void );
 };
 
 #endif
@@ -0,0 +1,119 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include "delay_gradient_controller.hh"
+#include "event_trace.hh"
+
+using namespace std;
+
+/* nanoseconds per millisecond */
+const static double kNanosPerMilli = 1e6;
+
+DelayGradientController::DelayGradientController( const bool debug,
+						  const ControllerParams & params )
+  : Controller( debug ),
+    alpha_( params.get( "alpha", 0.3 ) ),
+    beta_( params.get( "beta", 0.8 ) ),
+    additive_increase_( params.get( "additive_increase", 1.0 ) ),
+    t_low_ms_( params.get( "t_low_ms", 10 ) ),
+    t_high_ms_( params.get( "t_high_ms", 100 ) ),
+    min_window_( params.get( "min_window", 2 ) ),
+    pacing_gain_( params.get( "pacing_gain", 1.25 ) ),
+    forward_signal_( params.get( "delay_signal", "rtt" ) == "forward" ),
+    owd_resolution_ms_( params.get( "owd_resolution_us", 10 ) / 1e3 ),
+    one_way_delay_( params.get( "owd_bucket_ms", 1000 ) * kNanosPerMilli,
+		    params.get( "owd_buckets", 30 ),
+		    params.get( "owd_max_drift_ppm", 100 ) / 1e6 ),
+    the_window_size( params.get( "initial_window", 4 ) ),
+    srtt_ms( 0 ),
+    prev_rtt_ms( 0 ),
+    rtt_diff_ms( 0 ),
+    min_rtt_ms( numeric_limits<double>::max() ),
+    next_update( 0 )
+{
+  const string signal = params.get( "delay_signal", "rtt" );
+  if ( signal != "rtt" and signal != "forward" ) {
+    throw runtime_error( "delay_signal must be rtt or forward" );
+  }
+  if ( owd_resolution_ms_ <= 0 ) {
+    throw runtime_error( "owd_resolution_us must be positive" );
+  }
+}
+
+/* Get current window size, in datagrams */
+unsigned int DelayGradientController::window_size( void )
+{
+  return (unsigned int)the_window_size;
+}
+
+/* Get current pacing rate, in datagrams per second */
+double DelayGradientController::pacing_rate( void )
+{
+  return window_pacing_rate( the_window_size, srtt_ms, pacing_gain_ );
+}
+
+/* An ack was received */
+void DelayGradientController::ack_received( const uint64_t sequence_number_acked,
+					    const uint64_t send_timestamp_acked,
+					    const uint64_t recv_timestamp_acked,
+					    const uint64_t timestamp_ack_received,
+					    const uint64_t payload_length_acked __attribute__((unused)) )
+{
+  const double measured_rtt_ms = (timestamp_ack_received - send_timestamp_acked) / kNanosPerMilli;
+  min_rtt_ms = min( min_rtt_ms, measured_rtt_ms );
+  srtt_ms = srtt_ms == 0 ? measured_rtt_ms : 0.875 * srtt_ms + 0.125 * measured_rtt_ms;
+
+  /* the RTT as it would be with only the forward path's queueing */
+  double rtt_ms = measured_rtt_ms;
+  if ( forward_signal_ ) {
+    one_way_delay_.sample( send_timestamp_acked, recv_timestamp_acked );
+    const double queueing_ms = one_way_delay_.queueing_delay() / kNanosPerMilli;
+    rtt_ms = min_rtt_ms + round( queueing_ms / owd_resolution_ms_ ) * owd_resolution_ms_;
+
+    EventTracer::record( TraceEvent::ForwardDelay, timestamp_ack_received, sequence_number_acked,
+			 one_way_delay_.queueing_delay() / kNanosPerMilli,
+			 one_way_delay_.clock_drift() * 1e6 );
+  }
+
+  /* react to at most one sample per minimum RTT */
+  if ( timestamp_ack_received < next_update ) {
+    return;
+  }
+  next_update = timestamp_ack_received + min_rtt_ms * kNanosPerMilli;
+
+  if ( prev_rtt_ms == 0 ) {
+    prev_rtt_ms = rtt_ms;
+    return;
+  }
+
+  rtt_diff_ms = (1 - alpha_) * rtt_diff_ms + alpha_ * (rtt_ms - prev_rtt_ms);
+  prev_rtt_ms = rtt_ms;
+
+  const double gradient = rtt_diff_ms / max( min_rtt_ms, 1e-3 );
+
+  if ( rtt_ms < t_low_ms_ ) {
+    the_window_size += additive_increase_;
+  } else if ( rtt_ms > t_high_ms_ ) {
+    the_window_size *= 1 - beta_ * (1 - t_high_ms_ / rtt_ms);
+  } else if ( gradient <= 0 ) {
+    the_window_size += additive_increase_;
+  } else {
+    the_window_size *= max( 0.5, 1 - beta_ * gradient );
+  }
+
+  the_window_size = max( min_window_, the_window_size );
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_ack_received
+	 << " received ack for datagram " << sequence_number_acked
+	 << " (rtt " << rtt_ms << " ms, gradient " << gradient
+	 << "), window " << the_window_size << endl;
+  }
+}
+
+void DelayGradientController::timeout_occurred( void )
+{
+  the_window_size = max( min_window_, the_window_size / 2 );
+}
@@ -0,0 +1,59 @@
+#ifndef DELAY_GRADIENT_CONTROLLER_HH
+#define DELAY_GRADIENT_CONTROLLER_HH
+
+#include "controller.hh"
+#include "one_way_delay.hh"
+
+/* TIMELY-style window controller driven by the RTT gradient.
+   About once per minimum RTT it smooths the change in RTT, normalises
+   it by the minimum RTT, and grows the window additively while the
+   gradient is non-positive or shrinks it in proportion to a positive
+   gradient. Below t_low_ms it always grows; above t_high_ms it always
+   shrinks.
+
+   With delay_signal=forward, the RTT it reacts to is the minimum RTT
+   plus the forward queueing delay (from the receiver's timestamps),
+   so queueing on the ack path doesn't make it back off. It rounds
+   the forward delay to owd_resolution_us: the drift is only known to
+   a fraction of a ppm (and not at all for the first few buckets), and
+   a gradient made of the error would keep the window from growing. */
+class DelayGradientController : public Controller
+{
+private:
+  /* tunables */
+  double alpha_;              /* EWMA gain for the RTT difference */
+  double beta_;               /* multiplicative decrease gain */
+  double additive_increase_;  /* datagrams per update */
+  double t_low_ms_;           /* always grow below this RTT */
+  double t_high_ms_;          /* always shrink above this RTT */
+  double min_window_;         /* in datagrams */
+  double pacing_gain_;        /* 0 disables pacing */
+  bool forward_signal_;       /* react to forward queueing only */
+  double owd_resolution_ms_;  /* granularity of the forward queueing delay */
+
+  OneWayDelayEstimator one_way_delay_;
+
+  double the_window_size;
+  double srtt_ms;
+  double prev_rtt_ms;
+  double rtt_diff_ms;
+  double min_rtt_ms;
+  uint64_t next_update; /* in nanoseconds */
+
+public:
+  DelayGradientController( const bool debug, const ControllerParams & params );
+
+  unsigned int window_size( void ) override;
+
+  double pacing_rate( void ) override;
+
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received,
+		     const uint64_t payload_length_acked ) override;
+
+  void timeout_occurred( void ) override;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdexcept>
+
+#include "drr_scheduler.hh"
+
+using namespace std;
+
+DrrScheduler::DrrScheduler( const unsigned int flow_count, const unsigned int quantum )
+  : quantum_( quantum ),
+    active_( flow_count ),
+    head_( 0 ),
+    count_( 0 ),
+    deficit_( flow_count ),
+    queued_( flow_count )
+{
+  if ( flow_count == 0 or quantum == 0 ) {
+    throw runtime_error( "DrrScheduler: flow count and quantum must be positive" );
+  }
+}
+
+void DrrScheduler::activate( const unsigned int flow )
+{
+  if ( queued_.at( flow ) ) {
+    return;
+  }
+
+  queued_[ flow ] = true;
+  active_[ (head_ + count_) % active_.size() ] = flow;
+  count_++;
+}
+
+void DrrScheduler::pop_front( void )
+{
+  head_ = (head_ + 1) % active_.size();
+  count_--;
+}
+
+unsigned int DrrScheduler::current( void )
+{
+  const unsigned int flow = active_[ head_ ];
+
+  /* a new turn at the head */
+  if ( deficit_[ flow ] == 0 ) {
+    deficit_[ flow ] = quantum_;
+  }
+
+  return flow;
+}
+
+void DrrScheduler::charge( void )
+{
+  const unsigned int flow = active_[ head_ ];
+
+  /* with its quantum spent, the flow goes to the back of the line */
+  if ( deficit_[ flow ] > 0 and --deficit_[ flow ] == 0 ) {
+    pop_front();
+    active_[ (head_ + count_) % active_.size() ] = flow;
+    count_++;
+  }
+}
+
+void DrrScheduler::deactivate_current( void )
+{
+  const unsigned int flow = active_[ head_ ];
+
+  /* an idle flow doesn't bank its unspent quantum */
+  deficit_[ flow ] = 0;
+  queued_[ flow ] = false;
+  pop_front();
+}
@@ -0,0 +1,46 @@
+#ifndef DRR_SCHEDULER_HH
+#define DRR_SCHEDULER_HH
+
+#include <vector>
+
+/* Deficit round robin among flows (numbered from 0) that have something
+   to send. Each time a flow comes to the head of the active list it is
+   granted a quantum of datagrams, and it keeps the head until it has
+   spent them or runs out of things to send, so every backlogged flow
+   gets the same share however many acks it happens to receive. (Every
+   datagram is the same size, so the deficit is counted in datagrams.)
+   The active list is a fixed ring with room for every flow, since a
+   flow is on it at most once, so scheduling never allocates. */
+class DrrScheduler
+{
+private:
+  unsigned int quantum_;
+
+  std::vector<unsigned int> active_; /* ring of active flows */
+  unsigned int head_, count_;
+
+  std::vector<unsigned int> deficit_;
+  std::vector<bool> queued_;
+
+  void pop_front( void );
+
+public:
+  DrrScheduler( const unsigned int flow_count, const unsigned int quantum );
+
+  /* the flow has something to send (no-op if it is already active) */
+  void activate( const unsigned int flow );
+
+  /* is any flow active? */
+  bool empty( void ) const { return count_ == 0; }
+
+  /* the flow whose turn it is (the scheduler must not be empty) */
+  unsigned int current( void );
+
+  /* the current flow sent a datagram */
+  void charge( void );
+
+  /* the current flow has nothing more to send for now */
+  void deactivate_current( void );
+};
+
+#endif /* DRR_SCHEDULER_HH */
@@ -0,0 +1,182 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "event_trace.hh"
+#include "file_descriptor.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* records per thread (a power of two); at 40 bytes each, 2.5 MiB */
+static const uint64_t RING_CAPACITY = 65536;
+
+/* how often the background thread drains the rings */
+static const chrono::milliseconds FLUSH_INTERVAL( 10 );
+
+/* write a whole buffer to a file */
+static void write_all( FileDescriptor & file, const void * const data, const size_t size )
+{
+  const char * const bytes = static_cast<const char *>( data );
+  size_t written = 0;
+  while ( written < size ) {
+    written += SystemCall( "write", ::write( file.fd_num(), bytes + written, size - written ) );
+  }
+}
+
+/* single-producer, single-consumer ring of records for one thread */
+class TraceRing
+{
+private:
+  vector<TraceRecord> records_;
+  atomic<uint64_t> head_; /* advanced by the recording thread */
+  atomic<uint64_t> tail_; /* advanced by the background thread */
+  atomic<uint64_t> dropped_;
+  uint16_t thread_;
+
+public:
+  TraceRing( const uint16_t thread )
+    : records_( RING_CAPACITY ), head_( 0 ), tail_( 0 ), dropped_( 0 ), thread_( thread )
+  {}
+
+  void push( const TraceRecord & record )
+  {
+    const uint64_t head = head_.load( memory_order_relaxed );
+    if ( head - tail_.load( memory_order_acquire ) >= RING_CAPACITY ) {
+      dropped_.fetch_add( 1, memory_order_relaxed );
+      return;
+    }
+
+    TraceRecord & slot = records_[ head & (RING_CAPACITY - 1) ];
+    slot = record;
+    slot.thread = thread_;
+    head_.store( head + 1, memory_order_release );
+  }
+
+  /* write out everything pushed so far */
+  void drain( FileDescriptor & file )
+  {
+    const uint64_t head = head_.load( memory_order_acquire );
+    uint64_t tail = tail_.load( memory_order_relaxed );
+
+    while ( tail < head ) {
+      const uint64_t index = tail & (RING_CAPACITY - 1);
+      const uint64_t count = min( head - tail, RING_CAPACITY - index );
+      write_all( file, &records_[ index ], count * sizeof( TraceRecord ) );
+      tail += count;
+    }
+
+    tail_.store( tail, memory_order_release );
+  }
+
+  uint64_t dropped( void ) const { return dropped_.load( memory_order_relaxed ); }
+};
+
+/* owns the trace file, the rings, and the background thread */
+class TraceWriter
+{
+private:
+  FileDescriptor file_;
+  mutex rings_mutex_;
+  vector<unique_ptr<TraceRing>> rings_;
+  atomic<bool> stopping_;
+  thread flusher_;
+
+public:
+  const uint64_t generation;
+
+  TraceWriter( const string & filename, const uint64_t s_generation )
+    : file_( SystemCall( "open " + filename,
+			 open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) ),
+      rings_mutex_(), rings_(), stopping_( false ), flusher_(), generation( s_generation )
+  {
+    write_all( file_, TRACE_MAGIC, sizeof( TRACE_MAGIC ) );
+
+    flusher_ = thread( [&] () {
+	while ( not stopping_ ) {
+	  this_thread::sleep_for( FLUSH_INTERVAL );
+	  flush();
+	}
+      } );
+  }
+
+  ~TraceWriter()
+  {
+    stopping_ = true;
+    flusher_.join();
+
+    try {
+      flush();
+    } catch ( const exception & e ) { /* don't throw from destructor */
+      print_exception( e );
+    }
+
+    uint64_t dropped = 0;
+    for ( const auto & ring : rings_ ) {
+      dropped += ring->dropped();
+    }
+    if ( dropped ) {
+      cerr << "Warning: event trace dropped " << dropped << " records (rings were full)" << endl;
+    }
+  }
+
+  /* give the calling thread its own ring */
+  TraceRing * new_ring( void )
+  {
+    lock_guard<mutex> lock( rings_mutex_ );
+    rings_.emplace_back( new TraceRing( rings_.size() ) );
+    return rings_.back().get();
+  }
+
+  void flush( void )
+  {
+    lock_guard<mutex> lock( rings_mutex_ );
+    for ( const auto & ring : rings_ ) {
+      ring->drain( file_ );
+    }
+  }
+
+  /* forbid copying */
+  TraceWriter( const TraceWriter & other ) = delete;
+  TraceWriter & operator=( const TraceWriter & other ) = delete;
+};
+
+atomic<TraceWriter *> EventTracer::writer_( nullptr );
+
+/* each tracing session gets a new generation, so threads know to
+   fetch a fresh ring instead of reusing one from an earlier session */
+static atomic<uint64_t> trace_generation( 0 );
+
+struct ThreadRing
+{
+  uint64_t generation;
+  TraceRing * ring;
+};
+
+static thread_local ThreadRing this_thread_ring = { 0, nullptr };
+
+void EventTracer::start( const string & filename )
+{
+  stop();
+  writer_ = new TraceWriter( filename, ++trace_generation );
+}
+
+void EventTracer::stop( void )
+{
+  delete writer_.exchange( nullptr );
+}
+
+void EventTracer::append( TraceWriter * const writer, const TraceRecord & record )
+{
+  if ( this_thread_ring.generation != writer->generation ) {
+    this_thread_ring = { writer->generation, writer->new_ring() };
+  }
+
+  this_thread_ring.ring->push( record );
+}
@@ -0,0 +1,73 @@
+#ifndef EVENT_TRACE_HH
+#define EVENT_TRACE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/* Binary event trace for the sender and the congestion controllers.
+   Each thread appends fixed-size records to its own lock-free ring
+   (dropping, and counting, records if the ring is full), and a
+   background thread drains the rings to the trace file. Nothing on
+   the hot path allocates, locks or makes a syscall. */
+
+enum class TraceEvent : uint16_t
+{
+  Send = 1,          /* value: sequence number */
+  Ack = 2,           /* value: sequence number acked, x: RTT (ms; 0 if the ack echoes a later send time) */
+  Timeout = 3,       /* value: datagrams presumed lost, x: backed-off RTO (ms) */
+  WindowChange = 4,  /* value: window (datagrams), x: pacing rate (datagrams/s) */
+  RttPrediction = 5, /* value: sequence number acked, x: smoothed RTT (ms), y: predicted RTT (ms) */
+  Loss = 6,          /* value: sequence number presumed lost, x: time since it was sent (ms) */
+  Allocations = 7,   /* value: heap allocations by the thread so far, x: since its last report */
+  PathModel = 8,     /* value: bottleneck bandwidth (bytes/s), x: minimum RTT (ms), y: pacing gain */
+  ForwardDelay = 9,  /* value: sequence number acked, x: forward queueing delay (ms), y: clock drift (ppm) */
+  Stray = 10,        /* value: datagrams the sender has dropped as not acks of its flows, so far */
+};
+
+/* one record on disk (host byte order) */
+struct TraceRecord
+{
+  uint64_t timestamp; /* in nanoseconds */
+  uint16_t event;     /* a TraceEvent */
+  uint16_t thread;    /* which thread recorded it, numbered from 0 */
+  uint32_t flow;      /* which of the sender's flows it concerns */
+  uint64_t value;
+  double x, y;
+};
+
+static_assert( sizeof( TraceRecord ) == 40, "TraceRecord must stay compact" );
+
+/* the file starts with this magic string */
+static const char TRACE_MAGIC[ 8 ] = { 'D', 'G', 'T', 'R', 'A', 'C', 'E', '1' };
+
+class TraceWriter;
+
+class EventTracer
+{
+private:
+  static std::atomic<TraceWriter *> writer_;
+
+  static void append( TraceWriter * const writer, const TraceRecord & record );
+
+public:
+  /* start tracing to a file (replacing any earlier trace) */
+  static void start( const std::string & filename );
+
+  /* flush everything recorded so far and stop tracing
+     (no other thread may be recording at the same time) */
+  static void stop( void );
+
+  /* append a record, if tracing is on */
+  static void record( const TraceEvent event, const uint64_t timestamp,
+		      const uint64_t value = 0, const double x = 0, const double y = 0,
+		      const uint32_t flow = 0 )
+  {
+    TraceWriter * const writer = writer_.load( std::memory_order_acquire );
+    if ( writer ) {
+      append( writer, { timestamp, uint16_t( event ), 0, flow, value, x, y } );
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+#include "forecast_controller.hh"
+
+using namespace std;
+
+/* nanoseconds per millisecond */
+const static double kNanosPerMilli = 1e6;
+
+/* nanoseconds per second */
+const static double kNanosPerSecond = 1e9;
+
+ForecastController::ForecastController( const bool debug, const ControllerParams & params )
+  : Controller( debug ),
+    target_ms_( params.get( "target_ms", 50 ) ),
+    min_window_( params.get( "min_window", 2 ) ),
+    pacing_gain_( params.get( "pacing_gain", 0 ) ),
+    forecast_( 0 ),
+    datagram_bytes_( 0 ),
+    min_rtt_( params.get( "min_rtt_window_s", 10 ) * kNanosPerSecond,
+	      numeric_limits<uint64_t>::max() ),
+    the_window_size( params.get( "initial_window", 10 ) )
+{}
+
+/* Get current window size, in datagrams */
+unsigned int ForecastController::window_size( void )
+{
+  return (unsigned int)the_window_size;
+}
+
+/* Get current pacing rate, in datagrams per second */
+double ForecastController::pacing_rate( void )
+{
+  return pacing_gain_ * forecast_;
+}
+
+/* what the link should deliver over a minimum RTT plus the target delay */
+void ForecastController::update_window( void )
+{
+  if ( forecast_ == 0 or min_rtt_.best() == numeric_limits<uint64_t>::max() ) {
+    return;
+  }
+
+  const double min_rtt_ms = min_rtt_.best() / kNanosPerMilli;
+  the_window_size = max( min_window_, forecast_ * (min_rtt_ms + target_ms_) / 1000.0 );
+}
+
+/* An ack was received */
+void ForecastController::ack_received( const uint64_t sequence_number_acked,
+				       const uint64_t send_timestamp_acked,
+				       const uint64_t recv_timestamp_acked __attribute__((unused)),
+				       const uint64_t timestamp_ack_received,
+				       const uint64_t payload_length_acked )
+{
+  /* (an ack echoing a later send time has no RTT to offer) */
+  const bool has_rtt = timestamp_ack_received >= send_timestamp_acked;
+  const uint64_t rtt = has_rtt ? timestamp_ack_received - send_timestamp_acked : 0;
+  if ( has_rtt ) {
+    min_rtt_.update( rtt, timestamp_ack_received );
+    update_window();
+  }
+
+  datagram_bytes_ = max( datagram_bytes_, double( payload_length_acked ) );
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_ack_received
+	 << " received ack for datagram " << sequence_number_acked
+	 << " (rtt " << rtt / kNanosPerMilli << " ms), window " << the_window_size << endl;
+  }
+}
+
+/* The receiver's forecast arrived with an ack */
+void ForecastController::forecast_received( const uint64_t forecast,
+					    const uint64_t timestamp )
+{
+  if ( datagram_bytes_ == 0 ) {
+    return;
+  }
+
+  forecast_ = forecast / datagram_bytes_;
+  update_window();
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp << " forecast " << forecast_
+	 << " datagrams/s, window " << the_window_size << endl;
+  }
+}
+
+/* whatever was forecast before the timeout is stale */
+void ForecastController::timeout_occurred( void )
+{
+  forecast_ = 0;
+  the_window_size = min_window_;
+}
@@ -0,0 +1,54 @@
+#ifndef FORECAST_CONTROLLER_HH
+#define FORECAST_CONTROLLER_HH
+
+#include <cstdint>
+#include <functional>
+
+#include "controller.hh"
+#include "windowed_filter.hh"
+
+/* Window controller driven by the receiver's capacity forecast (run
+   the receiver with forecast=1; see capacity_forecast.hh). As in
+   Sprout, it keeps in flight what the link is forecast to deliver
+   over one minimum RTT (over the last min_rtt_window_s seconds, so a
+   path change ages out) plus target_ms, so datagrams queue for about
+   target_ms at most (Sprout's was 100 ms), unless the link does worse
+   than the forecast expected it to. Until the first forecast arrives, the window is
+   initial_window; after a timeout (an outage, most likely) it is
+   min_window until the next. */
+class ForecastController : public Controller
+{
+private:
+  /* tunables */
+  double target_ms_;          /* queueing delay to allow for */
+  double min_window_;         /* in datagrams */
+  double pacing_gain_;        /* 0 disables pacing */
+
+  double forecast_;           /* in datagrams per second (0 until the first) */
+  double datagram_bytes_;     /* largest payload acked */
+  WindowedFilter<uint64_t, std::less<uint64_t>> min_rtt_; /* in nanoseconds */
+
+  double the_window_size;
+
+  void update_window( void );
+
+public:
+  ForecastController( const bool debug, const ControllerParams & params );
+
+  unsigned int window_size( void ) override;
+
+  double pacing_rate( void ) override;
+
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received,
+		     const uint64_t payload_length_acked ) override;
+
+  void forecast_received( const uint64_t forecast,
+			  const uint64_t timestamp ) override;
+
+  void timeout_occurred( void ) override;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <stdexcept>
+
+#include "interpolation_controller.hh"
+#include "event_trace.hh"
+#include "lagrange.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+/* nanoseconds per millisecond */
+const static double kNanosPerMilli = 1e6;
+
+const unsigned int InterpolationController::MAX_HISTORY;
+
+/* extrapolation weights for each order the controller offers */
+static const double * extrapolation_weights( const unsigned int order )
+{
+  switch ( order ) {
+  case 1: return LagrangeExtrapolation<1>::weights();
+  case 2: return LagrangeExtrapolation<2>::weights();
+  case 3: return LagrangeExtrapolation<3>::weights();
+  case 4: return LagrangeExtrapolation<4>::weights();
+  case 5: return LagrangeExtrapolation<5>::weights();
+  case 6: return LagrangeExtrapolation<6>::weights();
+  }
+
+  throw runtime_error( "interpolation order must be between 1 and 6" );
+}
+
+/* Default constructor */
+InterpolationController::InterpolationController( const bool debug,
+						  const ControllerParams & params )
+  : Controller( debug ),
+    gamma_( params.get( "gamma", 0.15 ) ),
+    window_decay_( params.get( "window_decay", 0.8 ) ),
+    window_grow_( params.get( "window_grow", 1.2 ) ),
+    grace_ms_( params.get( "grace_ms", 50 ) ),
+    min_window_( params.get( "min_window", 4 ) ),
+    max_rtt_ms_( params.get( "max_rtt_ms", 100 ) ),
+    min_rtt_ms_( params.get( "min_rtt_ms", 50 ) ),
+    order_( params.get( "order", 3 ) ),
+    stride_( params.get( "stride", 3 ) ),
+    weights_( extrapolation_weights( order_ ) ),
+    the_window_size( min_window_ ), rtt_ewma ( 0.0 ), grace_end( 0 ),
+    rtt_history_( 0.0 )
+{
+  if ( stride_ == 0 or order_ * stride_ > MAX_HISTORY ) {
+    throw runtime_error( "interpolation stride must be positive, and order * stride at most "
+			 + to_string( MAX_HISTORY ) );
+  }
+}
+
+/* Get current window size, in datagrams */
+unsigned int InterpolationController::window_size( void ) {
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_ns()
+	 << " window size is " << the_window_size << endl;
+  }
+
+  return (unsigned int)the_window_size;
+}
+
+/* The smoothed RTT predicted from the history: sample i (oldest
+   first) is the one order * stride - 1 - i * stride acks old */
+double InterpolationController::interpolate( void ) const
+{
+  double sum = 0;
+  unsigned int age = order_ * stride_ - 1;
+  for ( unsigned int i = 0; i < order_; i++, age -= stride_ ) {
+    sum += weights_[ i ] * rtt_history_[ age ];
+  }
+
+  return sum;
+}
+
+/* An ack was received */
+void InterpolationController::ack_received( const uint64_t sequence_number_acked,
+					    /* what sequence number was acknowledged */
+					    const uint64_t send_timestamp_acked,
+					    /* when the acknowledged datagram was sent (sender's clock) */
+					    const uint64_t recv_timestamp_acked,
+					    /* when the acknowledged datagram was received (receiver's clock)*/
+					    const uint64_t timestamp_ack_received,
+					    /* when the ack was received (by sender) */
+					    const uint64_t payload_length_acked __attribute__((unused)) )
+                                            /* how long the acknowledged datagram's payload was */
+{
+  const double delta = (timestamp_ack_received - send_timestamp_acked) / kNanosPerMilli;
+
+  rtt_ewma = gamma_*delta + (1.0 - gamma_)*rtt_ewma;
+  rtt_history_.push( rtt_ewma );
+  double predicted_rtt = interpolate();
+
+  EventTracer::record( TraceEvent::RttPrediction, timestamp_ack_received,
+		       sequence_number_acked, rtt_ewma, predicted_rtt );
+
+  if (timestamp_ack_received < grace_end) {
+    // do nothing
+  } else if (predicted_rtt >= max_rtt_ms_) {
+    the_window_size *= window_decay_;
+    grace_end = timestamp_ack_received + grace_ms_ * kNanosPerMilli;
+  } else if (predicted_rtt <= min_rtt_ms_) {
+    the_window_size *= window_grow_;
+    grace_end = timestamp_ack_received + grace_ms_ * kNanosPerMilli;
+  }
+
+  if (the_window_size < min_window_) {
+    the_window_size = min_window_;
+  }
+
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_ack_received
+	 << " received ack for datagram " << sequence_number_acked
+	 << " (send @ time " << send_timestamp_acked
+	 << ", received @ time " << recv_timestamp_acked << " by receiver's clock)"
+	 << endl;
+  }
+}
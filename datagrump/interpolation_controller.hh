@@ -0,0 +1,55 @@
+#ifndef INTERPOLATION_CONTROLLER_HH
+#define INTERPOLATION_CONTROLLER_HH
+
+#include "controller.hh"
+#include "ring_buffer.hh"
+
+/* Window controller that extrapolates the smoothed RTT a few samples
+   ahead and shrinks or grows the window multiplicatively when the
+   prediction leaves the [min_rtt_ms, max_rtt_ms] band. The prediction
+   is the polynomial through `order` smoothed RTTs, `stride` acks
+   apart, one stride past the last of them (as a weighted sum, with
+   the weights worked out at compile time; see lagrange.hh). */
+class InterpolationController : public Controller
+{
+private:
+  /* most smoothed RTTs kept (order * stride may be up to this) */
+  static const unsigned int MAX_HISTORY = 64;
+
+  /* tunables */
+  double gamma_;          /* EWMA gain for RTT samples */
+  double window_decay_;   /* multiplicative decrease */
+  double window_grow_;    /* multiplicative increase */
+  double grace_ms_;       /* hold-off after each change */
+  double min_window_;     /* in datagrams */
+  double max_rtt_ms_;     /* shrink above this predicted RTT */
+  double min_rtt_ms_;     /* grow below this predicted RTT */
+  unsigned int order_;    /* samples extrapolated from */
+  unsigned int stride_;   /* acks between them */
+  const double * weights_;
+
+  double the_window_size;
+  double rtt_ewma; /* in milliseconds */
+  uint64_t grace_end; /* in nanoseconds */
+
+  RingBuffer<double, MAX_HISTORY> rtt_history_; /* smoothed, in milliseconds */
+
+  double interpolate( void ) const;
+
+public:
+  InterpolationController( const bool debug, const ControllerParams & params );
+
+  unsigned int window_size( void ) override;
+
+  void ack_received( const uint64_t sequence_number_acked,
+		     const uint64_t send_timestamp_acked,
+		     const uint64_t recv_timestamp_acked,
+		     const uint64_t timestamp_ack_received,
+		     const uint64_t payload_length_acked ) override;
+
+  /* forbid copying, since the controller points to its weights */
+  InterpolationController( const InterpolationController & other ) = delete;
+  InterpolationController & operator=( const InterpolationController & other ) = delete;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef LAGRANGE_HH
+#define LAGRANGE_HH
+
+/* Weights that extrapolate Order evenly spaced samples one spacing
+   past the last, by the Lagrange polynomial through them: with
+   samples y_0 (oldest) ... y_{Order-1} at x = 0 ... Order - 1, the
+   polynomial at x = Order is the sum of weight( i ) * y_i, where
+
+     weight( i ) = product over j != i of (Order - j) / (i - j)
+
+   (Spacing the samples further apart scales every distance alike,
+   so the weights are the same for any stride.) They are worked out
+   at compile time. */
+template <unsigned int Order>
+class LagrangeExtrapolation
+{
+private:
+  static_assert( Order > 0, "extrapolation needs at least one sample" );
+
+  /* the product's factors from j on */
+  static constexpr double product( const unsigned int i, const unsigned int j )
+  {
+    return j == Order ? 1.0
+      : (j == i ? 1.0 : (double( Order ) - j) / (double( i ) - double( j ))) * product( i, j + 1 );
+  }
+
+public:
+  static constexpr double weight( const unsigned int i ) { return product( i, 0 ); }
+
+  /* all Order of them, in a table */
+  static const double * weights( void );
+};
+
+/* the table, for weights I... (0 ... Order - 1) */
+template <unsigned int Order, unsigned int... I>
+struct LagrangeWeights
+{
+  static constexpr double values[ Order ] = { LagrangeExtrapolation<Order>::weight( I )... };
+};
+
+template <unsigned int Order, unsigned int... I>
+constexpr double LagrangeWeights<Order, I...>::values[ Order ];
+
+/* (counts N down to 0, building up I...) */
+template <unsigned int Order, unsigned int N, unsigned int... I>
+struct MakeLagrangeWeights : MakeLagrangeWeights<Order, N - 1, N - 1, I...> {};
+
+template <unsigned int Order, unsigned int... I>
+struct MakeLagrangeWeights<Order, 0, I...>
+{
+  typedef LagrangeWeights<Order, I...> type;
+};
+
+template <unsigned int Order>
+const double * LagrangeExtrapolation<Order>::weights( void )
+{
+  return MakeLagrangeWeights<Order, Order>::type::values;
+}
+
+#endif /* LAGRANGE_HH */
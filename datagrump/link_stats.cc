@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cmath>
+
+#include "link_stats.hh"
+
+using namespace std;
+
+/* nanoseconds per second */
+static const double kNanosPerSecond = 1e9;
+
+LinkStats::LinkStats( const uint64_t window, const WindowCallback & window_callback )
+  : start_( -1 ), end_( 0 ),
+    capacity_bytes_( 0 ), delivered_bytes_( 0 ),
+    delay_histogram_(), delay_count_( 0 ),
+    window_( window ), window_start_( 0 ),
+    window_capacity_bytes_( 0 ), window_delivered_bytes_( 0 ),
+    window_callback_( window_callback )
+{}
+
+/* move the clock forward, reporting any throughput windows that ended */
+void LinkStats::advance( const uint64_t time )
+{
+  if ( start_ == uint64_t( -1 ) ) {
+    start_ = time;
+    window_start_ = time;
+  }
+
+  end_ = max( end_, time );
+
+  if ( not window_ ) {
+    return;
+  }
+
+  while ( time >= window_start_ + window_ ) {
+    if ( window_callback_ ) {
+      const double seconds = window_ / kNanosPerSecond;
+      window_callback_( window_start_,
+			window_capacity_bytes_ * 8 / seconds / 1e6,
+			window_delivered_bytes_ * 8 / seconds / 1e6 );
+    }
+
+    window_start_ += window_;
+    window_capacity_bytes_ = window_delivered_bytes_ = 0;
+  }
+}
+
+void LinkStats::opportunity( const uint64_t time, const uint64_t bytes )
+{
+  advance( time );
+  capacity_bytes_ += bytes;
+  window_capacity_bytes_ += bytes;
+}
+
+void LinkStats::delivery( const uint64_t time, const uint64_t bytes, const double delay_ms )
+{
+  advance( time );
+  delivered_bytes_ += bytes;
+  window_delivered_bytes_ += bytes;
+
+  const size_t bin = min( uint64_t( max( 0.0, delay_ms ) * BINS_PER_MS ), uint64_t( MAX_BINS - 1 ) );
+  if ( bin >= delay_histogram_.size() ) {
+    delay_histogram_.resize( bin + 1 );
+  }
+  delay_histogram_[ bin ]++;
+  delay_count_++;
+}
+
+void LinkStats::finish( const uint64_t time )
+{
+  advance( time );
+}
+
+double LinkStats::duration_seconds( void ) const
+{
+  return start_ == uint64_t( -1 ) ? 0 : (end_ - start_) / kNanosPerSecond;
+}
+
+double LinkStats::capacity_mbps( void ) const
+{
+  const double seconds = duration_seconds();
+  return seconds > 0 ? capacity_bytes_ * 8 / seconds / 1e6 : 0;
+}
+
+double LinkStats::throughput_mbps( void ) const
+{
+  const double seconds = duration_seconds();
+  return seconds > 0 ? delivered_bytes_ * 8 / seconds / 1e6 : 0;
+}
+
+/* the delay that the given fraction of packets did not exceed */
+double LinkStats::delay_percentile_ms( const double fraction ) const
+{
+  if ( delay_count_ == 0 ) {
+    return 0;
+  }
+
+  const uint64_t rank = max( 1.0, ceil( fraction * delay_count_ ) );
+
+  uint64_t seen = 0;
+  for ( size_t bin = 0; bin < delay_histogram_.size(); bin++ ) {
+    seen += delay_histogram_[ bin ];
+    if ( seen >= rank ) {
+      return double( bin ) / BINS_PER_MS;
+    }
+  }
+
+  return double( delay_histogram_.size() - 1 ) / BINS_PER_MS;
+}
+
+double LinkStats::power( void ) const
+{
+  const double delay = delay_percentile_ms( 0.95 );
+  return delay > 0 ? throughput_mbps() / (delay / 1000) : 0;
+}
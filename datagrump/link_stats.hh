@@ -0,0 +1,58 @@
+#ifndef LINK_STATS_HH
+#define LINK_STATS_HH
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/* Capacity, throughput and per-packet delay of one direction of a link,
+   accumulated in a single pass. Delays go into a fixed-resolution
+   histogram, so memory is bounded by the largest delay seen rather than
+   the number of packets. */
+class LinkStats
+{
+public:
+  /* called once per completed throughput window:
+     (window start in ns, capacity in Mbit/s, throughput in Mbit/s) */
+  typedef std::function<void( const uint64_t, const double, const double )> WindowCallback;
+
+private:
+  static const unsigned int BINS_PER_MS = 100;    /* 10 us resolution */
+  static const unsigned int MAX_BINS = 10000000;  /* delays past 100 s share a bin */
+
+  uint64_t start_, end_;               /* in nanoseconds */
+  uint64_t capacity_bytes_, delivered_bytes_;
+  std::vector<uint64_t> delay_histogram_;
+  uint64_t delay_count_;
+
+  uint64_t window_;                    /* in nanoseconds; 0 means no windows */
+  uint64_t window_start_;
+  uint64_t window_capacity_bytes_, window_delivered_bytes_;
+  WindowCallback window_callback_;
+
+  void advance( const uint64_t time );
+
+public:
+  LinkStats( const uint64_t window = 0, const WindowCallback & window_callback = nullptr );
+
+  /* the link could have delivered bytes at time (in nanoseconds) */
+  void opportunity( const uint64_t time, const uint64_t bytes );
+
+  /* the link delivered bytes at time, after delay_ms in the queue */
+  void delivery( const uint64_t time, const uint64_t bytes, const double delay_ms );
+
+  /* the measurement ends at time (to include idle time after the last event) */
+  void finish( const uint64_t time );
+
+  /* results */
+  double duration_seconds( void ) const;
+  double capacity_mbps( void ) const;
+  double throughput_mbps( void ) const;
+  double delay_percentile_ms( const double fraction ) const;
+  uint64_t packets( void ) const { return delay_count_; }
+
+  /* the contest score: throughput (Mbit/s) per second of 95th-percentile delay */
+  double power( void ) const;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "one_way_delay.hh"
+
+using namespace std;
+
+const unsigned int OneWayDelayEstimator::MIN_FIT_BUCKETS;
+
+OneWayDelayEstimator::OneWayDelayEstimator( const uint64_t bucket_length,
+					    const unsigned int bucket_count,
+					    const double max_drift )
+  : bucket_length_( bucket_length ),
+    max_drift_( max_drift ),
+    buckets_( bucket_count ),
+    newest_( 0 ),
+    count_( 0 ),
+    started_( false ),
+    first_send_timestamp_( 0 ),
+    first_delay_( 0 ),
+    offset_( 0 ),
+    drift_( 0 ),
+    queueing_delay_( 0 )
+{
+  if ( bucket_length == 0 or bucket_count == 0 ) {
+    throw runtime_error( "OneWayDelayEstimator: bucket length and count must be positive" );
+  }
+}
+
+/* the baseline's slope is the least-squares fit to the buckets'
+   one-way minima; its height puts it under the lowest of them */
+void OneWayDelayEstimator::fit( void )
+{
+  const unsigned int size = buckets_.size();
+  const unsigned int oldest = (newest_ + size - count_ + 1) % size;
+
+  /* too short a stretch of time says more about the queue than the clocks */
+  drift_ = 0;
+  if ( count_ >= MIN_FIT_BUCKETS ) {
+    double mean_time = 0, mean_delay = 0;
+    for ( unsigned int i = 0; i < count_; i++ ) {
+      const Bucket & bucket = buckets_[ (oldest + i) % size ];
+      mean_time += bucket.time;
+      mean_delay += bucket.delay;
+    }
+    mean_time /= count_;
+    mean_delay /= count_;
+
+    double covariance = 0, variance = 0;
+    for ( unsigned int i = 0; i < count_; i++ ) {
+      const Bucket & bucket = buckets_[ (oldest + i) % size ];
+      covariance += (bucket.time - mean_time) * (bucket.delay - mean_delay);
+      variance += (bucket.time - mean_time) * (bucket.time - mean_time);
+    }
+
+    if ( variance > 0 ) {
+      drift_ = max( -max_drift_, min( max_drift_, covariance / variance ) );
+    }
+  }
+
+  offset_ = buckets_[ oldest ].delay - drift_ * buckets_[ oldest ].time;
+  for ( unsigned int i = 1; i < count_; i++ ) {
+    const Bucket & bucket = buckets_[ (oldest + i) % size ];
+    offset_ = min( offset_, bucket.delay - drift_ * bucket.time );
+  }
+}
+
+/* a datagram sent at send_timestamp arrived at recv_timestamp */
+void OneWayDelayEstimator::sample( const uint64_t send_timestamp, const uint64_t recv_timestamp )
+{
+  /* the clocks' difference can have either sign */
+  const int64_t raw_delay = int64_t( recv_timestamp - send_timestamp );
+
+  if ( not started_ ) {
+    started_ = true;
+    first_send_timestamp_ = send_timestamp;
+    first_delay_ = raw_delay;
+  }
+
+  /* relative to the first sample, to keep the fit's doubles precise */
+  const double time = double( int64_t( send_timestamp - first_send_timestamp_ ) );
+  const double delay = double( raw_delay - first_delay_ );
+  const int64_t index = int64_t( floor( time / bucket_length_ ) );
+
+  if ( count_ == 0 or index > buckets_[ newest_ ].index ) {
+    /* a new stretch of time, pushing out the oldest */
+    newest_ = (newest_ + 1) % buckets_.size();
+    buckets_[ newest_ ] = { index, time, delay };
+    count_ = min<unsigned int>( count_ + 1, buckets_.size() );
+    fit();
+  } else {
+    /* (a datagram acked late may belong to an earlier bucket) */
+    for ( unsigned int i = 0; i < count_; i++ ) {
+      Bucket & bucket = buckets_[ (newest_ + buckets_.size() - i) % buckets_.size() ];
+      if ( bucket.index == index ) {
+	if ( delay < bucket.delay ) {
+	  bucket.time = time;
+	  bucket.delay = delay;
+	  fit();
+	}
+	break;
+      }
+    }
+  }
+
+  queueing_delay_ = max( 0.0, delay - (offset_ + drift_ * time) );
+}
@@ -0,0 +1,76 @@
+#ifndef ONE_WAY_DELAY_HH
+#define ONE_WAY_DELAY_HH
+
+#include <cstdint>
+#include <vector>
+
+/* Forward (sender-to-receiver) queueing delay, from the send timestamp
+   (sender's clock) and receive timestamp (receiver's clock) of each
+   acked datagram. Their difference is the one-way delay plus the
+   offset between the clocks, which drifts as the clocks run at
+   slightly different rates. The least-delayed datagram of each
+   bucket_length stretch of time saw (nearly) no queue, so the line
+   through the last bucket_count of those minima, with the slope of
+   the drift and lowered until it is below all of them, tracks the
+   propagation delay plus the offset; a datagram's height above it
+   is its forward queueing delay. Delay on the ack path doesn't
+   enter into it (nothing timed over the ack path is used, so a queue
+   building there can't be taken for drift).
+
+   Until MIN_FIT_BUCKETS buckets have been seen, the baseline is flat
+   (the offset alone), off by however far the clocks drift meanwhile.
+   A forward queue that never drains raises the minima just as drift
+   does, so the drift is limited to max_drift, since real clocks are
+   within about 100 ppm of each other. All times are in nanoseconds. */
+class OneWayDelayEstimator
+{
+private:
+  /* buckets needed before the drift is fitted */
+  static const unsigned int MIN_FIT_BUCKETS = 3;
+
+  /* the least-delayed datagram sent in one stretch of time
+     (times and delays relative to the first sample) */
+  struct Bucket
+  {
+    int64_t index;
+    double time;
+    double delay;
+  };
+
+  uint64_t bucket_length_;
+  double max_drift_;
+  std::vector<Bucket> buckets_; /* ring of the most recent */
+  unsigned int newest_, count_;
+
+  bool started_;
+  uint64_t first_send_timestamp_;
+  int64_t first_delay_;
+
+  /* the baseline: offset_ + drift_ * time */
+  double offset_, drift_;
+
+  double queueing_delay_;
+
+  void fit( void );
+
+public:
+  OneWayDelayEstimator( const uint64_t bucket_length, const unsigned int bucket_count,
+			const double max_drift );
+
+  /* a datagram sent at send_timestamp arrived at recv_timestamp (by
+     the receiver's clock) */
+  void sample( const uint64_t send_timestamp, const uint64_t recv_timestamp );
+
+  /* whether the drift has been fitted yet (until then, the queueing
+     delay is measured from the offset alone) */
+  bool calibrated( void ) const { return count_ >= MIN_FIT_BUCKETS; }
+
+  /* the latest datagram's forward queueing delay */
+  double queueing_delay( void ) const { return queueing_delay_; }
+
+  /* how much faster the receiver's clock runs than the sender's
+     (e.g. 1e-5 is 10 ppm) */
+  double clock_drift( void ) const { return drift_; }
+};
+
+#endif /* ONE_WAY_DELAY_HH */
@@ -0,0 +1,30 @@
+#include <algorithm>
+
+#include "pacer.hh"
+
+using namespace std;
+
+/* nanoseconds per second */
+const static double kNanosPerSecond = 1e9;
+
+Pacer::Pacer( const double max_burst )
+  : max_burst_( max( 1.0, max_burst ) ),
+    next_departure_( 0 )
+{}
+
+/* a datagram left at time now */
+void Pacer::datagram_sent( const uint64_t now, const double rate )
+{
+  if ( rate <= 0 ) {
+    next_departure_ = 0;
+    return;
+  }
+
+  const double interval = kNanosPerSecond / rate;
+
+  /* don't let unused credit build up beyond max_burst_ datagrams */
+  const uint64_t credit_limit = (max_burst_ - 1) * interval;
+  const uint64_t earliest = now > credit_limit ? now - credit_limit : 0;
+
+  next_departure_ = max( next_departure_, earliest ) + interval;
+}
@@ -0,0 +1,30 @@
+#ifndef PACER_HH
+#define PACER_HH
+
+#include <cstdint>
+
+/* Spaces departures out at the congestion controller's pacing rate,
+   so the window drains as a smooth stream rather than line-rate bursts.
+   A little credit (max_burst datagrams) can build up while the sender
+   is idle or a wakeup is late, so timer slack does not cost throughput. */
+class Pacer
+{
+private:
+  double max_burst_;          /* in datagrams */
+  uint64_t next_departure_;   /* in nanoseconds */
+
+public:
+  Pacer( const double max_burst );
+
+  /* may a datagram leave at time now? */
+  bool may_send( const uint64_t now ) const { return now >= next_departure_; }
+
+  /* when the next datagram may leave */
+  uint64_t next_departure( void ) const { return next_departure_; }
+
+  /* a datagram left at time now, with the controller asking for
+     rate datagrams per second (0 means unpaced) */
+  void datagram_sent( const uint64_t now, const double rate );
+};
+
+#endif
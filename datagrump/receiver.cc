@@ -2,11 +2,396 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
 
 #include "socket.hh"
+#include "io_uring.hh"
+#include "capacity_forecast.hh"
 #include "contest_message.hh"
+#include "scoreboard.hh"
+#include "controller.hh"
+#include "poller.hh"
+#include "timestamp.hh"
+#include "util.hh"
 
 using namespace std;
+using namespace PollerShortNames;
+
+/* how the receiver acknowledges: each datagram straight away, or
+   (with ack_every > 1) aggregated, once ack_every datagrams from a
+   sender are waiting or ack_delay after the first of them arrived;
+   acks carry a capacity forecast if there is a model to make it */
+struct AckPolicy
+{
+  unsigned int ack_every;
+  uint64_t ack_delay; /* in nanoseconds */
+  bool io_uring;      /* receive and ack (one at a time) on io_uring */
+  bool gro;           /* datagrams arrive coalesced (UDP_GRO) */
+  const ForecastModel * forecast_model; /* null unless forecasting */
+  uint64_t sender_idle; /* a sender quiet this long is forgotten (in nanoseconds) */
+};
+
+/* most datagrams one aggregated ack can cover */
+static const unsigned int MAX_ACK_EVERY = 64;
+
+/* senders are told apart by their address and the flow ID in the header
+   (one sender may multiplex many flows over one socket) */
+typedef pair<Address, uint64_t> FlowKey;
+
+/* what the receiver knows about one sender */
+struct SenderState
+{
+  ReceiveHistory history;
+  vector<AckedDatagram> pending; /* arrived, but not yet acknowledged */
+  uint64_t deadline;             /* when the pending datagrams must be */
+  bool queued;                   /* in the aggregator's deadline heap */
+  CapacityForecast forecast;     /* of the link from the sender */
+  uint64_t last_arrival;
+
+  SenderState()
+    : history(), pending(), deadline( 0 ), queued( false ), forecast(), last_arrival( 0 ) {}
+
+  /* the sender started over */
+  void reset( void )
+  {
+    history = ReceiveHistory();
+    pending.clear();
+    forecast = CapacityForecast();
+  }
+
+  /* a datagram arrived from the sender */
+  void received( const AckPolicy & policy, const uint64_t sequence_number,
+		 const uint64_t send_timestamp, const uint64_t recv_timestamp,
+		 const uint64_t payload_length )
+  {
+    if ( sequence_number == 0 ) {
+      reset();
+    }
+    history.received( sequence_number );
+    last_arrival = recv_timestamp;
+
+    if ( policy.forecast_model ) {
+      forecast.arrival( *policy.forecast_model, send_timestamp, recv_timestamp, payload_length );
+    }
+  }
+};
+
+/* The senders heard from recently. One that has been quiet for the
+   policy's sender_idle, with nothing waiting to be acked, is
+   forgotten, so a receiver that outlives many short flows doesn't
+   keep them all. (Looking for them once per sender_idle keeps the
+   cost per datagram constant.) */
+class SenderTable
+{
+public:
+  typedef map<FlowKey, SenderState>::value_type Entry;
+
+private:
+  map<FlowKey, SenderState> senders_;
+  uint64_t idle_;
+  uint64_t next_sweep_;
+
+  void sweep( const uint64_t now )
+  {
+    for ( auto it = senders_.begin(); it != senders_.end(); ) {
+      const SenderState & sender = it->second;
+      if ( not sender.queued and sender.pending.empty() and now - sender.last_arrival >= idle_ ) {
+	it = senders_.erase( it );
+      } else {
+	it++;
+      }
+    }
+  }
+
+public:
+  SenderTable( const uint64_t idle ) : senders_(), idle_( idle ), next_sweep_( 0 ) {}
+
+  /* the sender a datagram arrived from at recv_timestamp (forgetting
+     any idle ones first, so the entry stays put until it is idle too) */
+  Entry & find( const FlowKey & key, const uint64_t recv_timestamp )
+  {
+    if ( recv_timestamp >= next_sweep_ ) {
+      sweep( recv_timestamp );
+      next_sweep_ = recv_timestamp + idle_;
+    }
+
+    return *senders_.emplace( key, SenderState() ).first;
+  }
+};
+
+/* Loop and acknowledge every incoming datagram back to its source */
+static void acknowledge_forever( UDPSocket & socket, const AckPolicy & policy )
+{
+  /* each socket (and so each worker) numbers its acks independently */
+  uint64_t sequence_number = 0;
+
+  /* most datagrams to receive (and acknowledge) per syscall */
+  const unsigned int BATCH_SIZE = 32;
+
+  /* datagrams are received into, and acknowledged from, reusable
+     buffers (with GRO, a split-up datagram may be shorter than its
+     ack, so each ack gets space of its own) */
+  DatagramBatch batch( BATCH_SIZE, 65536, policy.gro ? ContestMessageView::MAX_ACK_LENGTH : 0 );
+
+  /* which datagrams have arrived from each sender, for the SACK blocks */
+  SenderTable senders( policy.sender_idle );
+
+  while ( true ) {
+    const unsigned int count = socket.recv_batch( batch );
+
+    for ( unsigned int i = 0; i < count; i++ ) {
+      const ContestMessageView message( batch.payload( i ), batch.length( i ) );
+      const uint64_t acked = message.sequence_number();
+
+      /* (a sender starting over from the same address starts a new history) */
+      SenderState & sender = senders.find( FlowKey( batch.address( i ), message.flow_id() ),
+					   batch.timestamp( i ) ).second;
+      sender.received( policy, acked, message.send_timestamp(), batch.timestamp( i ),
+		       message.payload_length() );
+
+      /* the ack keeps the header, but not the payload */
+      char * const ack = batch.reply( i );
+      if ( ack != batch.payload( i ) ) {
+	memcpy( ack, batch.payload( i ), ContestMessageView::HEADER_LENGTH );
+      }
+
+      ContestMessageView reply( ack, ContestMessageView::HEADER_LENGTH, batch.room( i ) );
+      reply.transform_into_ack( sequence_number++, batch.timestamp( i ) );
+      reply.set_ack_payload_length( message.payload_length() );
+      reply.set_ack_forecast( sender.forecast.forecast() );
+      batch.set_length( i, reply.set_sack( sender.history.sack( acked ) ) );
+
+      /* timestamp the ack just before sending */
+      reply.set_send_timestamp();
+    }
+
+    /* send the acks */
+    socket.sendto_batch( batch );
+  }
+}
+
+/* Loop and acknowledge every incoming datagram, on io_uring: the
+   datagrams arrive through one multishot receive, and the acks for
+   everything that arrived go out together with the next wait */
+static void uring_acknowledge_forever( UDPSocket & socket, const AckPolicy & policy )
+{
+  uint64_t sequence_number = 0;
+
+  SenderTable senders( policy.sender_idle );
+
+  /* the ack is assembled here, then copied into a send slot */
+  char ack[ ContestMessageView::MAX_ACK_LENGTH ];
+
+  UringPoller poller;
+
+  poller.add_receiver( socket, [&] ( const UDPSocket::received_datagram_view & datagram ) {
+      const ContestMessageView message( datagram.payload, datagram.length );
+      const uint64_t acked = message.sequence_number();
+
+      /* (a sender starting over from the same address starts a new history) */
+      SenderState & sender = senders.find( FlowKey( datagram.source_address, message.flow_id() ),
+					   datagram.timestamp ).second;
+      sender.received( policy, acked, message.send_timestamp(), datagram.timestamp,
+		       message.payload_length() );
+
+      /* the ack keeps the header, but not the payload */
+      memcpy( ack, datagram.payload, ContestMessageView::HEADER_LENGTH );
+      ContestMessageView reply( ack, ContestMessageView::HEADER_LENGTH, sizeof( ack ) );
+      reply.transform_into_ack( sequence_number++, datagram.timestamp );
+      reply.set_ack_payload_length( message.payload_length() );
+      reply.set_ack_forecast( sender.forecast.forecast() );
+      const size_t length = reply.set_sack( sender.history.sack( acked ) );
+
+      /* timestamp the ack just before queueing it */
+      reply.set_send_timestamp();
+      poller.sendto( socket, datagram.source_address, ack, length );
+
+      return ResultType::Continue;
+    } );
+
+  while ( true ) {
+    poller.poll( -1 );
+  }
+}
+
+/* send one ack covering all of a sender's pending datagrams */
+static void send_aggregated_ack( UDPSocket & socket, const FlowKey & flow,
+				 SenderState & sender, uint64_t & sequence_number,
+				 Packet & buffer )
+{
+  ContestMessageView ack( buffer.data(), ContestMessageView::HEADER_LENGTH, buffer.capacity() );
+  ack.init_header( sequence_number++, flow.second );
+  ack.set_ack_sequence_number( sender.pending.front().sequence_number );
+  ack.set_sack( sender.history.sack( sender.pending.back().sequence_number ) );
+  const size_t length = ack.set_acked_datagrams( sender.pending );
+  ack.set_ack_forecast( sender.forecast.forecast() );
+
+  /* timestamp the ack just before sending */
+  ack.set_send_timestamp();
+  buffer.set_length( length );
+  socket.sendto( flow.first, buffer );
+
+  sender.pending.clear();
+}
+
+/* a sender with datagrams waiting to be acked, and when they must be
+   (ordered so a priority_queue puts the earliest deadline on top) */
+struct AckDeadline
+{
+  uint64_t deadline;
+  SenderTable::Entry * sender;
+
+  bool operator<( const AckDeadline & other ) const { return deadline > other.deadline; }
+};
+
+/* Loop and acknowledge incoming datagrams in aggregate */
+static void aggregate_acks_forever( UDPSocket & socket, const AckPolicy & policy )
+{
+  uint64_t sequence_number = 0;
+
+  const unsigned int BATCH_SIZE = 32;
+  DatagramBatch batch( BATCH_SIZE );
+
+  SenderTable senders( policy.sender_idle );
+
+  /* each sender with pending datagrams has one entry here (which may
+     be out of date, if they were acked early: see the timer) */
+  priority_queue<AckDeadline> deadlines;
+
+  /* each ack is assembled in the same reusable buffer */
+  PacketPool pool( 1, ContestMessageView::MAX_ACK_LENGTH
+		   + MAX_ACK_EVERY * ContestMessageView::AGGREGATE_ENTRY_LENGTH );
+  Packet ack = pool.get();
+
+  Poller poller;
+
+  /* fires for the earliest deadline */
+  const Poller::TimerId ack_timer = poller.add_timer( [&] () {
+      const uint64_t now = timestamp_ns();
+      while ( not deadlines.empty() and deadlines.top().deadline <= now ) {
+	auto & entry = *deadlines.top().sender;
+	deadlines.pop();
+
+	SenderState & sender = entry.second;
+	if ( not sender.pending.empty() and sender.deadline <= now ) {
+	  send_aggregated_ack( socket, entry.first, sender, sequence_number, ack );
+	}
+
+	/* (pending datagrams that arrived after an early ack wait
+	   for their own deadline) */
+	if ( sender.pending.empty() ) {
+	  sender.queued = false;
+	} else {
+	  deadlines.push( { sender.deadline, &entry } );
+	}
+      }
+
+      if ( not deadlines.empty() ) {
+	poller.set_timer( ack_timer, deadlines.top().deadline );
+      }
+      return ResultType::Continue;
+    } );
+
+  poller.add_action( Poller::Action( socket, Poller::Action::In, [&] () {
+	const unsigned int count = socket.recv_batch( batch );
+
+	for ( unsigned int i = 0; i < count; i++ ) {
+	  const ContestMessageView message( batch.payload( i ), batch.length( i ) );
+	  const AckedDatagram datagram = { message.sequence_number(), message.send_timestamp(),
+					   batch.timestamp( i ), message.payload_length() };
+
+	  auto & entry = senders.find( FlowKey( batch.address( i ), message.flow_id() ),
+				       datagram.recv_timestamp );
+	  SenderState & sender = entry.second;
+
+	  /* (a sender starting over from the same address starts a new history) */
+	  sender.received( policy, datagram.sequence_number, datagram.send_timestamp,
+			   datagram.recv_timestamp, datagram.payload_length );
+
+	  /* offsets in an aggregated ack are only 32 bits */
+	  if ( not sender.pending.empty()
+	       and not ContestMessageView::can_aggregate( sender.pending.front(), datagram ) ) {
+	    send_aggregated_ack( socket, entry.first, sender, sequence_number, ack );
+	  }
+
+	  if ( sender.pending.empty() ) {
+	    sender.deadline = datagram.recv_timestamp + policy.ack_delay;
+	    if ( not sender.queued ) {
+	      sender.queued = true;
+	      deadlines.push( { sender.deadline, &entry } );
+	    }
+	  }
+	  sender.pending.push_back( datagram );
+
+	  if ( sender.pending.size() >= policy.ack_every ) {
+	    send_aggregated_ack( socket, entry.first, sender, sequence_number, ack );
+	  }
+	}
+
+	if ( not deadlines.empty() ) {
+	  poller.set_timer( ack_timer, deadlines.top().deadline );
+	}
+	return ResultType::Continue;
+      } ) );
+
+  while ( true ) {
+    poller.poll( -1 );
+  }
+}
+
+/* acknowledge according to the policy */
+static void serve( UDPSocket & socket, const AckPolicy & policy )
+{
+  if ( policy.io_uring ) {
+    uring_acknowledge_forever( socket, policy );
+  } else if ( policy.ack_every > 1 ) {
+    aggregate_acks_forever( socket, policy );
+  } else {
+    acknowledge_forever( socket, policy );
+  }
+}
+
+/* the cores this process may run on (in a container or under
+   taskset, not necessarily 0 to hardware_concurrency() - 1) */
+static vector<unsigned int> allowed_cores( void )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  SystemCall( "sched_getaffinity", sched_getaffinity( 0, sizeof( cpus ), &cpus ) );
+
+  vector<unsigned int> cores;
+  for ( unsigned int core = 0; core < CPU_SETSIZE; core++ ) {
+    if ( CPU_ISSET( core, &cpus ) ) {
+      cores.push_back( core );
+    }
+  }
+
+  if ( cores.empty() ) {
+    throw runtime_error( "sched_getaffinity: no cores allowed" );
+  }
+
+  return cores;
+}
+
+/* pin the calling thread to one core */
+static void pin_to_core( const unsigned int core )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( core, &cpus );
+
+  const int ret = pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus );
+  if ( ret ) {
+    throw unix_error( "pthread_setaffinity_np", ret );
+  }
+}
 
 int main( int argc, char *argv[] )
 {
@@ -15,37 +400,120 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  if ( argc != 2 ) {
-    cerr << "Usage: " << argv[ 0 ] << " PORT" << endl;
+  int workers = 1;
+  bool usage_error = argc < 2;
+  ControllerParams params;
+
+  for ( int i = 2; i < argc and not usage_error; i++ ) {
+    const string option( argv[ i ] );
+    if ( option.find( '=' ) != string::npos ) {
+      params.set( option );
+    } else if ( i == 2 ) {
+      workers = stoi( option );
+    } else {
+      usage_error = true;
+    }
+  }
+
+  if ( usage_error ) {
+    cerr << "Usage: " << argv[ 0 ] << " PORT [WORKERS] [ack_every=N] [ack_delay_us=T] [gro=1] [io_uring=1] [forecast=1] [sender_idle_ms=T]" << endl;
+    cerr << "With ack_every > 1, each ack covers up to N datagrams from one sender,"
+	 << " sent at most T microseconds after the first of them arrived." << endl;
+    cerr << "With forecast=1, acks carry a forecast of the link's capacity"
+	 << " (for cc=forecast at the sender)." << endl;
     return EXIT_FAILURE;
   }
 
-  /* create UDP socket for incoming datagrams */
-  UDPSocket socket;
+  if ( workers < 1 ) {
+    cerr << "WORKERS must be positive" << endl;
+    return EXIT_FAILURE;
+  }
 
-  /* turn on timestamps on receipt */
-  socket.set_timestamps();
+  unique_ptr<ForecastModel> forecast_model;
+  if ( params.get( "forecast", 0 ) ) {
+    forecast_model.reset( new ForecastModel( params ) );
+  }
 
-  /* "bind" the socket to the user-specified local port number */
-  socket.bind( Address( "::0", argv[ 1 ] ) );
+  const AckPolicy policy = { unsigned( params.get( "ack_every", 1 ) ),
+			     uint64_t( params.get( "ack_delay_us", 1000 ) * 1000 ),
+			     bool( params.get( "io_uring", 0 ) ),
+			     /* let the kernel coalesce incoming datagrams (split up again by recv_batch) */
+			     bool( params.get( "gro", 0 ) ),
+			     forecast_model.get(),
+			     uint64_t( params.get( "sender_idle_ms", 60000 ) * 1000000 ) };
+  if ( policy.ack_every < 1 or policy.ack_every > MAX_ACK_EVERY ) {
+    cerr << "ack_every must be between 1 and " << MAX_ACK_EVERY << endl;
+    return EXIT_FAILURE;
+  }
 
-  cerr << "Listening on " << socket.local_address().to_string() << endl;
+  if ( policy.io_uring and (policy.ack_every > 1 or policy.gro) ) {
+    cerr << "io_uring=1 acks each datagram, and can't be combined with ack_every or gro" << endl;
+    return EXIT_FAILURE;
+  }
 
-  uint64_t sequence_number = 0;
+  for ( const auto & key : params.unused() ) {
+    cerr << "Warning: setting \"" << key << "\" is not used by the receiver" << endl;
+  }
 
-  /* Loop and acknowledge every incoming datagram back to its source */
-  while ( true ) {
-    const UDPSocket::received_datagram recd = socket.recv();
-    ContestMessage message = recd.payload;
+  /* create one UDP socket for incoming datagrams per worker,
+     all sharing the port so the kernel spreads flows among them */
+  vector<UDPSocket> sockets;
+  sockets.reserve( workers );
+
+  for ( int i = 0; i < workers; i++ ) {
+    sockets.emplace_back();
+
+    /* turn on timestamps on receipt */
+    sockets.back().set_timestamps();
+
+    if ( policy.gro ) {
+      sockets.back().set_gro();
+    }
+
+    if ( workers > 1 ) {
+      sockets.back().set_reuseport();
+    }
+
+    /* "bind" the socket to the user-specified local port number */
+    sockets.back().bind( Address( "::0", argv[ 1 ] ) );
+  }
 
-    /* assemble the acknowledgment */
-    message.transform_into_ack( sequence_number++, recd.timestamp );
+  cerr << "Listening on " << sockets.front().local_address().to_string();
+  if ( workers > 1 ) {
+    cerr << " with " << workers << " workers";
+  }
+  if ( policy.ack_every > 1 ) {
+    cerr << ", acking every " << policy.ack_every << " datagrams or "
+	 << policy.ack_delay / 1000 << " us";
+  }
+  if ( policy.io_uring ) {
+    cerr << ", on io_uring";
+  }
+  if ( policy.forecast_model ) {
+    cerr << ", forecasting capacity";
+  }
+  cerr << endl;
 
-    /* timestamp the ack just before sending */
-    message.set_send_timestamp();
+  if ( workers == 1 ) {
+    serve( sockets.front(), policy );
+  }
+
+  /* otherwise, run one worker per socket, each pinned to its own core
+     (of those the process is allowed, taking turns if there are more
+     workers than cores) */
+  const vector<unsigned int> cores = allowed_cores();
+
+  vector<thread> threads;
+  for ( int i = 0; i < workers; i++ ) {
+    const unsigned int core = cores.at( i % cores.size() );
+    threads.emplace_back( [&sockets, &policy, i, core] () {
+	pin_to_core( core );
+	serve( sockets.at( i ), policy );
+      } );
+  }
 
-    /* send the ack */
-    socket.sendto( recd.source_address, message.to_string() );
+  for ( auto & thread : threads ) {
+    thread.join();
   }
 
   return EXIT_SUCCESS;
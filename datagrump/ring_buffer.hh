@@ -0,0 +1,48 @@
+#ifndef RING_BUFFER_HH
+#define RING_BUFFER_HH
+
+#include <algorithm>
+#include <array>
+
+/* The last Capacity items pushed, oldest overwritten first, indexed
+   by age (0 is the newest). Capacity must be a power of two. */
+template <typename T, unsigned int Capacity>
+class RingBuffer
+{
+private:
+  static_assert( Capacity > 0 and (Capacity & (Capacity - 1)) == 0,
+		 "RingBuffer capacity must be a power of two" );
+
+  std::array<T, Capacity> items_;
+  unsigned int newest_;
+  unsigned int size_;
+
+public:
+  /* empty */
+  RingBuffer() : items_(), newest_( Capacity - 1 ), size_( 0 ) {}
+
+  /* full, of copies of fill */
+  explicit RingBuffer( const T & fill )
+    : items_(), newest_( Capacity - 1 ), size_( Capacity )
+  {
+    items_.fill( fill );
+  }
+
+  void push( const T & item )
+  {
+    newest_ = (newest_ + 1) & (Capacity - 1);
+    items_[ newest_ ] = item;
+    size_ = std::min( size_ + 1, Capacity );
+  }
+
+  /* the item pushed `age` pushes before the newest (age < size()) */
+  const T & operator[]( const unsigned int age ) const
+  {
+    return items_[ (newest_ - age) & (Capacity - 1) ];
+  }
+
+  unsigned int size( void ) const { return size_; }
+  static constexpr unsigned int capacity( void ) { return Capacity; }
+};
+
+#endif /* RING_BUFFER_HH */
@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "rto_estimator.hh"
+
+using namespace std;
+
+const uint64_t RtoEstimator::INITIAL_RTO;
+const uint64_t RtoEstimator::MAX_RTO;
+const uint64_t RtoEstimator::GRANULARITY;
+
+RtoEstimator::RtoEstimator( const uint64_t min_rto )
+  : min_rto_( min_rto ), srtt_( 0 ), rttvar_( 0 ), rto_( INITIAL_RTO ), backoff_( 0 )
+{}
+
+/* a new RTT sample (RFC 6298 section 2) */
+void RtoEstimator::sample( const uint64_t rtt )
+{
+  if ( srtt_ == 0 ) {
+    srtt_ = rtt;
+    rttvar_ = rtt / 2;
+  } else {
+    const uint64_t deviation = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+    rttvar_ = (3 * rttvar_ + deviation) / 4;
+    srtt_ = (7 * srtt_ + rtt) / 8;
+  }
+
+  rto_ = min( MAX_RTO, max( min_rto_, srtt_ + max( GRANULARITY, 4 * rttvar_ ) ) );
+
+  /* a fresh sample ends any backoff (section 5.7) */
+  backoff_ = 0;
+}
+
+/* the timer expired (section 5.5) */
+void RtoEstimator::backoff( void )
+{
+  if ( rto() < MAX_RTO ) {
+    backoff_++;
+  }
+}
+
+/* current timeout, including any backoff */
+uint64_t RtoEstimator::rto( void ) const
+{
+  return min( MAX_RTO, rto_ << min( backoff_, 16u ) );
+}
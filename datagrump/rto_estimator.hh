@@ -0,0 +1,37 @@
+#ifndef RTO_ESTIMATOR_HH
+#define RTO_ESTIMATOR_HH
+
+#include <cstdint>
+
+/* Retransmission timeout, estimated from RTT samples as in RFC 6298:
+   RTO = SRTT + max(G, 4 * RTTVAR), clamped to [min_rto, MAX_RTO],
+   and doubled after each timeout until the next RTT sample.
+   All times are in nanoseconds. */
+class RtoEstimator
+{
+private:
+  static const uint64_t INITIAL_RTO = 1000000000; /* 1 s, before any sample */
+  static const uint64_t MAX_RTO = 60000000000;    /* 60 s */
+  static const uint64_t GRANULARITY = 1000000;    /* G: the sender wakes up to the millisecond */
+
+  uint64_t min_rto_;
+  uint64_t srtt_, rttvar_;
+  uint64_t rto_;          /* before backoff */
+  unsigned int backoff_;  /* timeouts since the last sample */
+
+public:
+  RtoEstimator( const uint64_t min_rto );
+
+  /* a new RTT sample */
+  void sample( const uint64_t rtt );
+
+  /* the timer expired */
+  void backoff( void );
+
+  /* current timeout, including any backoff */
+  uint64_t rto( void ) const;
+
+  uint64_t srtt( void ) const { return srtt_; }
+};
+
+#endif /* RTO_ESTIMATOR_HH */
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "scoreboard.hh"
+
+using namespace std;
+
+/* note an arriving datagram */
+void ReceiveHistory::received( const uint64_t sequence_number )
+{
+  if ( sequence_number < cumulative_ack_ ) {
+    return; /* duplicate */
+  }
+
+  /* the ranges on either side */
+  auto next = ranges_.upper_bound( sequence_number );
+  auto previous = next == ranges_.begin() ? ranges_.end() : std::prev( next );
+
+  if ( previous != ranges_.end() and previous->second > sequence_number ) {
+    return; /* duplicate */
+  }
+
+  /* merge with any adjacent ranges */
+  uint64_t start = sequence_number, end = sequence_number + 1;
+
+  if ( previous != ranges_.end() and previous->second == start ) {
+    start = previous->first;
+    ranges_.erase( previous );
+  }
+
+  if ( next != ranges_.end() and next->first == end ) {
+    end = next->second;
+    ranges_.erase( next );
+  }
+
+  if ( start == cumulative_ack_ ) {
+    cumulative_ack_ = end;
+  } else {
+    ranges_[ start ] = end;
+  }
+
+  /* bound the state by forgetting the oldest range (never by moving
+     the cumulative ack over a hole, which would tell the sender the
+     missing datagrams arrived; forgotten ones it presumes lost) */
+  while ( ranges_.size() > MAX_TRACKED_RANGES ) {
+    ranges_.erase( ranges_.begin() );
+  }
+}
+
+/* summarize, leading with the range that holds sequence_number */
+SackBlock ReceiveHistory::sack( const uint64_t sequence_number ) const
+{
+  SackBlock ret = SackBlock();
+  ret.cumulative_ack = cumulative_ack_;
+
+  auto holder = ranges_.upper_bound( sequence_number );
+  if ( holder != ranges_.begin() and std::prev( holder )->second > sequence_number ) {
+    holder = std::prev( holder );
+    ret.ranges[ ret.range_count++ ] = { holder->first, holder->second };
+  } else {
+    holder = ranges_.end();
+  }
+
+  /* then the most recent of the rest */
+  for ( auto it = ranges_.rbegin();
+	it != ranges_.rend() and ret.range_count < SackBlock::MAX_RANGES; it++ ) {
+    if ( holder == ranges_.end() or it->first != holder->first ) {
+      ret.ranges[ ret.range_count++ ] = { it->first, it->second };
+    }
+  }
+
+  return ret;
+}
+
+Scoreboard::Scoreboard( const unsigned int reorder_threshold )
+  : entries_( 64 ), head_( 0 ), count_( 0 ), base_( 0 ), in_flight_( 0 ),
+    acked_ranges_(),
+    reorder_threshold_( reorder_threshold ),
+    acked_end_( 0 ), rack_sequence_( 0 ),
+    latest_rtt_( 0 ), min_rtt_( 0 ), loss_deadline_( 0 )
+{
+  acked_ranges_.reserve( MAX_ACKED_RANGES + 1 );
+}
+
+const unsigned int Scoreboard::MAX_ACKED_RANGES;
+
+Scoreboard::Entry * Scoreboard::find( const uint64_t sequence_number )
+{
+  if ( sequence_number < base_ or sequence_number - base_ >= count_ ) {
+    return nullptr;
+  }
+
+  return &at( sequence_number );
+}
+
+void Scoreboard::push_back( const Entry & entry )
+{
+  /* when full, unroll the ring into one twice the size */
+  if ( count_ == entries_.size() ) {
+    vector<Entry> larger( 2 * entries_.size() );
+    for ( size_t i = 0; i < count_; i++ ) {
+      larger[ i ] = entries_[ (head_ + i) & (entries_.size() - 1) ];
+    }
+    entries_.swap( larger );
+    head_ = 0;
+  }
+
+  count_++;
+  at( base_ + count_ - 1 ) = entry;
+}
+
+void Scoreboard::pop_front( void )
+{
+  head_ = (head_ + 1) & (entries_.size() - 1);
+  count_--;
+  base_++;
+}
+
+/* a datagram was sent */
+void Scoreboard::sent( const uint64_t sequence_number, const uint64_t send_timestamp )
+{
+  if ( count_ == 0 ) {
+    base_ = sequence_number;
+  } else if ( sequence_number != base_ + count_ ) {
+    throw runtime_error( "scoreboard: sequence numbers must be consecutive" );
+  }
+
+  push_back( { send_timestamp, State::InFlight } );
+  in_flight_++;
+}
+
+/* in-flight datagrams become acked (presumed-lost ones stay lost) */
+void Scoreboard::mark_acked( const uint64_t sequence_number )
+{
+  Entry * const entry = find( sequence_number );
+  if ( entry and entry->state == State::InFlight ) {
+    entry->state = State::Acked;
+    in_flight_--;
+  }
+
+  acked_end_ = max( acked_end_, sequence_number + 1 );
+}
+
+/* [start, end) have been acked: mark the part not acked before */
+void Scoreboard::apply_range( uint64_t start, uint64_t end )
+{
+  start = max( start, base_ );
+  end = min( end, base_ + count_ );
+  if ( start >= end ) {
+    return;
+  }
+
+  /* the first range that overlaps or touches [start, end) */
+  size_t first = 0;
+  while ( first < acked_ranges_.size() and acked_ranges_[ first ].end < start ) {
+    first++;
+  }
+
+  /* mark the gaps between the ranges */
+  size_t last = first;
+  uint64_t n = start;
+  while ( n < end ) {
+    if ( last < acked_ranges_.size() and acked_ranges_[ last ].start <= n ) {
+      n = max( n, acked_ranges_[ last ].end );
+      last++;
+      continue;
+    }
+
+    const uint64_t gap_end = last < acked_ranges_.size()
+      ? min( end, acked_ranges_[ last ].start ) : end;
+    for ( ; n < gap_end; n++ ) {
+      mark_acked( n );
+    }
+  }
+
+  /* and merge them into one */
+  while ( last < acked_ranges_.size() and acked_ranges_[ last ].start <= end ) {
+    last++;
+  }
+
+  if ( last > first ) {
+    acked_ranges_[ first ] = { min( start, acked_ranges_[ first ].start ),
+			       max( end, acked_ranges_[ last - 1 ].end ) };
+    acked_ranges_.erase( acked_ranges_.begin() + first + 1, acked_ranges_.begin() + last );
+  } else {
+    acked_ranges_.insert( acked_ranges_.begin() + first, { start, end } );
+    if ( acked_ranges_.size() > MAX_ACKED_RANGES ) {
+      acked_ranges_.erase( acked_ranges_.begin() );
+    }
+  }
+}
+
+/* forget resolved datagrams at the front */
+void Scoreboard::trim( void )
+{
+  while ( count_ and at( base_ ).state != State::InFlight ) {
+    pop_front();
+  }
+
+  while ( not acked_ranges_.empty() and acked_ranges_.front().end <= base_ ) {
+    acked_ranges_.erase( acked_ranges_.begin() );
+  }
+}
+
+/* an ack arrived */
+void Scoreboard::ack_received( const uint64_t sequence_number, const uint64_t send_timestamp,
+			       const uint64_t timestamp )
+{
+  /* RTT of the latest-sent datagram acked so far */
+  if ( sequence_number >= rack_sequence_ and timestamp >= send_timestamp ) {
+    rack_sequence_ = sequence_number;
+    latest_rtt_ = timestamp - send_timestamp;
+    min_rtt_ = min_rtt_ ? min( min_rtt_, latest_rtt_ ) : latest_rtt_;
+  }
+
+  apply_range( sequence_number, sequence_number + 1 );
+  acked_end_ = max( acked_end_, sequence_number + 1 );
+  trim();
+}
+
+void Scoreboard::ack_received( const uint64_t sequence_number, const uint64_t send_timestamp,
+			       const uint64_t timestamp, const SackBlock & sack )
+{
+  /* everything below the cumulative ack has arrived, and so has
+     everything in the ranges (each datagram is only marked once) */
+  apply_range( base_, sack.cumulative_ack );
+  for ( unsigned int i = 0; i < sack.range_count; i++ ) {
+    apply_range( sack.ranges[ i ].start, sack.ranges[ i ].end );
+  }
+
+  ack_received( sequence_number, send_timestamp, timestamp );
+}
+
+/* presume everything in flight lost */
+uint64_t Scoreboard::abandon_in_flight( void )
+{
+  const uint64_t abandoned = in_flight_;
+
+  base_ += count_;
+  head_ = 0;
+  count_ = 0;
+  in_flight_ = 0;
+  loss_deadline_ = 0;
+  acked_ranges_.clear();
+
+  return abandoned;
+}
+
+/* when the oldest datagram in flight was sent */
+uint64_t Scoreboard::oldest_send_timestamp( void ) const
+{
+  /* after trim(), the front entry is the oldest still in flight */
+  return count_ ? entries_[ head_ ].send_timestamp : 0;
+}
+
+/* find newly presumed-lost datagrams */
+void Scoreboard::detect_losses( const uint64_t now, vector<LostDatagram> & lost )
+{
+  lost.clear();
+  loss_deadline_ = 0;
+
+  /* only datagrams sent before the latest acked one can be presumed lost */
+  const uint64_t end = min( acked_end_, base_ + count_ );
+  size_t range = 0;
+  for ( uint64_t n = base_; n < end; n++ ) {
+    /* skip over what has been acked */
+    while ( range < acked_ranges_.size() and acked_ranges_[ range ].end <= n ) {
+      range++;
+    }
+    if ( range < acked_ranges_.size() and acked_ranges_[ range ].start <= n ) {
+      n = acked_ranges_[ range ].end - 1;
+      continue;
+    }
+
+    Entry & entry = at( n );
+    if ( entry.state != State::InFlight ) {
+      continue;
+    }
+
+    const bool reordered_past = n + reorder_threshold_ < acked_end_;
+    const uint64_t deadline = entry.send_timestamp + latest_rtt_ + min_rtt_ / 4;
+    const bool timed_out = latest_rtt_ > 0 and now >= deadline;
+
+    if ( not (reordered_past or timed_out) ) {
+      /* datagrams after this one were sent later, so can't be lost yet either */
+      if ( latest_rtt_ > 0 ) {
+	loss_deadline_ = deadline;
+      }
+      break;
+    }
+
+    entry.state = State::Lost;
+    in_flight_--;
+    lost.push_back( { n, entry.send_timestamp } );
+  }
+
+  trim();
+}
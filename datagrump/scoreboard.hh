@@ -0,0 +1,126 @@
+#ifndef SCOREBOARD_HH
+#define SCOREBOARD_HH
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "contest_message.hh"
+
+/* Receiver's record of which datagrams have arrived from one sender,
+   summarized in the SACK block of each ack */
+class ReceiveHistory
+{
+private:
+  /* most ranges remembered above the cumulative ack; past this,
+     the receiver forgets the oldest range */
+  static const unsigned int MAX_TRACKED_RANGES = 32;
+
+  uint64_t cumulative_ack_;
+  std::map<uint64_t, uint64_t> ranges_; /* start -> end, above cumulative_ack_ */
+
+public:
+  ReceiveHistory() : cumulative_ack_( 0 ), ranges_() {}
+
+  /* note an arriving datagram */
+  void received( const uint64_t sequence_number );
+
+  /* summarize, leading with the range that holds sequence_number */
+  SackBlock sack( const uint64_t sequence_number ) const;
+};
+
+/* A datagram the sender has given up on */
+struct LostDatagram
+{
+  uint64_t sequence_number;
+  uint64_t send_timestamp;
+};
+
+/* Sender's record of every outstanding datagram: which are still
+   in flight, which have been acked (directly or by a SACK range),
+   and which are presumed lost.
+
+   A datagram is presumed lost once a datagram sent after it has been
+   acked, and either reorder_threshold later datagrams have been acked,
+   or it has gone unacked for an RTT plus a reordering window of a
+   quarter of the minimum RTT (as in RACK, RFC 8985). */
+class Scoreboard
+{
+private:
+  enum class State : uint8_t { InFlight, Acked, Lost };
+
+  /* most acked ranges above base_ remembered (past this, the lowest
+     is forgotten, which only costs time) */
+  static const unsigned int MAX_ACKED_RANGES = 64;
+
+  struct Range
+  {
+    uint64_t start, end; /* [start, end) */
+  };
+
+  struct Entry
+  {
+    uint64_t send_timestamp;
+    State state;
+  };
+
+  /* sequence numbers base_ and up, in a ring that doubles when full
+     (rather than a deque, which allocates as it slides along) */
+  std::vector<Entry> entries_;
+  size_t head_, count_;
+  uint64_t base_;
+  uint64_t in_flight_;
+
+  /* what has been acked above base_, as sorted disjoint ranges, so a
+     SACK block only marks what it adds, and detect_losses() skips what
+     is already resolved (a vector with room reserved, so it doesn't
+     allocate) */
+  std::vector<Range> acked_ranges_;
+
+  unsigned int reorder_threshold_;
+
+  uint64_t acked_end_;         /* one past the highest sequence number acked */
+  uint64_t rack_sequence_;     /* latest-sent datagram with an RTT sample */
+  uint64_t latest_rtt_;        /* its RTT, in nanoseconds */
+  uint64_t min_rtt_;           /* in nanoseconds */
+  uint64_t loss_deadline_;     /* when the oldest in-flight datagram times out, or 0 */
+
+  Entry & at( const uint64_t sequence_number ) { return entries_[ (head_ + sequence_number - base_) & (entries_.size() - 1) ]; }
+  Entry * find( const uint64_t sequence_number );
+  void push_back( const Entry & entry );
+  void pop_front( void );
+  void mark_acked( const uint64_t sequence_number );
+  void apply_range( uint64_t start, uint64_t end );
+  void trim( void );
+
+public:
+  Scoreboard( const unsigned int reorder_threshold = 3 );
+
+  /* a datagram was sent (sequence numbers must be consecutive) */
+  void sent( const uint64_t sequence_number, const uint64_t send_timestamp );
+
+  /* an ack arrived (with or without a SACK block), echoing
+     the send timestamp of the datagram it acknowledges */
+  void ack_received( const uint64_t sequence_number, const uint64_t send_timestamp,
+		     const uint64_t timestamp );
+  void ack_received( const uint64_t sequence_number, const uint64_t send_timestamp,
+		     const uint64_t timestamp, const SackBlock & sack );
+
+  /* move newly presumed-lost datagrams into lost (cleared first) */
+  void detect_losses( const uint64_t now, std::vector<LostDatagram> & lost );
+
+  /* after a retransmission timeout, presume everything in flight lost;
+     returns how many datagrams that was */
+  uint64_t abandon_in_flight( void );
+
+  /* datagrams neither acked nor presumed lost */
+  uint64_t in_flight( void ) const { return in_flight_; }
+
+  /* when the oldest datagram in flight was sent, or 0 if none is */
+  uint64_t oldest_send_timestamp( void ) const;
+
+  /* when detect_losses() may next find a loss by time, or 0 if never */
+  uint64_t loss_deadline( void ) const { return loss_deadline_; }
+};
+
+#endif /* SCOREBOARD_HH */
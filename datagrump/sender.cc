@@ -1,37 +1,146 @@
 /* UDP sender for congestion-control contest */
 
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include "socket.hh"
 #include "contest_message.hh"
 #include "controller.hh"
 #include "poller.hh"
+#include "timestamp.hh"
+#include "pacer.hh"
+#include "event_trace.hh"
+#include "scoreboard.hh"
+#include "rto_estimator.hh"
+#include "drr_scheduler.hh"
+#include "packet_pool.hh"
+#include "allocation_counter.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
+/* most datagrams to send or receive per syscall */
+static const unsigned int MAX_BATCH_SIZE = 32;
+
+/* length of every outgoing datagram, unless the path needs them shorter
+   (1500 bytes less the IPv4 and UDP headers) */
+static const size_t MAX_DATAGRAM_LENGTH = 1472;
+
+/* how departures are spaced out when the controller gives a pacing rate:
+   not at all, by waking up on a timer, by busy-polling, or by handing
+   each datagram to the kernel with its launch time (SO_TXTIME) */
+enum class PacingMode { Off, Timer, BusyPoll, Kernel };
+
 /* simple sender class to handle the accounting */
 class DatagrumpSender
 {
 private:
+  /* one of the flows multiplexed over the socket, with its own
+     congestion controller and accounting (its datagrams carry its ID) */
+  struct Flow
+  {
+    uint32_t id;
+    std::unique_ptr<Controller> controller; /* chosen at runtime */
+
+    uint64_t sequence_number; /* next outgoing sequence number */
+
+    /* which datagrams are in flight, acked, or presumed lost */
+    Scoreboard scoreboard;
+
+    /* retransmission timeout, timed from the oldest datagram in flight */
+    RtoEstimator rto;
+
+    /* decides when the flow's next datagram may leave */
+    Pacer pacer;
+
+    /* the window last reported to the event trace */
+    unsigned int last_window;
+
+    /* wakes the sender for the flow's next deadline (see set_flow_timer) */
+    Poller::TimerId timer;
+    uint64_t wakeup; /* what the timer is set for (0 if nothing) */
+
+    /* the window is open, but pacing holds the next datagram back */
+    bool held;
+
+    Flow( const uint32_t s_id, std::unique_ptr<Controller> && s_controller,
+	  const uint64_t min_rto, const double pacing_burst );
+  };
+
   UDPSocket socket_;
-  Controller controller_; /* your class */
 
-  uint64_t sequence_number_; /* next outgoing sequence number */
+  /* the event loop, which also keeps every flow's timer */
+  Poller poller_;
+
+  /* the rule that sends datagrams, interested while some flow may send */
+  Poller::ActionId send_action_;
+
+  std::vector<Flow> flows_;
+
+  /* picks which flow's window is serviced next */
+  DrrScheduler scheduler_;
+
+  /* scratch space for the datagrams a flow gives up on */
+  std::vector<LostDatagram> lost_;
+
+  /* outgoing datagrams are assembled in place in reusable buffers from the pool */
+  PacketPool pool_;
+  std::vector<Packet> datagrams_;
+
+  /* with segmentation offload (UDP_SEGMENT), a batch is assembled back
+     to back in one buffer instead, and the kernel splits it up */
+  bool gso_;
+  std::string segments_;
+
+  /* length of every outgoing datagram (and so of each segment) */
+  size_t datagram_length_;
+
+  /* acks are received into reusable buffers */
+  DatagramBatch acks_;
+
+  /* pacing: each flow's pacer decides when its next datagram may leave,
+     and (in Timer mode) the flow's timer wakes the loop up for it */
+  PacingMode pacing_mode_;
+  std::vector<uint64_t> launch_times_;
 
-  /* if network does not reorder or lose datagrams,
-     this is the sequence number that the sender
-     next expects will be acknowledged by the receiver */
-  uint64_t next_ack_expected_;
+  /* how many flows pacing alone holds back */
+  unsigned int held_flows_;
 
-  void send_datagram( void );
-  void got_ack( const uint64_t timestamp, const ContestMessage & msg );
-  bool window_is_open( void );
+  /* how many heap allocations were last reported to the event trace */
+  uint64_t last_allocation_count_;
+
+  /* datagrams dropped for not being acks of our flows */
+  uint64_t stray_datagrams_;
+
+  void send_datagrams( void );
+  ContestMessageView outgoing( const unsigned int n, const bool segmented );
+  void got_datagram( const uint64_t timestamp, char * const payload, const size_t length );
+  void got_ack( const uint64_t timestamp, const ContestMessageView & ack,
+		const AckedDatagrams & acked_datagrams );
+  void stray_datagram( const uint64_t timestamp, const uint64_t flow_id );
+  void detect_losses( Flow & flow, const uint64_t now );
+  uint64_t rto_deadline( const Flow & flow );
+  void rto_expired( Flow & flow, const uint64_t now );
+  void service_flow( Flow & flow, const uint64_t now );
+  void set_flow_timer( Flow & flow, const uint64_t now );
+  unsigned int window_space( Flow & flow );
+  bool paced( Flow & flow );
+  bool pacer_allows( Flow & flow, const uint64_t now );
+  bool may_send( Flow & flow, const uint64_t now );
+  bool ready_to_send( const uint64_t now );
+  void trace_window( Flow & flow, const uint64_t now );
+  void trace_allocations( const uint64_t now );
 
 public:
   DatagrumpSender( const char * const host, const char * const port,
-		   const bool debug );
+		   std::vector<std::unique_ptr<Controller>> && controllers,
+		   const unsigned int drr_quantum,
+		   const PacingMode pacing_mode, const double pacing_burst,
+		   const uint64_t max_pacing_rate, const uint64_t min_rto,
+		   const bool gso, const bool gro );
   int loop( void );
 };
 
@@ -43,113 +152,553 @@ int main( int argc, char *argv[] )
   }
 
   bool debug = false;
-  if ( argc == 4 and string( argv[ 3 ] ) == "debug" ) {
-    debug = true;
-  } else if ( argc == 3 ) {
-    /* do nothing */
-  } else {
-    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [debug]" << endl;
+  bool usage_error = argc < 3;
+  ControllerParams params;
+
+  for ( int i = 3; i < argc and not usage_error; i++ ) {
+    const string option( argv[ i ] );
+    if ( option == "debug" ) {
+      debug = true;
+    } else if ( option == "ms" ) {
+      /* compatibility mode: millisecond-quantised timestamps */
+      set_millisecond_timestamps( true );
+    } else if ( option.compare( 0, 6, "trace=" ) == 0 ) {
+      /* binary event trace; decode it with trace2csv */
+      EventTracer::start( option.substr( 6 ) );
+    } else if ( option.compare( 0, 7, "config=" ) == 0 ) {
+      params.load_file( option.substr( 7 ) );
+    } else if ( option.find( '=' ) != string::npos ) {
+      params.set( option );
+    } else {
+      usage_error = true;
+    }
+  }
+
+  if ( usage_error ) {
+    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [debug] [ms] [trace=FILE] [cc=NAME] [config=FILE] [key=value]..." << endl;
+    cerr << "Congestion controllers:";
+    for ( const auto & name : Controller::names() ) {
+      cerr << " " << name;
+    }
+    cerr << endl;
+    return EXIT_FAILURE;
+  }
+
+  /* how many flows to multiplex over the socket, and how many datagrams
+     each may send in its turn */
+  const unsigned int flow_count = params.get( "flows", 1 );
+  const unsigned int drr_quantum = params.get( "drr_quantum", 1 );
+  if ( flow_count == 0 or drr_quantum == 0 ) {
+    cerr << "flows and drr_quantum must be positive" << endl;
+    return EXIT_FAILURE;
+  }
+
+  /* pick the congestion controller and let each flow's copy read its tunables */
+  vector<unique_ptr<Controller>> controllers;
+  for ( unsigned int i = 0; i < flow_count; i++ ) {
+    controllers.push_back( Controller::make( params.get( "cc", "interpolation" ),
+					     debug, params ) );
+  }
+
+  /* pick how departures are paced */
+  const string pacing = params.get( "pacing", "timer" );
+  const double pacing_burst = params.get( "pacing_burst", 2 );
+  PacingMode pacing_mode = PacingMode::Timer;
+  if ( pacing == "off" ) {
+    pacing_mode = PacingMode::Off;
+  } else if ( pacing == "busy" ) {
+    pacing_mode = PacingMode::BusyPoll;
+  } else if ( pacing == "kernel" ) {
+    pacing_mode = PacingMode::Kernel;
+  } else if ( pacing != "timer" ) {
+    cerr << "pacing must be one of off, timer, busy or kernel" << endl;
     return EXIT_FAILURE;
   }
 
+  /* optional cap on the kernel's pacing rate, in bytes per second */
+  const uint64_t max_pacing_rate = params.get( "max_pacing_rate", 0 );
+
+  /* floor on the retransmission timeout (RFC 6298 says 1 s; Linux uses 200 ms) */
+  const uint64_t min_rto = params.get( "min_rto_ms", 200 ) * 1000000;
+
+  /* segmentation offload for sending batches, and coalescing of received acks */
+  const bool gso = params.get( "gso", 0 );
+  const bool gro = params.get( "gro", 0 );
+
+  for ( const auto & key : params.unused() ) {
+    cerr << "Warning: setting \"" << key << "\" is not used by this controller" << endl;
+  }
+
   /* create sender object to handle the accounting */
   /* all the interesting work is done by the Controller */
-  DatagrumpSender sender( argv[ 1 ], argv[ 2 ], debug );
-  return sender.loop();
+  DatagrumpSender sender( argv[ 1 ], argv[ 2 ], move( controllers ), drr_quantum,
+			  pacing_mode, pacing_burst, max_pacing_rate, min_rto, gso, gro );
+  const int status = sender.loop();
+  EventTracer::stop();
+  return status;
 }
 
+DatagrumpSender::Flow::Flow( const uint32_t s_id,
+			     unique_ptr<Controller> && s_controller,
+			     const uint64_t min_rto,
+			     const double pacing_burst )
+  : id( s_id ),
+    controller( move( s_controller ) ),
+    sequence_number( 0 ),
+    scoreboard(),
+    rto( min_rto ),
+    pacer( pacing_burst ),
+    last_window( 0 ),
+    timer( 0 ),
+    wakeup( 0 ),
+    held( false )
+{}
+
 DatagrumpSender::DatagrumpSender( const char * const host,
 				  const char * const port,
-				  const bool debug )
+				  vector<unique_ptr<Controller>> && controllers,
+				  const unsigned int drr_quantum,
+				  const PacingMode pacing_mode,
+				  const double pacing_burst,
+				  const uint64_t max_pacing_rate,
+				  const uint64_t min_rto,
+				  const bool gso,
+				  const bool gro )
   : socket_(),
-    controller_( debug ),
-    sequence_number_( 0 ),
-    next_ack_expected_( 0 )
+    poller_(),
+    send_action_( 0 ),
+    flows_(),
+    scheduler_( controllers.size(), drr_quantum ),
+    lost_(),
+    pool_( MAX_BATCH_SIZE ),
+    datagrams_( MAX_BATCH_SIZE ),
+    gso_( gso ),
+    segments_(),
+    datagram_length_( 0 ),
+    acks_( MAX_BATCH_SIZE ),
+    pacing_mode_( pacing_mode ),
+    launch_times_( MAX_BATCH_SIZE ),
+    held_flows_( 0 ),
+    last_allocation_count_( 0 ),
+    stray_datagrams_( 0 )
 {
+  /* every flow starts out with an open window (and its timer unset) */
+  flows_.reserve( controllers.size() );
+  for ( auto & controller : controllers ) {
+    flows_.emplace_back( flows_.size(), move( controller ), min_rto, pacing_burst );
+    Flow & flow = flows_.back();
+    flow.timer = poller_.add_timer( [this, &flow] () {
+	/* (with millisecond timestamps, the clock can read a little
+	   short of the deadline the timer fired for) */
+	const uint64_t now = max( timestamp_ns(), flow.wakeup );
+	flow.wakeup = 0;
+	service_flow( flow, now );
+	return ResultType::Continue;
+      } );
+    scheduler_.activate( flow.id );
+  }
+
   /* turn on timestamps when socket receives a datagram */
   socket_.set_timestamps();
 
+  /* let datagrams carry their launch times to the fq qdisc */
+  if ( pacing_mode_ == PacingMode::Kernel ) {
+    socket_.set_txtime();
+  }
+
+  if ( max_pacing_rate ) {
+    socket_.set_max_pacing_rate( max_pacing_rate );
+  }
+
+  if ( gro ) {
+    socket_.set_gro();
+  }
+
   /* connect socket to the remote host */
   /* (note: this doesn't send anything; it just tags the socket
      locally with the remote address */
   socket_.connect( Address( host, port ) );
 
-  cerr << "Sending to " << socket_.peer_address().to_string() << endl;
+  /* datagrams (and the segments GSO splits a batch into) must
+     fit the path unfragmented, which over IPv6 or a smaller MTU
+     leaves less room */
+  datagram_length_ = min( MAX_DATAGRAM_LENGTH, socket_.max_payload() );
+  if ( datagram_length_ < ContestMessageView::HEADER_LENGTH ) {
+    throw runtime_error( "path MTU too small for a datagram header" );
+  }
+
+  cerr << "Sending " << flows_.size() << " flow" << (flows_.size() == 1 ? "" : "s")
+       << " to " << socket_.peer_address().to_string() << endl;
+}
+
+/* a datagram arrived on the socket: an ack, unless it's stray
+   (which shouldn't end every flow on the socket) */
+void DatagrumpSender::got_datagram( const uint64_t timestamp,
+				    char * const payload, const size_t length )
+{
+  if ( length < ContestMessageView::HEADER_LENGTH ) {
+    stray_datagram( timestamp, 0 );
+    return;
+  }
+
+  const ContestMessageView ack( payload, length );
+  if ( not ack.is_ack() or ack.flow_id() >= flows_.size() ) {
+    stray_datagram( timestamp, ack.flow_id() );
+    return;
+  }
+
+  /* (a truncated SACK block or aggregate is found before acting on any of it) */
+  AckedDatagrams acked_datagrams;
+  try {
+    acked_datagrams = ack.acked_datagrams();
+  } catch ( const runtime_error & ) {
+    stray_datagram( timestamp, ack.flow_id() );
+    return;
+  }
+
+  got_ack( timestamp, ack, acked_datagrams );
+}
+
+/* count and drop a datagram that isn't an ack for one of the flows */
+void DatagrumpSender::stray_datagram( const uint64_t timestamp, const uint64_t flow_id )
+{
+  if ( stray_datagrams_++ == 0 ) {
+    cerr << "Warning: dropping datagrams that are not acks for any flow" << endl;
+  }
+
+  EventTracer::record( TraceEvent::Stray, timestamp, stray_datagrams_, 0, 0, flow_id );
 }
 
 void DatagrumpSender::got_ack( const uint64_t timestamp,
-			       const ContestMessage & ack )
+			       const ContestMessageView & ack,
+			       const AckedDatagrams & acked_datagrams )
+{
+  Flow & flow = flows_[ ack.flow_id() ];
+
+  /* an aggregated ack covers several datagrams; handle each as if it had its own ack
+     (the SACK block describes the receiver's state after all of them arrived) */
+  const unsigned int count = acked_datagrams.size();
+  for ( unsigned int i = 0; i < count; i++ ) {
+    const AckedDatagram acked = acked_datagrams[ i ];
+
+    /* the RTT, unless the echoed send timestamp is from the future
+       (a corrupt or stray ack) */
+    const bool has_rtt = timestamp >= acked.send_timestamp;
+    const uint64_t rtt = has_rtt ? timestamp - acked.send_timestamp : 0;
+
+    /* Update the scoreboard and the RTO estimate */
+    if ( has_rtt ) {
+      flow.rto.sample( rtt );
+    }
+
+    if ( i == count - 1 and acked_datagrams.has_sack() ) {
+      flow.scoreboard.ack_received( acked.sequence_number, acked.send_timestamp,
+				    timestamp, acked_datagrams.sack() );
+    } else {
+      flow.scoreboard.ack_received( acked.sequence_number, acked.send_timestamp,
+				    timestamp );
+    }
+
+    EventTracer::record( TraceEvent::Ack, timestamp, acked.sequence_number,
+			 rtt / 1e6, 0, flow.id );
+
+    /* Inform congestion controller */
+    flow.controller->ack_received( acked.sequence_number,
+				   acked.send_timestamp,
+				   acked.recv_timestamp,
+				   timestamp,
+				   acked.payload_length );
+  }
+
+  if ( ack.ack_forecast() ) {
+    flow.controller->forecast_received( ack.ack_forecast(), timestamp );
+  }
+
+  detect_losses( flow, timestamp );
+  trace_window( flow, timestamp );
+
+  /* the window may have opened, and the deadlines moved */
+  service_flow( flow, timestamp );
+}
+
+/* Give up on datagrams that should have been acked by now */
+void DatagrumpSender::detect_losses( Flow & flow, const uint64_t now )
 {
-  if ( not ack.is_ack() ) {
-    throw runtime_error( "sender got something other than an ack from the receiver" );
+  flow.scoreboard.detect_losses( now, lost_ );
+
+  for ( const auto & lost : lost_ ) {
+    EventTracer::record( TraceEvent::Loss, now, lost.sequence_number,
+			 (now - lost.send_timestamp) / 1e6, 0, flow.id );
+    flow.controller->loss_detected( lost.sequence_number, lost.send_timestamp, now );
   }
+}
 
-  /* Update sender's counter */
-  next_ack_expected_ = max( next_ack_expected_,
-			    ack.header.ack_sequence_number + 1 );
+/* the retransmission timer runs from when the oldest datagram
+   in flight was sent (0 means nothing is in flight) */
+uint64_t DatagrumpSender::rto_deadline( const Flow & flow )
+{
+  const uint64_t oldest = flow.scoreboard.oldest_send_timestamp();
+  return oldest ? oldest + flow.rto.rto() : 0;
+}
+
+/* The oldest datagram in flight went unacked for a whole RTO */
+void DatagrumpSender::rto_expired( Flow & flow, const uint64_t now )
+{
+  const uint64_t abandoned = flow.scoreboard.abandon_in_flight();
+  flow.rto.backoff();
 
-  /* Inform congestion controller */
-  controller_.ack_received( ack.header.ack_sequence_number,
-			    ack.header.ack_send_timestamp,
-			    ack.header.ack_recv_timestamp,
-			    timestamp );
+  EventTracer::record( TraceEvent::Timeout, now, abandoned, flow.rto.rto() / 1e6, 0, flow.id );
+  flow.controller->timeout_occurred();
 }
 
-void DatagrumpSender::send_datagram( void )
+/* All messages use the same dummy payload (or as much of it as fits) */
+static const string dummy_payload( MAX_DATAGRAM_LENGTH - ContestMessageView::HEADER_LENGTH, 'x' );
+
+/* a reusable outgoing datagram: room for the header, then the dummy payload */
+static string blank_datagram( const size_t length )
 {
-  /* All messages use the same dummy payload */
-  static const string dummy_payload( 1424, 'x' );
+  return string( ContestMessageView::HEADER_LENGTH, 0 )
+    + dummy_payload.substr( 0, length - ContestMessageView::HEADER_LENGTH );
+}
 
-  ContestMessage cm( sequence_number_++, dummy_payload );
-  cm.set_send_timestamp();
-  socket_.send( cm.to_string() );
+/* the nth datagram of a batch being assembled */
+ContestMessageView DatagrumpSender::outgoing( const unsigned int n, const bool segmented )
+{
+  if ( segmented ) {
+    return ContestMessageView( &segments_[ n * datagram_length_ ], datagram_length_ );
+  }
+
+  Packet & datagram = datagrams_.at( n );
+  if ( datagram.empty() ) {
+    datagram = pool_.get();
+    memcpy( datagram.data() + ContestMessageView::HEADER_LENGTH,
+	    dummy_payload.data(), datagram_length_ - ContestMessageView::HEADER_LENGTH );
+    datagram.set_length( datagram_length_ );
+  }
+
+  return ContestMessageView( datagram );
+}
+
+/* fill a batch from the flows in the scheduler's order, and send
+   it with one syscall */
+void DatagrumpSender::send_datagrams( void )
+{
+  /* with kernel pacing, give each datagram its launch time
+     (which rules out segmentation offload, since the kernel
+     would send all the segments at once) */
+  const bool kernel_paced = pacing_mode_ == PacingMode::Kernel;
 
-  /* Inform congestion controller */
-  controller_.datagram_was_sent( cm.header.sequence_number,
-				 cm.header.send_timestamp );
+  const bool segmented = gso_ and not kernel_paced;
+  if ( segmented and segments_.empty() ) {
+    while ( segments_.size() < MAX_BATCH_SIZE * datagram_length_ ) {
+      segments_ += blank_datagram( datagram_length_ );
+    }
+  }
+
+  const uint64_t now = timestamp_ns();
+
+  unsigned int count = 0;
+  while ( count < MAX_BATCH_SIZE and not scheduler_.empty() ) {
+    Flow & flow = flows_[ scheduler_.current() ];
+    if ( not may_send( flow, now ) ) {
+      scheduler_.deactivate_current();
+      set_flow_timer( flow, now );
+      continue;
+    }
+
+    ContestMessageView cm = outgoing( count, segmented );
+    cm.init_header( flow.sequence_number++, flow.id );
+
+    /* the accounting is done as the batch is filled, so the flow's
+       window and pacer see the datagrams ahead of it in the batch */
+    uint64_t departure = now;
+    if ( kernel_paced ) {
+      departure = max( now, flow.pacer.next_departure() );
+      launch_times_[ count ] = departure;
+    }
+    cm.set_send_timestamp( departure );
+
+    flow.pacer.datagram_sent( departure, paced( flow ) ? flow.controller->pacing_rate() : 0 );
+    flow.scoreboard.sent( cm.sequence_number(), departure );
+    EventTracer::record( TraceEvent::Send, departure, cm.sequence_number(), 0, 0, flow.id );
+
+    /* Inform congestion controller */
+    flow.controller->datagram_was_sent( cm.sequence_number(), departure );
+
+    scheduler_.charge();
+    set_flow_timer( flow, now );
+    count++;
+  }
+
+  if ( count == 0 ) {
+    return;
+  } else if ( kernel_paced ) {
+    socket_.send_batch_at( datagrams_, launch_times_, count );
+  } else if ( segmented ) {
+    socket_.send_segmented( segments_.data(), count * datagram_length_, datagram_length_ );
+  } else if ( count == 1 ) {
+    socket_.send( datagrams_.front() );
+  } else {
+    socket_.send_batch( datagrams_, count );
+  }
+}
+
+/* how many more datagrams the flow's window allows right now */
+unsigned int DatagrumpSender::window_space( Flow & flow )
+{
+  const uint64_t in_flight = flow.scoreboard.in_flight();
+
+  /* the window never closes completely, or nothing could restart the ack clock */
+  const unsigned int window = max( 1u, flow.controller->window_size() );
+  return in_flight < window ? window - in_flight : 0;
+}
+
+/* is the flow's controller asking for paced departures? */
+bool DatagrumpSender::paced( Flow & flow )
+{
+  return pacing_mode_ != PacingMode::Off and flow.controller->pacing_rate() > 0;
 }
 
-bool DatagrumpSender::window_is_open( void )
+/* may the flow's next datagram leave now, as far as pacing is concerned?
+   (with kernel pacing, it may be handed to the kernel straight away) */
+bool DatagrumpSender::pacer_allows( Flow & flow, const uint64_t now )
 {
-  return sequence_number_ - next_ack_expected_ < controller_.window_size();
+  return not paced( flow ) or pacing_mode_ == PacingMode::Kernel or flow.pacer.may_send( now );
+}
+
+/* may the flow send a datagram now? */
+bool DatagrumpSender::may_send( Flow & flow, const uint64_t now )
+{
+  return window_space( flow ) > 0 and pacer_allows( flow, now );
+}
+
+/* may the flow whose turn it is send now? (dropping flows that
+   can't from the head of the line, until one can) */
+bool DatagrumpSender::ready_to_send( const uint64_t now )
+{
+  while ( not scheduler_.empty() and not may_send( flows_[ scheduler_.current() ], now ) ) {
+    Flow & flow = flows_[ scheduler_.current() ];
+    scheduler_.deactivate_current();
+    set_flow_timer( flow, now );
+  }
+
+  return not scheduler_.empty();
+}
+
+/* act on the flow's expired deadlines, and put it back in line if it may send */
+void DatagrumpSender::service_flow( Flow & flow, const uint64_t now )
+{
+  if ( flow.scoreboard.loss_deadline() and now >= flow.scoreboard.loss_deadline() ) {
+    detect_losses( flow, now );
+  }
+
+  if ( rto_deadline( flow ) and now >= rto_deadline( flow ) ) {
+    rto_expired( flow, now );
+  }
+
+  /* a flow with a closed window waits for acks (or its timer) */
+  if ( may_send( flow, now ) ) {
+    scheduler_.activate( flow.id );
+    poller_.update_interest( send_action_ );
+  }
+
+  set_flow_timer( flow, now );
+}
+
+/* set the flow's timer for its next loss or retransmission deadline,
+   or for its next departure if only pacing holds it back */
+void DatagrumpSender::set_flow_timer( Flow & flow, const uint64_t now )
+{
+  const bool held = window_space( flow ) > 0 and not pacer_allows( flow, now );
+  if ( held != flow.held ) {
+    flow.held = held;
+    held ? held_flows_++ : held_flows_--;
+  }
+
+  uint64_t wakeup = 0;
+  for ( const uint64_t deadline : { flow.scoreboard.loss_deadline(), rto_deadline( flow ),
+				    held ? flow.pacer.next_departure() : 0 } ) {
+    if ( deadline and (not wakeup or deadline < wakeup) ) {
+      wakeup = deadline;
+    }
+  }
+
+  if ( wakeup == flow.wakeup ) {
+    return;
+  }
+
+  flow.wakeup = wakeup;
+  if ( wakeup ) {
+    poller_.set_timer( flow.timer, wakeup );
+  } else {
+    poller_.clear_timer( flow.timer );
+  }
+}
+
+/* note how much the sending thread has allocated (which should
+   be nothing, once every buffer has been set up) */
+void DatagrumpSender::trace_allocations( const uint64_t now )
+{
+  const uint64_t count = allocation_count();
+  EventTracer::record( TraceEvent::Allocations, now, count, count - last_allocation_count_ );
+  last_allocation_count_ = count;
+}
+
+/* note window changes in the event trace */
+void DatagrumpSender::trace_window( Flow & flow, const uint64_t now )
+{
+  const unsigned int window = flow.controller->window_size();
+  if ( window != flow.last_window ) {
+    flow.last_window = window;
+    EventTracer::record( TraceEvent::WindowChange, now, window,
+			 flow.controller->pacing_rate(), 0, flow.id );
+  }
 }
 
 int DatagrumpSender::loop( void )
 {
-  /* read and write from the receiver using an event-driven "poller" */
-  Poller poller;
+  /* read and write from the receiver using an event-driven "poller"
+     (every flow's timer is already registered with it) */
 
-  /* first rule: if the window is open, close it by
+  /* first rule: if any flow's window is open, close it by
      sending more datagrams */
-  poller.add_action( Action( socket_, Direction::Out, [&] () {
-	/* Close the window */
-	while ( window_is_open() ) {
-	  send_datagram();
-	}
+  send_action_ = poller_.add_action( Action( socket_, Direction::Out, [&] () {
+	send_datagrams();
 	return ResultType::Continue;
       },
-      /* We're only interested in this rule when the window is open */
-      [&] () { return window_is_open(); } ) );
+      /* We're only interested in this rule when some flow may send */
+      [&] () { return ready_to_send( timestamp_ns() ); } ) );
 
   /* second rule: if sender receives an ack,
-     process it and inform the controller
+     process it and inform the flow's controller
      (by using the sender's got_ack method) */
-  poller.add_action( Action( socket_, Direction::In, [&] () {
-	const UDPSocket::received_datagram recd = socket_.recv();
-	const ContestMessage ack  = recd.payload;
-	got_ack( recd.timestamp, ack );
+  poller_.add_action( Action( socket_, Direction::In, [&] () {
+	const unsigned int count = socket_.recv_batch( acks_ );
+	for ( unsigned int i = 0; i < count; i++ ) {
+	  got_datagram( acks_.timestamp( i ), acks_.payload( i ), acks_.length( i ) );
+	}
 	return ResultType::Continue;
       } ) );
 
-  /* Run these two rules forever */
+  /* about once a second, report the heap allocations */
+  static const uint64_t ALLOCATION_REPORT_INTERVAL = 1000000000;
+  const Poller::TimerId allocation_report = poller_.add_timer( [&] () {
+      trace_allocations( timestamp_ns() );
+      return ResultType::Continue;
+    } );
+  poller_.set_timer( allocation_report, timestamp_ns() + ALLOCATION_REPORT_INTERVAL,
+		     ALLOCATION_REPORT_INTERVAL );
+
+  /* Run these rules forever */
   while ( true ) {
-    const auto ret = poller.poll( controller_.timeout_ms() );
+    /* with busy-poll pacing, spin instead of sleeping while only
+       pacing holds flows back (the timers run as soon as they're due) */
+    const bool spin = pacing_mode_ == PacingMode::BusyPoll
+      and held_flows_ > 0 and scheduler_.empty();
+
+    const auto ret = poller_.poll( spin ? 0 : -1 );
     if ( ret.result == PollResult::Exit ) {
       return ret.exit_status;
-    } else if ( ret.result == PollResult::Timeout ) {
-      /* After a timeout, send one datagram to try to get things moving again */
-      //controller_.timeout_occurred();
-      send_datagram();
     }
   }
 }
@@ -0,0 +1,552 @@
+/* offline, trace-driven link emulator for evaluating congestion controllers */
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "capacity_forecast.hh"
+#include "controller.hh"
+#include "contest_message.hh"
+#include "link_stats.hh"
+#include "pacer.hh"
+#include "event_trace.hh"
+#include "scoreboard.hh"
+#include "rto_estimator.hh"
+
+using namespace std;
+
+/* nanoseconds per millisecond and per second */
+static const uint64_t MILLION = 1000000;
+static const uint64_t BILLION = 1000 * MILLION;
+
+/* size of a datagram on the wire (payload + header + UDP + IPv4),
+   which fits in one 1504-byte mahimahi delivery opportunity */
+static const uint64_t DATAGRAM_BYTES = 1500;
+static const uint64_t OPPORTUNITY_BYTES = 1504;
+
+/* its payload: what is left after the IPv4 and UDP headers (28 bytes)
+   and the contest header */
+static const uint64_t PAYLOAD_BYTES = DATAGRAM_BYTES - 28 - ContestMessageView::HEADER_LENGTH;
+
+/* a mahimahi packet-delivery trace: one line per delivery opportunity,
+   in milliseconds, repeating forever with the period of the last line */
+class Trace
+{
+private:
+  vector<uint64_t> opportunities_; /* in nanoseconds */
+  uint64_t period_;
+
+public:
+  Trace( const string & filename );
+
+  /* time of the nth delivery opportunity */
+  uint64_t opportunity( const uint64_t n ) const
+  {
+    return (n / opportunities_.size()) * period_ + opportunities_[ n % opportunities_.size() ];
+  }
+
+  uint64_t period( void ) const { return period_; }
+};
+
+Trace::Trace( const string & filename )
+  : opportunities_(), period_( 0 )
+{
+  ifstream file( filename );
+  if ( not file ) {
+    throw runtime_error( "could not open trace file " + filename );
+  }
+
+  uint64_t ms;
+  while ( file >> ms ) {
+    if ( not opportunities_.empty() and ms * MILLION < opportunities_.back() ) {
+      throw runtime_error( filename + ": trace timestamps must not decrease" );
+    }
+    opportunities_.push_back( ms * MILLION );
+  }
+
+  if ( opportunities_.empty() or opportunities_.back() == 0 ) {
+    throw runtime_error( filename + ": trace must end at a positive timestamp" );
+  }
+
+  period_ = opportunities_.back();
+}
+
+/* one direction of an emulated path: a drop-tail FIFO queue served at
+   the trace's delivery opportunities (or instantly, with no trace),
+   followed by a fixed propagation delay */
+class Link
+{
+private:
+  const Trace * trace_;
+  uint64_t propagation_delay_;
+  unsigned int queue_limit_; /* in packets; 0 means unlimited */
+
+  uint64_t next_opportunity_;
+  deque<uint64_t> departures_; /* of packets still in the queue */
+
+public:
+  Link( const Trace * const trace, const uint64_t propagation_delay, const unsigned int queue_limit )
+    : trace_( trace ), propagation_delay_( propagation_delay ), queue_limit_( queue_limit ),
+      next_opportunity_( 0 ), departures_()
+  {}
+
+  /* a packet enters the link at time now; returns when it leaves the
+     queue (or false if it is dropped) */
+  bool enqueue( const uint64_t now, uint64_t & departure )
+  {
+    while ( not departures_.empty() and departures_.front() <= now ) {
+      departures_.pop_front();
+    }
+
+    if ( queue_limit_ and departures_.size() >= queue_limit_ ) {
+      return false;
+    }
+
+    if ( not trace_ ) {
+      departure = now;
+      return true;
+    }
+
+    /* opportunities that pass while the queue is empty are wasted */
+    while ( trace_->opportunity( next_opportunity_ ) < now ) {
+      next_opportunity_++;
+    }
+
+    departure = trace_->opportunity( next_opportunity_++ );
+    departures_.push_back( departure );
+    return true;
+  }
+
+  uint64_t propagation_delay( void ) const { return propagation_delay_; }
+
+  /* forbid copying, since a Link points to its trace */
+  Link( const Link & other ) = delete;
+  Link & operator=( const Link & other ) = delete;
+};
+
+/* settings shared by every simulation in a sweep */
+struct SimulationConfig
+{
+  string controller;
+  bool debug;
+  uint64_t duration;          /* in nanoseconds; 0 means one trace period */
+  uint64_t one_way_delay;     /* in nanoseconds */
+  unsigned int queue_limit;   /* in packets; 0 means unlimited */
+  double pacing_burst;        /* in datagrams */
+  string downlink_trace;      /* empty means acks see only the delay */
+  uint64_t min_rto;           /* in nanoseconds */
+  int64_t clock_offset;       /* receiver's clock ahead of the sender's, in nanoseconds */
+  double clock_drift;         /* and running faster by this fraction */
+  shared_ptr<const ForecastModel> forecast_model; /* null unless the receiver forecasts */
+
+  SimulationConfig( const ControllerParams & params, const bool s_debug )
+    : controller( params.get( "cc", "interpolation" ) ),
+      debug( s_debug ),
+      duration( params.get( "duration", 0 ) * BILLION ),
+      one_way_delay( params.get( "delay_ms", 20 ) * MILLION ),
+      queue_limit( params.get( "queue_packets", 0 ) ),
+      pacing_burst( params.get( "pacing_burst", 2 ) ),
+      downlink_trace( params.get( "downlink", "" ) ),
+      min_rto( params.get( "min_rto_ms", 200 ) * MILLION ),
+      clock_offset( params.get( "clock_offset_ms", 0 ) * MILLION ),
+      clock_drift( params.get( "clock_drift_ppm", 0 ) / MILLION ),
+      forecast_model( params.get( "forecast", controller == "forecast" )
+		      ? make_shared<ForecastModel>( params ) : nullptr )
+  {}
+};
+
+/* what happened in one simulation */
+struct SimulationResult
+{
+  LinkStats uplink;
+  uint64_t sent;
+  uint64_t dropped;
+
+  SimulationResult() : uplink(), sent( 0 ), dropped( 0 ) {}
+};
+
+/* a sender running the real Controller over emulated links, in virtual time */
+class Simulation
+{
+private:
+  enum class EventType { DatagramArrives, AckArrives, PacingTimer, LossTimer, RetransmissionTimer };
+
+  struct Event
+  {
+    uint64_t time;
+    uint64_t order; /* breaks ties in scheduling order */
+    EventType type;
+    uint64_t sequence_number;
+    uint64_t send_timestamp;
+    uint64_t recv_timestamp;
+    SackBlock sack;
+    uint64_t forecast;
+
+    bool operator>( const Event & other ) const
+    {
+      return time != other.time ? time > other.time : order > other.order;
+    }
+  };
+
+  unique_ptr<Controller> controller_;
+  Link uplink_, downlink_;
+  Pacer pacer_;
+  uint64_t end_;
+  int64_t clock_offset_;
+  double clock_drift_;
+
+  priority_queue<Event, vector<Event>, greater<Event>> events_;
+  uint64_t now_, event_order_;
+
+  uint64_t sequence_number_;
+  Scoreboard scoreboard_;          /* the sender's */
+  ReceiveHistory receive_history_; /* the receiver's */
+  shared_ptr<const ForecastModel> forecast_model_;
+  CapacityForecast forecast_;      /* the receiver's */
+  vector<LostDatagram> lost_;
+  RtoEstimator rto_;
+  uint64_t pacing_timer_, loss_timer_, rto_timer_;
+  unsigned int last_window_; /* the window last reported to the event trace */
+
+  SimulationResult result_;
+
+  void schedule( const uint64_t time, const EventType type,
+		 const uint64_t sequence_number = 0,
+		 const uint64_t send_timestamp = 0,
+		 const uint64_t recv_timestamp = 0,
+		 const SackBlock & sack = SackBlock(),
+		 const uint64_t forecast = 0 );
+
+  bool window_is_open( void );
+  void send_datagram( void );
+  void send_while_allowed( void );
+  void arm_rto_timer( void );
+  void detect_losses( void );
+  void trace_window( void );
+  uint64_t receiver_clock( void ) const;
+
+public:
+  Simulation( unique_ptr<Controller> && controller,
+	      const Trace & uplink_trace, const Trace * const downlink_trace,
+	      const SimulationConfig & config );
+
+  SimulationResult run( void );
+};
+
+Simulation::Simulation( unique_ptr<Controller> && controller,
+			const Trace & uplink_trace, const Trace * const downlink_trace,
+			const SimulationConfig & config )
+  : controller_( move( controller ) ),
+    uplink_( &uplink_trace, config.one_way_delay, config.queue_limit ),
+    downlink_( downlink_trace, config.one_way_delay, 0 ),
+    pacer_( config.pacing_burst ),
+    end_( config.duration ? config.duration : uplink_trace.period() ),
+    clock_offset_( config.clock_offset ), clock_drift_( config.clock_drift ),
+    events_(), now_( 0 ), event_order_( 0 ),
+    sequence_number_( 0 ), scoreboard_(), receive_history_(),
+    forecast_model_( config.forecast_model ), forecast_(), lost_(),
+    rto_( config.min_rto ),
+    pacing_timer_( 0 ), loss_timer_( 0 ), rto_timer_( 0 ), last_window_( 0 ),
+    result_()
+{
+  /* count the capacity the trace offered over the run */
+  for ( uint64_t n = 0; uplink_trace.opportunity( n ) < end_; n++ ) {
+    result_.uplink.opportunity( uplink_trace.opportunity( n ), OPPORTUNITY_BYTES );
+  }
+  result_.uplink.finish( end_ );
+}
+
+void Simulation::schedule( const uint64_t time, const EventType type,
+			   const uint64_t sequence_number,
+			   const uint64_t send_timestamp,
+			   const uint64_t recv_timestamp,
+			   const SackBlock & sack,
+			   const uint64_t forecast )
+{
+  events_.push( { time, event_order_++, type, sequence_number, send_timestamp, recv_timestamp,
+		  sack, forecast } );
+}
+
+bool Simulation::window_is_open( void )
+{
+  return scoreboard_.in_flight() < max( 1u, controller_->window_size() );
+}
+
+/* the datagram enters the uplink queue as soon as it is sent */
+void Simulation::send_datagram( void )
+{
+  const uint64_t sequence_number = sequence_number_++;
+  result_.sent++;
+
+  pacer_.datagram_sent( now_, controller_->pacing_rate() );
+  scoreboard_.sent( sequence_number, now_ );
+  EventTracer::record( TraceEvent::Send, now_, sequence_number );
+  controller_->datagram_was_sent( sequence_number, now_ );
+
+  uint64_t departure;
+  if ( not uplink_.enqueue( now_, departure ) ) {
+    result_.dropped++;
+    return;
+  }
+
+  if ( departure < end_ ) {
+    result_.uplink.delivery( departure, DATAGRAM_BYTES, double( departure - now_ ) / MILLION );
+  }
+
+  schedule( departure + uplink_.propagation_delay(), EventType::DatagramArrives,
+	    sequence_number, now_ );
+}
+
+/* send what the window and the pacer allow, as DatagrumpSender does */
+void Simulation::send_while_allowed( void )
+{
+  while ( window_is_open() ) {
+    if ( controller_->pacing_rate() > 0 and not pacer_.may_send( now_ ) ) {
+      if ( pacing_timer_ != pacer_.next_departure() ) {
+	pacing_timer_ = pacer_.next_departure();
+	schedule( pacing_timer_, EventType::PacingTimer );
+      }
+      return;
+    }
+
+    send_datagram();
+  }
+}
+
+/* the retransmission timer runs from when the oldest datagram in flight was sent */
+void Simulation::arm_rto_timer( void )
+{
+  const uint64_t oldest = scoreboard_.oldest_send_timestamp();
+  const uint64_t deadline = oldest ? oldest + rto_.rto() : 0;
+  if ( deadline and deadline != rto_timer_ ) {
+    rto_timer_ = max( deadline, now_ );
+    schedule( rto_timer_, EventType::RetransmissionTimer );
+  }
+}
+
+/* give up on datagrams that should have been acked by now,
+   and wake up when the next one should be */
+void Simulation::detect_losses( void )
+{
+  scoreboard_.detect_losses( now_, lost_ );
+
+  for ( const auto & lost : lost_ ) {
+    EventTracer::record( TraceEvent::Loss, now_, lost.sequence_number,
+			 double( now_ - lost.send_timestamp ) / MILLION );
+    controller_->loss_detected( lost.sequence_number, lost.send_timestamp, now_ );
+  }
+
+  const uint64_t deadline = scoreboard_.loss_deadline();
+  if ( deadline and deadline != loss_timer_ ) {
+    loss_timer_ = deadline;
+    schedule( loss_timer_, EventType::LossTimer );
+  }
+}
+
+/* note window changes in the event trace (timestamps are virtual) */
+void Simulation::trace_window( void )
+{
+  const unsigned int window = controller_->window_size();
+  if ( window != last_window_ ) {
+    last_window_ = window;
+    EventTracer::record( TraceEvent::WindowChange, now_, window, controller_->pacing_rate() );
+  }
+}
+
+/* the time by the receiver's clock, which is off by clock_offset_
+   and drifts by clock_drift_ */
+uint64_t Simulation::receiver_clock( void ) const
+{
+  return now_ + clock_offset_ + int64_t( clock_drift_ * now_ );
+}
+
+SimulationResult Simulation::run( void )
+{
+  send_while_allowed();
+  arm_rto_timer();
+
+  while ( not events_.empty() and events_.top().time < end_ ) {
+    const Event event = events_.top();
+    events_.pop();
+    now_ = event.time;
+
+    switch ( event.type ) {
+    case EventType::DatagramArrives:
+      {
+	/* the receiver acks immediately, with a SACK block
+	   (and its forecast, if it makes one) */
+	receive_history_.received( event.sequence_number );
+	if ( forecast_model_ ) {
+	  forecast_.arrival( *forecast_model_, event.send_timestamp, receiver_clock(), PAYLOAD_BYTES );
+	}
+
+	uint64_t departure;
+	if ( downlink_.enqueue( now_, departure ) ) {
+	  schedule( departure + downlink_.propagation_delay(), EventType::AckArrives,
+		    event.sequence_number, event.send_timestamp, receiver_clock(),
+		    receive_history_.sack( event.sequence_number ), forecast_.forecast() );
+	}
+      }
+      continue; /* not seen by the sender */
+
+    case EventType::AckArrives:
+      rto_.sample( now_ - event.send_timestamp );
+      scoreboard_.ack_received( event.sequence_number, event.send_timestamp, now_, event.sack );
+      EventTracer::record( TraceEvent::Ack, now_, event.sequence_number,
+			   double( now_ - event.send_timestamp ) / MILLION );
+      controller_->ack_received( event.sequence_number, event.send_timestamp,
+				 event.recv_timestamp, now_, PAYLOAD_BYTES );
+      if ( event.forecast ) {
+	controller_->forecast_received( event.forecast, now_ );
+      }
+      detect_losses();
+      break;
+
+    case EventType::PacingTimer:
+      if ( event.time != pacing_timer_ ) {
+	continue; /* superseded */
+      }
+      pacing_timer_ = 0;
+      break;
+
+    case EventType::LossTimer:
+      if ( event.time != loss_timer_ ) {
+	continue; /* superseded */
+      }
+      loss_timer_ = 0;
+      detect_losses();
+      break;
+
+    case EventType::RetransmissionTimer:
+      if ( event.time != rto_timer_ ) {
+	continue; /* superseded */
+      }
+      rto_timer_ = 0;
+      {
+	/* the oldest datagram in flight went unacked for a whole RTO */
+	const uint64_t abandoned = scoreboard_.abandon_in_flight();
+	rto_.backoff();
+	EventTracer::record( TraceEvent::Timeout, now_, abandoned, double( rto_.rto() ) / MILLION );
+	controller_->timeout_occurred();
+      }
+      break;
+    }
+
+    trace_window();
+    send_while_allowed();
+    arm_rto_timer();
+  }
+
+  return move( result_ );
+}
+
+/* run one trace and describe the outcome in one line */
+static string simulate( const string & uplink_filename,
+			const SimulationConfig & config,
+			const ControllerParams & params )
+{
+  const Trace uplink_trace( uplink_filename );
+  unique_ptr<Trace> downlink_trace;
+  if ( not config.downlink_trace.empty() ) {
+    downlink_trace.reset( new Trace( config.downlink_trace ) );
+  }
+
+  Simulation simulation( Controller::make( config.controller, config.debug, params ),
+			 uplink_trace, downlink_trace.get(), config );
+  const SimulationResult result = simulation.run();
+  const LinkStats & uplink = result.uplink;
+
+  ostringstream out;
+  out << fixed << setprecision( 2 )
+      << uplink_filename << ": " << uplink.duration_seconds() << " s, "
+      << "throughput " << uplink.throughput_mbps() << " Mbit/s (capacity "
+      << uplink.capacity_mbps() << " Mbit/s, " << setprecision( 1 )
+      << 100 * uplink.throughput_mbps() / uplink.capacity_mbps() << "% utilization), "
+      << "95th percentile queueing delay " << setprecision( 2 )
+      << uplink.delay_percentile_ms( 0.95 ) << " ms, "
+      << "power " << uplink.power() << ", "
+      << result.sent << " sent, " << result.dropped << " dropped";
+
+  return out.str();
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  bool debug = false;
+  vector<string> traces;
+  ControllerParams params;
+  string trace_filename;
+
+  for ( int i = 1; i < argc; i++ ) {
+    const string option( argv[ i ] );
+    if ( option == "debug" ) {
+      debug = true;
+    } else if ( option.compare( 0, 6, "trace=" ) == 0 ) {
+      trace_filename = option.substr( 6 );
+    } else if ( option.compare( 0, 7, "config=" ) == 0 ) {
+      params.load_file( option.substr( 7 ) );
+    } else if ( option.find( '=' ) != string::npos ) {
+      params.set( option );
+    } else {
+      traces.push_back( option );
+    }
+  }
+
+  if ( traces.empty() ) {
+    cerr << "Usage: " << argv[ 0 ] << " UPLINK_TRACE... [debug] [trace=FILE] [cc=NAME] [config=FILE]"
+	 << " [duration=SECONDS] [delay_ms=20] [queue_packets=0] [downlink=TRACE]"
+	 << " [clock_offset_ms=0] [clock_drift_ppm=0] [forecast=0] [key=value]..." << endl;
+    cerr << "Each trace is simulated on its own thread"
+	 << " (and gets its own thread number in the event trace)." << endl;
+    return EXIT_FAILURE;
+  }
+
+  const SimulationConfig config( params, debug );
+
+  /* make one controller up front, so bad settings fail before the threads start */
+  Controller::make( config.controller, debug, params );
+  for ( const auto & key : params.unused() ) {
+    cerr << "Warning: setting \"" << key << "\" is not used by this controller" << endl;
+  }
+
+  if ( not trace_filename.empty() ) {
+    EventTracer::start( trace_filename );
+  }
+
+  vector<string> results( traces.size() );
+  vector<thread> threads;
+
+  for ( size_t i = 0; i < traces.size(); i++ ) {
+    /* each thread gets its own copy of the settings */
+    threads.emplace_back( [&results, &traces, &config, params, i] () {
+	try {
+	  results[ i ] = simulate( traces[ i ], config, params );
+	} catch ( const exception & e ) {
+	  results[ i ] = traces[ i ] + ": " + e.what();
+	}
+      } );
+  }
+
+  for ( size_t i = 0; i < threads.size(); i++ ) {
+    threads[ i ].join();
+    cerr << results[ i ] << endl;
+  }
+
+  EventTracer::stop();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+/* decode a binary event trace (from sender or simulate trace=FILE) into CSV */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "event_trace.hh"
+
+using namespace std;
+
+static const char * event_name( const uint16_t event )
+{
+  switch ( TraceEvent( event ) ) {
+  case TraceEvent::Send: return "send";
+  case TraceEvent::Ack: return "ack";
+  case TraceEvent::Timeout: return "timeout";
+  case TraceEvent::WindowChange: return "window";
+  case TraceEvent::RttPrediction: return "rtt_prediction";
+  case TraceEvent::Loss: return "loss";
+  case TraceEvent::Allocations: return "allocations";
+  case TraceEvent::PathModel: return "path_model";
+  case TraceEvent::ForwardDelay: return "forward_delay";
+  case TraceEvent::Stray: return "stray";
+  }
+
+  return "unknown";
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc != 2 ) {
+    cerr << "Usage: " << argv[ 0 ] << " TRACEFILE" << endl;
+    cerr << "Prints \"time_ns,thread,event,value,x,y,flow\" for each record to stdout." << endl;
+    return EXIT_FAILURE;
+  }
+
+  ifstream trace( argv[ 1 ], ios::binary );
+  char magic[ sizeof( TRACE_MAGIC ) ];
+  if ( not trace.read( magic, sizeof( magic ) )
+       or memcmp( magic, TRACE_MAGIC, sizeof( magic ) ) ) {
+    cerr << argv[ 1 ] << ": not an event trace" << endl;
+    return EXIT_FAILURE;
+  }
+
+  cout << "time_ns,thread,event,value,x,y,flow" << endl;
+  cout << setprecision( 9 );
+
+  TraceRecord record;
+  while ( trace.read( reinterpret_cast<char *>( &record ), sizeof( record ) ) ) {
+    cout << record.timestamp << ',' << record.thread << ',' << event_name( record.event )
+	 << ',' << record.value << ',' << record.x << ',' << record.y << ',' << record.flow << '\n';
+  }
+
+  if ( trace.gcount() ) {
+    cerr << argv[ 1 ] << ": ignoring truncated record at end" << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
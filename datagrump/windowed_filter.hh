@@ -0,0 +1,77 @@
+#ifndef WINDOWED_FILTER_HH
+#define WINDOWED_FILTER_HH
+
+#include <cstdint>
+#include <functional>
+
+/* Running maximum (or, with std::less, minimum) of the samples seen
+   over the last `window` units of time, in constant time and space.
+   Kathleen Nichols' algorithm, as in Linux's win_minmax: it keeps the
+   best, second-best and third-best samples of successive sub-windows,
+   so the estimate ages out gracefully when the best sample expires.
+   Time is whatever the caller counts in (nanoseconds, round trips...). */
+template <typename T, typename Compare = std::greater<T>>
+class WindowedFilter
+{
+private:
+  struct Sample
+  {
+    T value;
+    uint64_t time;
+  };
+
+  uint64_t window_;
+  Sample estimates_[ 3 ];
+  Compare better_;
+
+  void reset( const T & value, const uint64_t time )
+  {
+    estimates_[ 0 ] = estimates_[ 1 ] = estimates_[ 2 ] = { value, time };
+  }
+
+public:
+  WindowedFilter( const uint64_t window, const T & initial = T() )
+    : window_( window ), estimates_(), better_()
+  {
+    reset( initial, 0 );
+  }
+
+  /* the best sample in the window */
+  const T & best( void ) const { return estimates_[ 0 ].value; }
+
+  /* add a sample (times must not go backwards) */
+  void update( const T & value, const uint64_t time )
+  {
+    /* a new best sample, or nothing in the window: start over */
+    if ( not better_( estimates_[ 0 ].value, value ) or time - estimates_[ 2 ].time > window_ ) {
+      reset( value, time );
+      return;
+    }
+
+    if ( not better_( estimates_[ 1 ].value, value ) ) {
+      estimates_[ 1 ] = estimates_[ 2 ] = { value, time };
+    } else if ( not better_( estimates_[ 2 ].value, value ) ) {
+      estimates_[ 2 ] = { value, time };
+    }
+
+    /* age out the best sample, promoting the next ones */
+    const uint64_t elapsed = time - estimates_[ 0 ].time;
+    if ( elapsed > window_ ) {
+      estimates_[ 0 ] = estimates_[ 1 ];
+      estimates_[ 1 ] = estimates_[ 2 ];
+      estimates_[ 2 ] = { value, time };
+      if ( time - estimates_[ 0 ].time > window_ ) {
+	estimates_[ 0 ] = estimates_[ 1 ];
+	estimates_[ 1 ] = estimates_[ 2 ];
+      }
+    } else if ( estimates_[ 1 ].time == estimates_[ 0 ].time and elapsed > window_ / 4 ) {
+      /* a quarter of the window has passed without a second-best sample */
+      estimates_[ 1 ] = estimates_[ 2 ] = { value, time };
+    } else if ( estimates_[ 2 ].time == estimates_[ 1 ].time and elapsed > window_ / 2 ) {
+      /* half the window has passed without a third-best sample */
+      estimates_[ 2 ] = { value, time };
+    }
+  }
+};
+
+#endif /* WINDOWED_FILTER_HH */
@@ -140,3 +140,12 @@ bool Address::operator==( const Address & other ) const
 {
   return 0 == memcmp( &addr_, &other.addr_, size_ );
 }
+
+bool Address::operator<( const Address & other ) const
+{
+  if ( size_ != other.size_ ) {
+    return size_ < other.size_;
+  }
+
+  return memcmp( &addr_, &other.addr_, size_ ) < 0;
+}
@@ -47,6 +47,9 @@ public:
 
   /* equality */
   bool operator==( const Address & other ) const;
+
+  /* ordering (arbitrary but consistent), so addresses can key a map */
+  bool operator<( const Address & other ) const;
 };
 
 #endif /* ADDRESS_HH */
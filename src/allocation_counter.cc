@@ -0,0 +1,51 @@
+#include <cstdlib>
+#include <new>
+
+#include "allocation_counter.hh"
+
+/* plain old data, so no thread pays for initializing it */
+static thread_local uint64_t allocations = 0;
+
+uint64_t allocation_count( void )
+{
+  return allocations;
+}
+
+/* the replacements allocate with malloc(), as the defaults do,
+   so the default operator delete still frees what they return */
+void * operator new( std::size_t size )
+{
+  allocations++;
+
+  for ( ;; ) {
+    void * const ret = std::malloc( size ? size : 1 );
+    if ( ret ) {
+      return ret;
+    }
+
+    const std::new_handler handler = std::get_new_handler();
+    if ( not handler ) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void * operator new[]( std::size_t size )
+{
+  return operator new( size );
+}
+
+void * operator new( std::size_t size, const std::nothrow_t & ) noexcept
+{
+  try {
+    return operator new( size );
+  } catch ( ... ) {
+    return nullptr;
+  }
+}
+
+void * operator new[]( std::size_t size, const std::nothrow_t & ) noexcept
+{
+  return operator new( size, std::nothrow );
+}
@@ -0,0 +1,13 @@
+#ifndef ALLOCATION_COUNTER_HH
+#define ALLOCATION_COUNTER_HH
+
+#include <cstdint>
+
+/* Linking this in replaces the global operator new with one that
+   counts heap allocations (per thread), so a test or a long-running
+   loop can check that its steady state doesn't allocate */
+
+/* how many times the calling thread has called operator new */
+uint64_t allocation_count( void );
+
+#endif /* ALLOCATION_COUNTER_HH */
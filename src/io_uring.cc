@@ -0,0 +1,546 @@
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "io_uring.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* what a completion's user_data says it is the result of */
+enum class RequestKind : uint64_t { Receive = 1, Action, Send, Cancel };
+
+static uint64_t user_data( const RequestKind kind, const size_t index )
+{
+  return (uint64_t( kind ) << 32) | index;
+}
+
+/* ask for a completion queue larger than the submission queue, since
+   one multishot receive can produce many completions */
+static io_uring_params ring_params( const unsigned int completion_entries )
+{
+  io_uring_params params;
+  zero( params );
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = completion_entries;
+  return params;
+}
+
+static void * map_ring( const int fd_num, const size_t size, const off_t offset )
+{
+  void * const ret = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, fd_num, offset );
+  if ( ret == MAP_FAILED ) {
+    throw unix_error( "mmap (io_uring)" );
+  }
+
+  return ret;
+}
+
+template <typename T> static T * ring_field( void * const rings, const uint32_t offset )
+{
+  return reinterpret_cast<T *>( static_cast<char *>( rings ) + offset );
+}
+
+IoUring::IoUring( const unsigned int entries, const unsigned int completion_entries )
+  : params_( ring_params( completion_entries ) ),
+    fd_( SystemCall( "io_uring_setup", int( syscall( __NR_io_uring_setup, entries, &params_ ) ) ) ),
+    rings_( nullptr ),
+    rings_size_( 0 ),
+    sqes_( nullptr ),
+    sqes_size_( 0 ),
+    sq_head_( nullptr ), sq_tail_( nullptr ), sq_array_( nullptr ),
+    sq_mask_( 0 ),
+    sq_local_tail_( 0 ),
+    cq_head_( nullptr ), cq_tail_( nullptr ),
+    cq_mask_( 0 ),
+    cqes_( nullptr ),
+    enter_count_( 0 )
+{
+  const uint32_t required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+  if ( (params_.features & required) != required ) {
+    throw runtime_error( "io_uring: kernel is too old (needs single mmap, nodrop and ext_arg)" );
+  }
+
+  rings_size_ = max( params_.sq_off.array + params_.sq_entries * sizeof( unsigned int ),
+		     params_.cq_off.cqes + params_.cq_entries * sizeof( io_uring_cqe ) );
+  rings_ = map_ring( fd_.fd_num(), rings_size_, IORING_OFF_SQ_RING );
+
+  sqes_size_ = params_.sq_entries * sizeof( io_uring_sqe );
+  sqes_ = static_cast<io_uring_sqe *>( map_ring( fd_.fd_num(), sqes_size_, IORING_OFF_SQES ) );
+
+  sq_head_ = ring_field<unsigned int>( rings_, params_.sq_off.head );
+  sq_tail_ = ring_field<unsigned int>( rings_, params_.sq_off.tail );
+  sq_array_ = ring_field<unsigned int>( rings_, params_.sq_off.array );
+  sq_mask_ = *ring_field<unsigned int>( rings_, params_.sq_off.ring_mask );
+  sq_local_tail_ = *sq_tail_;
+
+  cq_head_ = ring_field<unsigned int>( rings_, params_.cq_off.head );
+  cq_tail_ = ring_field<unsigned int>( rings_, params_.cq_off.tail );
+  cq_mask_ = *ring_field<unsigned int>( rings_, params_.cq_off.ring_mask );
+  cqes_ = ring_field<io_uring_cqe>( rings_, params_.cq_off.cqes );
+
+  /* each submission queue slot always holds the request of the same index */
+  for ( unsigned int i = 0; i < params_.sq_entries; i++ ) {
+    sq_array_[ i ] = i;
+  }
+}
+
+IoUring::~IoUring()
+{
+  munmap( sqes_, sqes_size_ );
+  munmap( rings_, rings_size_ );
+}
+
+/* a zeroed request to fill in */
+io_uring_sqe & IoUring::next_sqe( void )
+{
+  if ( sq_local_tail_ - __atomic_load_n( sq_head_, __ATOMIC_ACQUIRE ) >= params_.sq_entries ) {
+    submit();
+
+    if ( sq_local_tail_ - __atomic_load_n( sq_head_, __ATOMIC_ACQUIRE ) >= params_.sq_entries ) {
+      throw runtime_error( "io_uring: submission queue is full" );
+    }
+  }
+
+  io_uring_sqe & sqe = sqes_[ sq_local_tail_ & sq_mask_ ];
+  sq_local_tail_++;
+
+  zero( sqe );
+  return sqe;
+}
+
+/* submit the pending requests, and maybe wait for a completion */
+void IoUring::submit( const bool wait, const int timeout_ms )
+{
+  /* hand the requests filled in so far to the kernel */
+  __atomic_store_n( sq_tail_, sq_local_tail_, __ATOMIC_RELEASE );
+  const unsigned int to_submit = sq_local_tail_ - __atomic_load_n( sq_head_, __ATOMIC_ACQUIRE );
+
+  const bool must_wait = wait and not peek_completion();
+  if ( to_submit == 0 and not must_wait ) {
+    return;
+  }
+
+  unsigned int flags = must_wait ? IORING_ENTER_GETEVENTS : 0;
+
+  __kernel_timespec timeout;
+  io_uring_getevents_arg arg;
+  zero( arg );
+  if ( must_wait and timeout_ms >= 0 ) {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    arg.ts = reinterpret_cast<uint64_t>( &timeout );
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  const long ret = syscall( __NR_io_uring_enter, fd_.fd_num(), to_submit, must_wait ? 1 : 0, flags,
+			    flags & IORING_ENTER_EXT_ARG ? &arg : nullptr, sizeof( arg ) );
+  enter_count_++;
+
+  if ( ret < 0 and errno != ETIME and errno != EINTR ) {
+    throw unix_error( "io_uring_enter" );
+  }
+}
+
+/* the oldest unconsumed completion */
+const io_uring_cqe * IoUring::peek_completion( void ) const
+{
+  const unsigned int head = *cq_head_;
+  if ( head == __atomic_load_n( cq_tail_, __ATOMIC_ACQUIRE ) ) {
+    return nullptr;
+  }
+
+  return &cqes_[ head & cq_mask_ ];
+}
+
+/* consume that completion */
+void IoUring::pop_completion( void )
+{
+  __atomic_store_n( cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE );
+}
+
+void IoUring::register_resource( const unsigned int opcode, void * const arg, const unsigned int nr_args )
+{
+  SystemCall( "io_uring_register",
+	      int( syscall( __NR_io_uring_register, fd_.fd_num(), opcode, arg, nr_args ) ) );
+}
+
+ProvidedBuffers::ProvidedBuffers( IoUring & ring, const uint16_t group,
+				  const unsigned int count, const size_t buffer_size )
+  : ring_( ring ),
+    group_( group ),
+    count_( count ),
+    buffer_size_( buffer_size ),
+    buf_ring_( nullptr ),
+    buf_ring_size_( count * sizeof( io_uring_buf ) ),
+    storage_( count * buffer_size ),
+    tail_( 0 )
+{
+  if ( count == 0 or count > 32768 or (count & (count - 1)) ) {
+    throw runtime_error( "ProvidedBuffers: count must be a power of two, at most 32768" );
+  }
+
+  /* the ring must be page-aligned, so it gets its own mapping */
+  void * const memory = mmap( nullptr, buf_ring_size_, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( memory == MAP_FAILED ) {
+    throw unix_error( "mmap (provided buffers)" );
+  }
+  buf_ring_ = static_cast<io_uring_buf *>( memory );
+
+  io_uring_buf_reg registration;
+  zero( registration );
+  registration.ring_addr = reinterpret_cast<uint64_t>( buf_ring_ );
+  registration.ring_entries = count_;
+  registration.bgid = group_;
+
+  try {
+    ring_.register_resource( IORING_REGISTER_PBUF_RING, &registration, 1 );
+  } catch ( ... ) {
+    munmap( buf_ring_, buf_ring_size_ );
+    throw;
+  }
+
+  for ( unsigned int id = 0; id < count_; id++ ) {
+    recycle( id );
+  }
+}
+
+ProvidedBuffers::~ProvidedBuffers()
+{
+  io_uring_buf_reg registration;
+  zero( registration );
+  registration.bgid = group_;
+
+  try {
+    ring_.register_resource( IORING_UNREGISTER_PBUF_RING, &registration, 1 );
+  } catch ( const exception & e ) {
+    print_exception( e );
+  }
+
+  munmap( buf_ring_, buf_ring_size_ );
+}
+
+/* give a buffer back to the kernel */
+void ProvidedBuffers::recycle( const uint16_t id )
+{
+  /* (don't zero the entry: the first one's last field is the ring's tail) */
+  io_uring_buf & entry = buf_ring_[ tail_ & (count_ - 1) ];
+  entry.addr = reinterpret_cast<uint64_t>( buffer( id ) );
+  entry.len = buffer_size_;
+  entry.bid = id;
+
+  tail_++;
+  __atomic_store_n( &buf_ring_[ 0 ].resv, tail_, __ATOMIC_RELEASE );
+}
+
+/* ancillary data space for just the SO_TIMESTAMPNS timestamp */
+static const size_t TIMESTAMP_CONTROL_LEN = CMSG_SPACE( sizeof( timespec ) );
+
+UringPoller::Receiver::Receiver( IoUring & ring, UDPSocket & s_socket, const ReceiveCallback & s_callback,
+				 const uint16_t group, const unsigned int count, const size_t buffer_size )
+  : socket( s_socket ),
+    callback( s_callback ),
+    buffers( ring, group, count, buffer_size ),
+    header(),
+    armed( false ),
+    active( true )
+{
+  /* each buffer starts with an io_uring_recvmsg_out, then the name and control */
+  zero( header );
+  header.msg_namelen = sizeof( Address::raw );
+  header.msg_controllen = TIMESTAMP_CONTROL_LEN;
+
+  if ( buffer_size <= sizeof( io_uring_recvmsg_out ) + header.msg_namelen + header.msg_controllen ) {
+    throw runtime_error( "UringPoller: receive buffers are too small" );
+  }
+}
+
+UringPoller::UringPoller( const unsigned int entries,
+			  const unsigned int send_slots,
+			  const size_t send_slot_size )
+  : ring_( entries, 16 * entries ),
+    receivers_(),
+    actions_(),
+    armed_(),
+    send_slot_size_( send_slot_size ),
+    send_payloads_( send_slots * send_slot_size ),
+    send_slots_( send_slots ),
+    free_send_slots_()
+{
+  for ( unsigned int i = 0; i < send_slots; i++ ) {
+    SendSlot & slot = send_slots_[ i ];
+    zero( slot );
+    slot.payload_iovec.iov_base = &send_payloads_[ i * send_slot_size_ ];
+    slot.header.msg_iov = &slot.payload_iovec;
+    slot.header.msg_iovlen = 1;
+
+    free_send_slots_.push_back( send_slots - 1 - i );
+  }
+}
+
+void UringPoller::add_receiver( UDPSocket & socket, const ReceiveCallback & callback,
+				const unsigned int buffers, const size_t buffer_size )
+{
+  receivers_.emplace_back( new Receiver( ring_, socket, callback,
+					 receivers_.size(), buffers, buffer_size ) );
+}
+
+void UringPoller::add_action( const Poller::Action & action )
+{
+  actions_.push_back( action );
+  armed_.push_back( false );
+}
+
+/* start a multishot recvmsg, picking buffers from the receiver's group */
+void UringPoller::arm_receiver( const size_t index )
+{
+  Receiver & receiver = *receivers_.at( index );
+
+  io_uring_sqe & sqe = ring_.next_sqe();
+  sqe.opcode = IORING_OP_RECVMSG;
+  sqe.fd = receiver.socket.fd_num();
+  sqe.addr = reinterpret_cast<uint64_t>( &receiver.header );
+  sqe.len = 1;
+  sqe.ioprio = IORING_RECV_MULTISHOT;
+  sqe.flags = IOSQE_BUFFER_SELECT;
+  sqe.buf_group = receiver.buffers.group();
+  sqe.user_data = user_data( RequestKind::Receive, index );
+
+  receiver.armed = true;
+}
+
+/* wait (once) for the action's fd to be ready */
+void UringPoller::arm_action( const size_t index )
+{
+  const Action & action = actions_.at( index );
+
+  io_uring_sqe & sqe = ring_.next_sqe();
+  sqe.opcode = IORING_OP_POLL_ADD;
+  sqe.fd = action.fd.fd_num();
+  sqe.poll32_events = action.direction;
+  sqe.user_data = user_data( RequestKind::Action, index );
+
+  armed_.at( index ) = true;
+}
+
+/* copy the datagram into a send slot and queue a sendmsg for it */
+void UringPoller::queue_send( UDPSocket & socket, const unsigned int slot_index,
+			      const char * const payload, const size_t length )
+{
+  SendSlot & slot = send_slots_.at( slot_index );
+  memcpy( slot.payload_iovec.iov_base, payload, length );
+  slot.payload_iovec.iov_len = length;
+
+  io_uring_sqe & sqe = ring_.next_sqe();
+  sqe.opcode = IORING_OP_SENDMSG;
+  sqe.fd = socket.fd_num();
+  sqe.addr = reinterpret_cast<uint64_t>( &slot.header );
+  sqe.len = 1;
+  sqe.user_data = user_data( RequestKind::Send, slot_index );
+}
+
+void UringPoller::sendto( UDPSocket & socket, const Address & destination,
+			  const char * const payload, const size_t length )
+{
+  if ( length > send_slot_size_ ) {
+    throw runtime_error( "datagram payload too big for UringPoller" );
+  }
+
+  /* if every slot is still in flight, don't wait for one */
+  if ( free_send_slots_.empty() ) {
+    socket.sendto( destination, payload, length );
+    return;
+  }
+
+  const unsigned int slot_index = free_send_slots_.back();
+  free_send_slots_.pop_back();
+
+  SendSlot & slot = send_slots_[ slot_index ];
+  memcpy( &slot.address, &destination.to_sockaddr(), destination.size() );
+  slot.header.msg_name = &slot.address;
+  slot.header.msg_namelen = destination.size();
+
+  queue_send( socket, slot_index, payload, length );
+}
+
+void UringPoller::send( UDPSocket & socket, const char * const payload, const size_t length )
+{
+  if ( length > send_slot_size_ ) {
+    throw runtime_error( "datagram payload too big for UringPoller" );
+  }
+
+  if ( free_send_slots_.empty() ) {
+    socket.send( payload, length );
+    return;
+  }
+
+  const unsigned int slot_index = free_send_slots_.back();
+  free_send_slots_.pop_back();
+
+  SendSlot & slot = send_slots_[ slot_index ];
+  slot.header.msg_name = nullptr;
+  slot.header.msg_namelen = 0;
+
+  queue_send( socket, slot_index, payload, length );
+}
+
+/* note what a callback asked for */
+static void apply_callback_result( const Result & callback_result, bool & active,
+				   Poller::Result & result )
+{
+  if ( callback_result.result == ResultType::Exit ) {
+    result = Poller::Result( PollResult::Exit, callback_result.exit_status );
+  } else if ( callback_result.result == ResultType::Cancel ) {
+    active = false;
+  }
+}
+
+/* handle one completion */
+void UringPoller::complete( const io_uring_cqe & cqe, Poller::Result & result )
+{
+  const size_t index = cqe.user_data & 0xffffffff;
+
+  switch ( RequestKind( cqe.user_data >> 32 ) ) {
+  case RequestKind::Receive: {
+    Receiver & receiver = *receivers_.at( index );
+
+    /* the request ends without IORING_CQE_F_MORE (e.g. when the kernel
+       ran out of buffers), and is started again by the next poll() */
+    if ( not (cqe.flags & IORING_CQE_F_MORE) ) {
+      receiver.armed = false;
+    }
+
+    if ( cqe.res == -ENOBUFS or cqe.res == -ECANCELED ) {
+      return;
+    } else if ( cqe.res < 0 ) {
+      throw unix_error( "recvmsg (io_uring)", -cqe.res );
+    } else if ( not (cqe.flags & IORING_CQE_F_BUFFER) ) {
+      throw runtime_error( "recvmsg (io_uring): no buffer selected" );
+    }
+
+    const uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    char * const buffer = receiver.buffers.buffer( id );
+
+    /* the buffer holds an io_uring_recvmsg_out, the name, the control and the payload */
+    io_uring_recvmsg_out out;
+    memcpy( &out, buffer, sizeof( out ) );
+
+    if ( out.flags & MSG_TRUNC ) {
+      throw runtime_error( "recvmsg (io_uring): oversized datagram" );
+    }
+
+    char * const name = buffer + sizeof( out );
+    char * const control = name + receiver.header.msg_namelen;
+    char * const payload = control + receiver.header.msg_controllen;
+
+    Address::raw source_address;
+    const size_t name_length = min( size_t( out.namelen ), sizeof( source_address ) );
+    memcpy( &source_address, name, name_length );
+
+    msghdr control_header;
+    zero( control_header );
+    control_header.msg_control = control;
+    control_header.msg_controllen = out.controllen;
+
+    if ( receiver.active ) {
+      const UDPSocket::received_datagram_view datagram = { Address( source_address, name_length ),
+							   kernel_timestamp( control_header ),
+							   payload,
+							   out.payloadlen };
+
+      apply_callback_result( receiver.callback( datagram ), receiver.active, result );
+
+      /* stop receiving once cancelled */
+      if ( not receiver.active and receiver.armed ) {
+	io_uring_sqe & sqe = ring_.next_sqe();
+	sqe.opcode = IORING_OP_ASYNC_CANCEL;
+	sqe.addr = user_data( RequestKind::Receive, index );
+	sqe.user_data = user_data( RequestKind::Cancel, index );
+      }
+    }
+
+    receiver.buffers.recycle( id );
+    return;
+  }
+
+  case RequestKind::Action: {
+    armed_.at( index ) = false;
+    Action & action = actions_.at( index );
+
+    if ( cqe.res < 0 ) {
+      throw unix_error( "poll (io_uring)", -cqe.res );
+    } else if ( cqe.res & (POLLERR | POLLHUP) ) {
+      result = Poller::Result( PollResult::Exit );
+    } else if ( action.active and (cqe.res & action.direction) ) {
+      apply_callback_result( action.callback(), action.active, result );
+    }
+    return;
+  }
+
+  case RequestKind::Send: {
+    free_send_slots_.push_back( index );
+
+    if ( cqe.res < 0 ) {
+      throw unix_error( "sendmsg (io_uring)", -cqe.res );
+    } else if ( size_t( cqe.res ) != send_slots_.at( index ).payload_iovec.iov_len ) {
+      throw runtime_error( "datagram payload too big for sendmsg (io_uring)" );
+    }
+    return;
+  }
+
+  case RequestKind::Cancel:
+    return;
+  }
+
+  throw runtime_error( "UringPoller: completion of unknown request" );
+}
+
+/* submit, wait and handle the completions */
+Poller::Result UringPoller::poll( const int timeout_ms )
+{
+  /* (re)start the requests that have ended */
+  bool interested = false;
+
+  for ( size_t i = 0; i < receivers_.size(); i++ ) {
+    Receiver & receiver = *receivers_[ i ];
+    if ( receiver.active and not receiver.armed ) {
+      arm_receiver( i );
+    }
+    interested |= receiver.active;
+  }
+
+  for ( size_t i = 0; i < actions_.size(); i++ ) {
+    Action & action = actions_[ i ];
+    if ( not armed_[ i ] and action.active and action.when_interested()
+	 and not (action.direction == Direction::In and action.fd.eof()) ) {
+      arm_action( i );
+    }
+    interested |= armed_[ i ];
+  }
+
+  /* Quit if nothing is interested in anything */
+  if ( not interested ) {
+    return PollResult::Exit;
+  }
+
+  ring_.submit( timeout_ms != 0, timeout_ms );
+
+  if ( not ring_.peek_completion() ) {
+    return PollResult::Timeout;
+  }
+
+  Poller::Result result( PollResult::Success );
+
+  while ( const io_uring_cqe * const next = ring_.peek_completion() ) {
+    const io_uring_cqe cqe = *next;
+    ring_.pop_completion();
+    complete( cqe, result );
+  }
+
+  return result;
+}
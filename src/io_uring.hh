@@ -0,0 +1,193 @@
+#ifndef IO_URING_HH
+#define IO_URING_HH
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+#include "file_descriptor.hh"
+#include "poller.hh"
+#include "socket.hh"
+
+/* an io_uring instance, driven with the raw syscalls: a submission
+   queue of requests and a completion queue of their results, both
+   shared with the kernel, so that many requests can be submitted
+   (and their results collected) with one io_uring_enter() */
+class IoUring
+{
+private:
+  io_uring_params params_;
+  FileDescriptor fd_;
+
+  /* the submission and completion rings share one mapping */
+  void * rings_;
+  size_t rings_size_;
+  io_uring_sqe * sqes_;
+  size_t sqes_size_;
+
+  unsigned int * sq_head_, * sq_tail_, * sq_array_;
+  unsigned int sq_mask_;
+
+  /* the tail including requests filled in but not yet handed to the kernel */
+  unsigned int sq_local_tail_;
+
+  unsigned int * cq_head_, * cq_tail_;
+  unsigned int cq_mask_;
+  io_uring_cqe * cqes_;
+
+  uint64_t enter_count_;
+
+public:
+  IoUring( const unsigned int entries, const unsigned int completion_entries );
+  ~IoUring();
+
+  /* a zeroed request to fill in (submitting the queue first if it is full) */
+  io_uring_sqe & next_sqe( void );
+
+  /* submit the pending requests, and (if wait) wait for a completion,
+     for at most timeout_ms (or forever, if negative) */
+  void submit( const bool wait = false, const int timeout_ms = -1 );
+
+  /* the oldest unconsumed completion, or nullptr if there is none */
+  const io_uring_cqe * peek_completion( void ) const;
+
+  /* consume the completion that peek_completion() returned */
+  void pop_completion( void );
+
+  /* call io_uring_register() */
+  void register_resource( const unsigned int opcode, void * const arg, const unsigned int nr_args );
+
+  /* accessors */
+  int fd_num( void ) const { return fd_.fd_num(); }
+  uint64_t enter_count( void ) const { return enter_count_; }
+
+  /* forbid copying, since the rings are mapped memory */
+  IoUring( const IoUring & other ) = delete;
+  IoUring & operator=( const IoUring & other ) = delete;
+};
+
+/* a group of receive buffers registered with the kernel (a provided
+   buffer ring), from which it picks one for each incoming datagram */
+class ProvidedBuffers
+{
+private:
+  IoUring & ring_;
+  uint16_t group_;
+  unsigned int count_;
+  size_t buffer_size_;
+
+  /* the ring itself (addressed as an array: in C++, io_uring_buf_ring's
+     flexible array member doesn't start at offset 0, as the kernel's does) */
+  io_uring_buf * buf_ring_;
+  size_t buf_ring_size_;
+  std::vector<char> storage_;
+  uint16_t tail_;
+
+public:
+  /* count must be a power of two */
+  ProvidedBuffers( IoUring & ring, const uint16_t group,
+		   const unsigned int count, const size_t buffer_size );
+  ~ProvidedBuffers();
+
+  /* accessors */
+  uint16_t group( void ) const { return group_; }
+  size_t buffer_size( void ) const { return buffer_size_; }
+  char * buffer( const uint16_t id ) { return &storage_.at( id * buffer_size_ ); }
+
+  /* give a buffer the kernel filled back to it */
+  void recycle( const uint16_t id );
+
+  /* forbid copying, since the kernel holds pointers into the buffers */
+  ProvidedBuffers( const ProvidedBuffers & other ) = delete;
+  ProvidedBuffers & operator=( const ProvidedBuffers & other ) = delete;
+};
+
+/* an event loop on io_uring, as an alternative to Poller: datagrams
+   are received by multishot recvmsg requests into provided buffers
+   (one request delivers datagram after datagram), fds are watched by
+   poll requests calling the same callbacks as a Poller::Action, and
+   outgoing datagrams are queued up and submitted together with the
+   next wait, so a busy loop makes one syscall per iteration */
+class UringPoller
+{
+public:
+  /* the view's payload is only valid during the callback */
+  typedef std::function<Poller::Action::Result( const UDPSocket::received_datagram_view & )> ReceiveCallback;
+
+private:
+  /* a multishot recvmsg request on one socket */
+  struct Receiver
+  {
+    UDPSocket & socket;
+    ReceiveCallback callback;
+    ProvidedBuffers buffers;
+    msghdr header; /* only the name and control lengths are used */
+    bool armed;    /* a request is in progress */
+    bool active;   /* the callback hasn't cancelled */
+
+    Receiver( IoUring & ring, UDPSocket & s_socket, const ReceiveCallback & s_callback,
+	      const uint16_t group, const unsigned int count, const size_t buffer_size );
+  };
+
+  /* an outgoing datagram, which must stay put until it completes */
+  struct SendSlot
+  {
+    msghdr header;
+    iovec payload_iovec;
+    Address::raw address;
+  };
+
+  IoUring ring_;
+
+  std::vector<std::unique_ptr<Receiver>> receivers_;
+
+  std::vector<Poller::Action> actions_;
+  std::vector<bool> armed_;
+
+  size_t send_slot_size_;
+  std::vector<char> send_payloads_;
+  std::vector<SendSlot> send_slots_;
+  std::vector<unsigned int> free_send_slots_;
+
+  void arm_receiver( const size_t index );
+  void arm_action( const size_t index );
+
+  void queue_send( UDPSocket & socket, const unsigned int slot_index,
+		   const char * const payload, const size_t length );
+
+  /* handle one completion, noting in result if a callback asked to exit */
+  void complete( const io_uring_cqe & cqe, Poller::Result & result );
+
+public:
+  UringPoller( const unsigned int entries = 256,
+	       const unsigned int send_slots = 256,
+	       const size_t send_slot_size = 2048 );
+
+  /* call callback with each datagram that arrives on the socket
+     (buffer_size must hold the name and timestamp, too) */
+  void add_receiver( UDPSocket & socket, const ReceiveCallback & callback,
+		     const unsigned int buffers = 256, const size_t buffer_size = 2048 );
+
+  /* call the action's callback when its fd is ready, as Poller does */
+  void add_action( const Poller::Action & action );
+
+  /* queue a datagram to be sent with the next poll() (the payload is
+     copied; if every send slot is in flight, it is sent straight away) */
+  void sendto( UDPSocket & socket, const Address & destination,
+	       const char * const payload, const size_t length );
+
+  /* ... or to the socket's connected address */
+  void send( UDPSocket & socket, const char * const payload, const size_t length );
+
+  /* submit the queued sends, wait for at least one completion
+     (for at most timeout_ms, or forever if negative), and handle them */
+  Poller::Result poll( const int timeout_ms );
+
+  /* how many io_uring_enter() syscalls the loop has made */
+  uint64_t syscall_count( void ) const { return ring_.enter_count(); }
+};
+
+#endif /* IO_URING_HH */
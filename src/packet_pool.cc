@@ -0,0 +1,134 @@
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+#include "packet_pool.hh"
+
+using namespace std;
+
+static size_t round_up( const size_t size, const size_t multiple )
+{
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+/* each buffer's header gets a cache line to itself, then comes the data */
+static const size_t HEADER_SPACE = round_up( sizeof( Packet::Header ), PacketPool::CACHE_LINE );
+
+Packet::Packet( Header * const header )
+  : header_( header )
+{
+  header_->references++;
+}
+
+Packet::Packet( const Packet & other )
+  : header_( other.header_ )
+{
+  if ( header_ ) {
+    header_->references++;
+  }
+}
+
+Packet::Packet( Packet && other )
+  : header_( other.header_ )
+{
+  other.header_ = nullptr;
+}
+
+Packet & Packet::operator=( const Packet & other )
+{
+  if ( other.header_ ) {
+    other.header_->references++;
+  }
+  release();
+  header_ = other.header_;
+  return *this;
+}
+
+Packet & Packet::operator=( Packet && other )
+{
+  if ( this != &other ) {
+    release();
+    header_ = other.header_;
+    other.header_ = nullptr;
+  }
+  return *this;
+}
+
+/* drop this handle's reference, returning the buffer if it was the last */
+void Packet::release( void )
+{
+  if ( header_ and --header_->references == 0 ) {
+    header_->pool->recycle( header_ );
+  }
+  header_ = nullptr;
+}
+
+char * Packet::data( void )
+{
+  return reinterpret_cast<char *>( header_ ) + HEADER_SPACE;
+}
+
+const char * Packet::data( void ) const
+{
+  return reinterpret_cast<const char *>( header_ ) + HEADER_SPACE;
+}
+
+size_t Packet::capacity( void ) const
+{
+  return header_->pool->capacity();
+}
+
+void Packet::set_length( const size_t length )
+{
+  if ( length > capacity() ) {
+    throw runtime_error( "Packet: length exceeds capacity" );
+  }
+
+  header_->length = length;
+}
+
+PacketPool::PacketPool( const unsigned int count, const size_t capacity )
+  : capacity_( capacity ),
+    stride_( HEADER_SPACE + round_up( capacity, CACHE_LINE ) ),
+    arena_( count * stride_ + CACHE_LINE ),
+    first_( nullptr ),
+    free_list_( nullptr ),
+    available_( 0 )
+{
+  if ( count == 0 ) {
+    throw runtime_error( "PacketPool: count must be positive" );
+  }
+
+  /* start the first buffer on a cache line */
+  const uintptr_t start = reinterpret_cast<uintptr_t>( arena_.data() );
+  first_ = arena_.data() + (round_up( start, CACHE_LINE ) - start);
+
+  for ( unsigned int i = count; i > 0; i-- ) {
+    Packet::Header * const header = new ( first_ + (i - 1) * stride_ ) Packet::Header();
+    header->pool = this;
+    recycle( header );
+  }
+}
+
+void PacketPool::recycle( Packet::Header * const header )
+{
+  header->references = 0;
+  header->length = 0;
+  header->next_free = free_list_;
+  free_list_ = header;
+  available_++;
+}
+
+Packet PacketPool::get( void )
+{
+  if ( not free_list_ ) {
+    throw runtime_error( "PacketPool: no free buffers" );
+  }
+
+  Packet::Header * const header = free_list_;
+  free_list_ = header->next_free;
+  available_--;
+
+  header->length = capacity_;
+  return Packet( header );
+}
@@ -0,0 +1,95 @@
+#ifndef PACKET_POOL_HH
+#define PACKET_POOL_HH
+
+#include <cstddef>
+#include <vector>
+
+class PacketPool;
+
+/* a handle to one datagram buffer from a PacketPool. The buffer
+   carries its own (intrusive) reference count: copying a Packet
+   shares the buffer, and the buffer goes back to the pool when
+   the last handle to it is destroyed. A pool and its packets
+   belong to one thread, so the count isn't atomic. */
+class Packet
+{
+  friend class PacketPool;
+
+public:
+  /* what precedes the data in each buffer */
+  struct Header
+  {
+    PacketPool * pool;
+    unsigned int references;
+    size_t length;
+    Header * next_free;
+  };
+
+private:
+  Header * header_;
+
+  explicit Packet( Header * const header );
+
+  void release( void );
+
+public:
+  /* an empty handle */
+  Packet() : header_( nullptr ) {}
+
+  Packet( const Packet & other );
+  Packet( Packet && other );
+  Packet & operator=( const Packet & other );
+  Packet & operator=( Packet && other );
+  ~Packet() { release(); }
+
+  /* accessors (the handle must not be empty) */
+  char * data( void );
+  const char * data( void ) const;
+  size_t length( void ) const { return header_->length; }
+  size_t capacity( void ) const;
+  unsigned int references( void ) const { return header_->references; }
+
+  /* how much of the buffer holds the datagram */
+  void set_length( const size_t length );
+
+  bool empty( void ) const { return header_ == nullptr; }
+};
+
+/* a fixed number of fixed-size datagram buffers, allocated together
+   up front and handed out and taken back without touching the heap.
+   Each buffer's data starts on its own cache line, so buffers used by
+   different cores don't share one. The pool must outlive its packets. */
+class PacketPool
+{
+  friend class Packet;
+
+private:
+  size_t capacity_;   /* data bytes per buffer */
+  size_t stride_;     /* bytes from one buffer to the next */
+  std::vector<char> arena_;
+  char * first_;      /* the first buffer, aligned to a cache line */
+  Packet::Header * free_list_;
+  unsigned int available_;
+
+  /* take back a buffer whose last handle went away */
+  void recycle( Packet::Header * const header );
+
+public:
+  /* buffers start on cache lines of this size */
+  static const size_t CACHE_LINE = 64;
+
+  PacketPool( const unsigned int count, const size_t capacity = 2048 );
+
+  /* a buffer from the pool, holding capacity() bytes (throws if none is free) */
+  Packet get( void );
+
+  /* accessors */
+  size_t capacity( void ) const { return capacity_; }
+  unsigned int available( void ) const { return available_; }
+
+  /* forbid copying, since the packets point into the arena */
+  PacketPool( const PacketPool & other ) = delete;
+  PacketPool & operator=( const PacketPool & other ) = delete;
+};
+
+#endif /* PACKET_POOL_HH */
@@ -1,17 +1,77 @@
 #include <algorithm>
 #include <cassert>
-#include <numeric>
 
 #include "poller.hh"
+#include "timestamp.hh"
 #include "util.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
-void Poller::add_action( Poller::Action action )
+static_assert( EPOLLIN == POLLIN and EPOLLOUT == POLLOUT,
+	       "Poller directions must double as epoll event flags" );
+
+Poller::Poller()
+  : epoll_fd_( SystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) ),
+    actions_(),
+    interested_(),
+    interested_count_( 0 ),
+    dirty_actions_(),
+    dirty_(),
+    registrations_(),
+    dirty_registrations_(),
+    events_(),
+    timers_(),
+    timer_heap_(),
+    timer_fd_(),
+    timer_fd_deadline_( 0 ),
+    timer_action_( 0 )
 {
+  /* the timerfd wakes the poll for the earliest timer
+     (and is only watched while some timer is set) */
+  timer_action_ = add_action( Action( timer_fd_, Direction::In, [&] () {
+	const uint64_t fired = timer_fd_.read_expirations() ? timer_fd_deadline_ : 0;
+	timer_fd_deadline_ = 0;
+
+	/* (with millisecond timestamps, the clock can still read a
+	   little short of the deadline the kernel fired for) */
+	return run_timers( max( timestamp_ns(), fired ) );
+      },
+      [&] () { return not timer_heap_.empty(); } ) );
+}
+
+const size_t Poller::NOT_SET;
+
+Poller::ActionId Poller::add_action( Poller::Action action )
+{
+  const size_t index = actions_.size();
+
   actions_.push_back( action );
-  pollfds_.push_back( { action.fd.fd_num(), 0, 0 } );
+  interested_.push_back( false );
+  dirty_.push_back( false );
+
+  registrations_[ action.fd.fd_num() ].actions.push_back( index );
+
+  mark_dirty( index );
+
+  events_.resize( registrations_.size() );
+
+  return index;
+}
+
+void Poller::update_interest( const ActionId id )
+{
+  mark_dirty( id );
+}
+
+/* re-evaluate an action's interest before the next wait (once,
+   however many times it is marked) */
+void Poller::mark_dirty( const size_t action_index )
+{
+  if ( not dirty_.at( action_index ) ) {
+    dirty_.at( action_index ) = true;
+    dirty_actions_.push_back( action_index );
+  }
 }
 
 unsigned int Poller::Action::service_count( void ) const
@@ -19,45 +79,122 @@ unsigned int Poller::Action::service_count( void ) const
   return direction == Direction::In ? fd.read_count() : fd.write_count();
 }
 
-Poller::Result Poller::poll( const int & timeout_ms )
+/* work out whether an action is interested, and note if that changed */
+void Poller::evaluate_interest( const size_t action_index )
+{
+  Action & action = actions_.at( action_index );
+
+  bool interested = action.active and action.when_interested();
+
+  /* don't poll in on fds that have had EOF */
+  if ( action.direction == Direction::In and action.fd.eof() ) {
+    interested = false;
+  }
+
+  if ( interested != interested_.at( action_index ) ) {
+    interested_.at( action_index ) = interested;
+    interested ? interested_count_++ : interested_count_--;
+
+    Registration & registration = registrations_.at( action.fd.fd_num() );
+    if ( not registration.needs_update ) {
+      registration.needs_update = true;
+      dirty_registrations_.push_back( action.fd.fd_num() );
+    }
+  }
+}
+
+/* tell epoll what we now care about on one fd */
+void Poller::update_registration( const int fd_num )
 {
-  assert( pollfds_.size() == actions_.size() );
+  Registration & registration = registrations_.at( fd_num );
+  registration.needs_update = false;
+
+  uint32_t events = 0;
+  for ( const auto & index : registration.actions ) {
+    if ( interested_.at( index ) ) {
+      events |= actions_.at( index ).direction;
+    }
+  }
+
+  if ( events == registration.events ) {
+    return;
+  }
+
+  epoll_event event;
+  zero( event );
+  event.events = events;
+  event.data.fd = fd_num;
 
-  /* tell poll whether we care about each fd */
-  for ( unsigned int i = 0; i < actions_.size(); i++ ) {
-    assert( pollfds_.at( i ).fd == actions_.at( i ).fd.fd_num() );
-    pollfds_.at( i ).events = (actions_.at( i ).active and actions_.at( i ).when_interested())
-      ? actions_.at( i ).direction : 0;
+  if ( registration.events == 0 ) {
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_ADD, fd_num, &event ) );
+  } else if ( events == 0 ) {
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_DEL, fd_num, &event ) );
+  } else {
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_MOD, fd_num, &event ) );
+  }
+
+  registration.events = events;
+}
 
-    /* don't poll in on fds that have had EOF */
-    if ( actions_.at( i ).direction == Direction::In
-	 and actions_.at( i ).fd.eof() ) {
-      pollfds_.at( i ).events = 0;
+Poller::Result Poller::poll( const int & timeout_ms )
+{
+  /* run the timers that are already due, since they may change
+     what the actions are interested in */
+  if ( not timer_heap_.empty() ) {
+    const auto result = run_timers( timestamp_ns() );
+    if ( result.result == ResultType::Exit ) {
+      return Result( Result::Type::Exit, result.exit_status );
     }
   }
 
-  /* Quit if no member in pollfds_ has a non-zero direction */
-  if ( not accumulate( pollfds_.begin(), pollfds_.end(), false,
-		       [] ( bool acc, pollfd x ) { return acc or x.events; } ) ) {
+  /* re-evaluate interest only where it may have changed */
+  /* (a predicate may mark more actions, so the list can grow meanwhile) */
+  for ( size_t i = 0; i < dirty_actions_.size(); i++ ) {
+    dirty_[ dirty_actions_[ i ] ] = false;
+    evaluate_interest( dirty_actions_[ i ] );
+  }
+  dirty_actions_.clear();
+
+  for ( const auto & fd_num : dirty_registrations_ ) {
+    update_registration( fd_num );
+  }
+  dirty_registrations_.clear();
+
+  /* Quit if no action is interested in anything */
+  if ( interested_count_ == 0 ) {
     return Result::Type::Exit;
   }
 
-  if ( 0 == SystemCall( "poll", ::poll( &pollfds_[ 0 ], pollfds_.size(), timeout_ms ) ) ) {
+  arm_timer_fd();
+
+  const int ready = SystemCall( "epoll_wait",
+				epoll_wait( epoll_fd_.fd_num(), &events_[ 0 ], events_.size(), timeout_ms ) );
+  if ( ready == 0 ) {
     return Result::Type::Timeout;
   }
 
-  for ( unsigned int i = 0; i < pollfds_.size(); i++ ) {
-    if ( pollfds_[ i ].revents & (POLLERR | POLLHUP | POLLNVAL) ) {
+  for ( int i = 0; i < ready; i++ ) {
+    if ( events_[ i ].events & (EPOLLERR | EPOLLHUP) ) {
       return Result::Type::Exit;
     }
 
-    if ( pollfds_[ i ].revents & pollfds_[ i ].events ) {
-      /* we only want to call callback if revents includes
-	 the event we asked for */
-      const auto count_before = actions_.at( i ).service_count();
-      auto result = actions_.at( i ).callback();
+    const Registration & registration = registrations_.at( events_[ i ].data.fd );
+
+    for ( const auto & index : registration.actions ) {
+      /* the fd has been serviced, so its actions' interest may change */
+      mark_dirty( index );
+
+      /* we only want to call callback if the event includes
+	 the direction this action asked for */
+      if ( not interested_.at( index )
+	   or not (events_[ i ].events & actions_.at( index ).direction) ) {
+	continue;
+      }
+
+      const auto count_before = actions_.at( index ).service_count();
+      auto result = actions_.at( index ).callback();
 
-      if ( count_before == actions_.at( i ).service_count() ) {
+      if ( count_before == actions_.at( index ).service_count() ) {
 	throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
       }
 
@@ -65,7 +202,7 @@ Poller::Result Poller::poll( const int & timeout_ms )
       case ResultType::Exit:
 	return Result( Result::Type::Exit, result.exit_status );
       case ResultType::Cancel:
-	actions_.at( i ).active = false;
+	actions_.at( index ).active = false;
       case ResultType::Continue:
 	break;
       }
@@ -74,3 +211,162 @@ Poller::Result Poller::poll( const int & timeout_ms )
 
   return Result::Type::Success;
 }
+
+Poller::TimerId Poller::add_timer( const Action::CallbackType & callback )
+{
+  timers_.emplace_back( callback );
+  return timers_.size() - 1;
+}
+
+void Poller::set_timer( const TimerId id, const uint64_t deadline, const uint64_t period )
+{
+  Timer & timer = timers_.at( id );
+  timer.period = period;
+
+  if ( timer.heap_index == NOT_SET ) {
+    if ( timer_heap_.empty() ) {
+      update_interest( timer_action_ );
+    }
+    timer.deadline = deadline;
+    timer_heap_.push_back( id );
+    timer.heap_index = timer_heap_.size() - 1;
+    sift_up( timer.heap_index );
+  } else if ( deadline < timer.deadline ) {
+    timer.deadline = deadline;
+    sift_up( timer.heap_index );
+  } else if ( deadline > timer.deadline ) {
+    timer.deadline = deadline;
+    sift_down( timer.heap_index );
+  }
+}
+
+void Poller::clear_timer( const TimerId id )
+{
+  if ( timers_.at( id ).heap_index != NOT_SET ) {
+    unlink_timer( id );
+  }
+}
+
+uint64_t Poller::next_timer( void ) const
+{
+  return timer_heap_.empty() ? 0 : timers_[ timer_heap_.front() ].deadline;
+}
+
+/* does timer a fire before timer b? */
+bool Poller::timer_before( const size_t a, const size_t b ) const
+{
+  return timers_[ a ].deadline < timers_[ b ].deadline;
+}
+
+/* put a timer at a position in the heap */
+void Poller::place_timer( const size_t heap_index, const size_t timer )
+{
+  timer_heap_[ heap_index ] = timer;
+  timers_[ timer ].heap_index = heap_index;
+}
+
+void Poller::sift_up( size_t heap_index )
+{
+  const size_t timer = timer_heap_[ heap_index ];
+
+  while ( heap_index > 0 ) {
+    const size_t parent = (heap_index - 1) / 2;
+    if ( not timer_before( timer, timer_heap_[ parent ] ) ) {
+      break;
+    }
+    place_timer( heap_index, timer_heap_[ parent ] );
+    heap_index = parent;
+  }
+
+  place_timer( heap_index, timer );
+}
+
+void Poller::sift_down( size_t heap_index )
+{
+  const size_t timer = timer_heap_[ heap_index ];
+
+  while ( true ) {
+    size_t child = 2 * heap_index + 1;
+    if ( child >= timer_heap_.size() ) {
+      break;
+    }
+    if ( child + 1 < timer_heap_.size() and timer_before( timer_heap_[ child + 1 ], timer_heap_[ child ] ) ) {
+      child++;
+    }
+    if ( not timer_before( timer_heap_[ child ], timer ) ) {
+      break;
+    }
+    place_timer( heap_index, timer_heap_[ child ] );
+    heap_index = child;
+  }
+
+  place_timer( heap_index, timer );
+}
+
+/* take a timer out of the heap, filling its place with the last one */
+void Poller::unlink_timer( const size_t timer )
+{
+  const size_t heap_index = timers_[ timer ].heap_index;
+  const size_t last = timer_heap_.back();
+
+  timer_heap_.pop_back();
+  timers_[ timer ].heap_index = NOT_SET;
+
+  if ( timer_heap_.empty() ) {
+    update_interest( timer_action_ );
+  }
+
+  if ( last != timer ) {
+    place_timer( heap_index, last );
+    sift_up( heap_index );
+    sift_down( timers_[ last ].heap_index );
+  }
+}
+
+/* call back every timer whose deadline is at or before now */
+Poller::Action::Result Poller::run_timers( const uint64_t now )
+{
+  while ( not timer_heap_.empty() and timers_[ timer_heap_.front() ].deadline <= now ) {
+    const size_t id = timer_heap_.front();
+    Timer & timer = timers_[ id ];
+
+    /* a periodic timer moves on to its next deadline after now,
+       and a one-shot timer is cleared, before the callback (which
+       may set it again) */
+    if ( timer.period ) {
+      timer.deadline += ((now - timer.deadline) / timer.period + 1) * timer.period;
+      sift_down( 0 );
+    } else {
+      unlink_timer( id );
+    }
+
+    const auto result = timer.callback();
+
+    switch ( result.result ) {
+    case ResultType::Exit:
+      return result;
+    case ResultType::Cancel:
+      clear_timer( id );
+    case ResultType::Continue:
+      break;
+    }
+  }
+
+  return ResultType::Continue;
+}
+
+/* have the timerfd fire for the earliest timer (if that has changed) */
+void Poller::arm_timer_fd( void )
+{
+  const uint64_t deadline = next_timer();
+  if ( deadline == timer_fd_deadline_ ) {
+    return;
+  }
+
+  if ( timer_heap_.empty() ) {
+    timer_fd_.disarm();
+  } else {
+    timer_fd_.arm_at( monotonic_ns( deadline ) );
+  }
+  timer_fd_deadline_ = deadline;
+}
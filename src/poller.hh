@@ -1,12 +1,17 @@
 #ifndef POLLER_HH
 #define POLLER_HH
 
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <vector>
+#include <unordered_map>
 
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include "file_descriptor.hh"
+#include "timerfd.hh"
 
 class Poller
 {
@@ -40,8 +45,69 @@ public:
   };
 
 private:
+  /* the actions registered for one fd, and what epoll is watching it for */
+  struct Registration
+  {
+    std::vector< size_t > actions;
+    uint32_t events;
+    bool needs_update;
+
+    Registration() : actions(), events( 0 ), needs_update( false ) {}
+  };
+
+  FileDescriptor epoll_fd_;
   std::vector< Action > actions_;
-  std::vector< pollfd > pollfds_;
+
+  /* whether each action is currently interested */
+  std::vector< bool > interested_;
+  unsigned int interested_count_;
+
+  /* actions whose interest must be re-evaluated before the next wait:
+     those that were just added, whose fd was just serviced, or whose
+     owner said their interest changed (see update_interest) */
+  std::vector< size_t > dirty_actions_;
+  std::vector< bool > dirty_;
+
+  std::unordered_map< int, Registration > registrations_;
+  std::vector< int > dirty_registrations_;
+
+  std::vector< epoll_event > events_;
+
+  /* one-shot and periodic timers (deadlines on the timestamp_ns()
+     timescale), in a binary min-heap by deadline that knows where
+     each timer is, so setting, moving or clearing one is O(log n).
+     Only the earliest is handed to the kernel, on one timerfd. */
+  struct Timer
+  {
+    Action::CallbackType callback;
+    uint64_t deadline;
+    uint64_t period;   /* 0 for a one-shot timer */
+    size_t heap_index; /* NOT_SET when the timer isn't set */
+
+    Timer( const Action::CallbackType & s_callback )
+      : callback( s_callback ), deadline( 0 ), period( 0 ), heap_index( NOT_SET ) {}
+  };
+
+  static const size_t NOT_SET = SIZE_MAX;
+
+  std::deque< Timer > timers_; /* (a deque, so adding one from a callback moves none) */
+  std::vector< size_t > timer_heap_;
+
+  Timerfd timer_fd_;
+  uint64_t timer_fd_deadline_; /* what timer_fd_ is armed for (0 if nothing) */
+  size_t timer_action_;        /* watches timer_fd_ while any timer is set */
+
+  void mark_dirty( const size_t action_index );
+  void evaluate_interest( const size_t action_index );
+  void update_registration( const int fd_num );
+
+  bool timer_before( const size_t a, const size_t b ) const;
+  void place_timer( const size_t heap_index, const size_t timer );
+  void sift_up( size_t heap_index );
+  void sift_down( size_t heap_index );
+  void unlink_timer( const size_t timer );
+  Action::Result run_timers( const uint64_t now );
+  void arm_timer_fd( void );
 
 public:
   struct Result
@@ -52,9 +118,36 @@ public:
       : result( s_result ), exit_status( s_status ) {}
   };
 
-  Poller() : actions_(), pollfds_() {}
-  void add_action( Action action );
+  typedef size_t ActionId;
+  typedef size_t TimerId;
+
+  Poller();
+  ActionId add_action( Action action );
   Result poll( const int & timeout_ms );
+
+  /* an action's when_interested predicate is only consulted when the
+     action is added and after its fd is serviced, so whatever else
+     can change its answer must say so here (before the next poll) */
+  void update_interest( const ActionId id );
+
+  /* register a timer, not yet set. Its callback runs from poll() once
+     the deadline has passed, and returns like an action's: Exit ends
+     the poll, and Cancel clears a periodic timer. */
+  TimerId add_timer( const Action::CallbackType & callback );
+
+  /* (re)set a timer to fire at deadline, and then every period
+     nanoseconds if period isn't 0 (missed periods are skipped) */
+  void set_timer( const TimerId id, const uint64_t deadline, const uint64_t period = 0 );
+
+  /* stop a timer (no-op if it isn't set) */
+  void clear_timer( const TimerId id );
+
+  /* the earliest deadline of any timer that is set (0 if none is) */
+  uint64_t next_timer( void ) const;
+
+  /* forbid copying or moving (the Poller's own timer action refers to it) */
+  Poller( const Poller & other ) = delete;
+  Poller & operator=( const Poller & other ) = delete;
 };
 
 namespace PollerShortNames {
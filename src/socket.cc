@@ -1,4 +1,8 @@
 #include <sys/socket.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
 
 #include "socket.hh"
 #include "util.hh"
@@ -75,26 +79,92 @@ void Socket::connect( const Address & address )
 				    address.size() ) );
 }
 
+/* make sure we got the whole datagram */
+static void check_received_flags( const msghdr & header )
+{
+  if ( header.msg_flags & MSG_TRUNC ) {
+    throw runtime_error( "recvfrom (oversized datagram)" );
+  } else if ( header.msg_flags ) {
+    throw runtime_error( "recvfrom (unhandled flag)" );
+  }
+}
+
+/* find the timestamp header (if there is one) */
+uint64_t kernel_timestamp( msghdr & header )
+{
+  uint64_t timestamp = -1;
+
+  cmsghdr *ts_hdr = CMSG_FIRSTHDR( &header );
+  while ( ts_hdr ) {
+    if ( ts_hdr->cmsg_level == SOL_SOCKET
+	 and ts_hdr->cmsg_type == SO_TIMESTAMPNS ) {
+      const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( ts_hdr ) );
+      timestamp = timestamp_ns( *kernel_time );
+    }
+    ts_hdr = CMSG_NXTHDR( &header, ts_hdr );
+  }
+
+  return timestamp;
+}
+
+/* find the size of coalesced datagrams (UDP_GRO), or 0 if not coalesced */
+static size_t gro_segment_size( msghdr & header )
+{
+  size_t segment_size = 0;
+
+  for ( cmsghdr * control = CMSG_FIRSTHDR( &header ); control; control = CMSG_NXTHDR( &header, control ) ) {
+    if ( control->cmsg_level == SOL_UDP and control->cmsg_type == UDP_GRO ) {
+      int size;
+      memcpy( &size, CMSG_DATA( control ), sizeof( size ) );
+      segment_size = size;
+    }
+  }
+
+  return segment_size;
+}
+
+/* ancillary data space for just the SO_TIMESTAMPNS timestamp */
+static const size_t TIMESTAMP_CONTROL_LEN = CMSG_SPACE( sizeof( timespec ) );
+
+/* ... and for the timestamp plus a UDP_GRO segment size */
+static const size_t RECEIVE_CONTROL_LEN = TIMESTAMP_CONTROL_LEN + CMSG_SPACE( sizeof( int ) );
+
+/* most datagrams the kernel coalesces into one (UDP_GRO_CNT_MAX) */
+static const unsigned int MAX_GRO_SEGMENTS = 64;
+
 /* receive datagram and where it came from */
 UDPSocket::received_datagram UDPSocket::recv( void )
 {
   static const ssize_t RECEIVE_MTU = 65536;
 
+  char msg_payload[ RECEIVE_MTU ];
+
+  const received_datagram_view recd = recv( msg_payload, sizeof( msg_payload ) );
+
+  received_datagram ret = { recd.source_address,
+			    recd.timestamp,
+			    string( recd.payload, recd.length ) };
+
+  return ret;
+}
+
+/* receive datagram into a caller-owned buffer */
+UDPSocket::received_datagram_view UDPSocket::recv( char * const buffer, const size_t capacity )
+{
   /* receive source address, timestamp and payload */
   Address::raw datagram_source_address;
   msghdr header; zero( header );
   iovec msg_iovec; zero( msg_iovec );
 
-  char msg_payload[ RECEIVE_MTU ];
-  char msg_control[ RECEIVE_MTU ];
+  char msg_control[ TIMESTAMP_CONTROL_LEN ];
 
   /* prepare to get the source address */
   header.msg_name = &datagram_source_address;
   header.msg_namelen = sizeof( datagram_source_address );
 
   /* prepare to get the payload */
-  msg_iovec.iov_base = msg_payload;
-  msg_iovec.iov_len = sizeof( msg_payload );
+  msg_iovec.iov_base = buffer;
+  msg_iovec.iov_len = capacity;
   header.msg_iov = &msg_iovec;
   header.msg_iovlen = 1;
 
@@ -108,68 +178,476 @@ UDPSocket::received_datagram UDPSocket::recv( void )
 
   register_read();
 
-  /* make sure we got the whole datagram */
-  if ( header.msg_flags & MSG_TRUNC ) {
-    throw runtime_error( "recvfrom (oversized datagram)" );
-  } else if ( header.msg_flags ) {
-    throw runtime_error( "recvfrom (unhandled flag)" );
+  check_received_flags( header );
+
+  received_datagram_view ret = { Address( datagram_source_address,
+					  header.msg_namelen ),
+				 kernel_timestamp( header ),
+				 buffer,
+				 size_t( recv_len ) };
+
+  return ret;
+}
+
+DatagramBatch::DatagramBatch( const unsigned int capacity, const size_t slot_size,
+			      const size_t reply_size )
+  : slot_size_( slot_size ),
+    reply_size_( reply_size ),
+    payloads_( capacity * slot_size ),
+    replies_( capacity * MAX_GRO_SEGMENTS * reply_size ),
+    controls_( capacity * RECEIVE_CONTROL_LEN ),
+    addresses_( capacity ),
+    timestamps_( capacity ),
+    iovecs_( capacity ),
+    headers_( capacity ),
+    records_(),
+    send_iovecs_(),
+    send_headers_()
+{
+  if ( capacity == 0 ) {
+    throw runtime_error( "DatagramBatch: capacity must be positive" );
   }
 
-  uint64_t timestamp = -1;
+  for ( unsigned int i = 0; i < capacity; i++ ) {
+    zero( headers_[ i ] );
+    msghdr & header = headers_[ i ].msg_hdr;
 
-  /* find the timestamp header (if there is one) */
-  cmsghdr *ts_hdr = CMSG_FIRSTHDR( &header );
-  while ( ts_hdr ) {
-    if ( ts_hdr->cmsg_level == SOL_SOCKET
-	 and ts_hdr->cmsg_type == SO_TIMESTAMPNS ) {
-      const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( ts_hdr ) );
-      timestamp = timestamp_ms( *kernel_time );
+    header.msg_name = &addresses_[ i ];
+    iovecs_[ i ].iov_base = &payloads_[ i * slot_size_ ];
+    header.msg_iov = &iovecs_[ i ];
+    header.msg_iovlen = 1;
+  }
+
+  /* room for every slot to be coalesced, so a receive doesn't allocate */
+  records_.reserve( capacity * MAX_GRO_SEGMENTS );
+
+  prepare_receive();
+}
+
+/* reset every slot to receive a full-sized datagram */
+void DatagramBatch::prepare_receive( void )
+{
+  for ( unsigned int i = 0; i < capacity(); i++ ) {
+    msghdr & header = headers_[ i ].msg_hdr;
+
+    header.msg_namelen = sizeof( addresses_[ i ] );
+    iovecs_[ i ].iov_len = slot_size_;
+    header.msg_control = &controls_[ i * RECEIVE_CONTROL_LEN ];
+    header.msg_controllen = RECEIVE_CONTROL_LEN;
+    header.msg_flags = 0;
+  }
+
+  records_.clear();
+}
+
+/* split what the slot received into records */
+void DatagramBatch::add_records( const unsigned int slot, const size_t segment_size )
+{
+  const size_t length = headers_[ slot ].msg_len;
+
+  if ( segment_size == 0 or segment_size >= length ) {
+    records_.push_back( { slot, 0, length } );
+    return;
+  }
+
+  for ( size_t offset = 0; offset < length; offset += segment_size ) {
+    records_.push_back( { slot, offset, min( segment_size, length - offset ) } );
+  }
+}
+
+char * DatagramBatch::payload( const unsigned int n )
+{
+  const Record & record = records_.at( n );
+  return &payloads_[ record.slot * slot_size_ + record.offset ];
+}
+
+char * DatagramBatch::reply( const unsigned int n )
+{
+  if ( reply_size_ == 0 ) {
+    return payload( n );
+  }
+
+  if ( n >= size() ) {
+    throw runtime_error( "DatagramBatch: no such datagram" );
+  }
+
+  return &replies_[ n * reply_size_ ];
+}
+
+Address DatagramBatch::address( const unsigned int n ) const
+{
+  const unsigned int slot = records_.at( n ).slot;
+  return Address( addresses_[ slot ], headers_[ slot ].msg_hdr.msg_namelen );
+}
+
+/* how long the reply to the nth datagram may grow */
+size_t DatagramBatch::room( const unsigned int n ) const
+{
+  const Record & record = records_.at( n );
+  if ( reply_size_ ) {
+    return reply_size_;
+  }
+
+  if ( n + 1 < records_.size() and records_[ n + 1 ].slot == record.slot ) {
+    return records_[ n + 1 ].offset - record.offset;
+  }
+
+  return slot_size_ - record.offset;
+}
+
+/* set the length of the reply to the nth datagram before sending it back out */
+void DatagramBatch::set_length( const unsigned int n, const size_t length )
+{
+  if ( length > room( n ) ) {
+    throw runtime_error( "DatagramBatch: length exceeds room for datagram" );
+  }
+
+  records_.at( n ).length = length;
+}
+
+/* receive between one and batch.capacity() datagrams with one syscall */
+unsigned int UDPSocket::recv_batch( DatagramBatch & batch )
+{
+  batch.prepare_receive();
+
+  /* call recvmmsg, waiting only for the first datagram */
+  const int count = SystemCall( "recvmmsg",
+				recvmmsg( fd_num(), &batch.headers_[ 0 ], batch.capacity(),
+					  MSG_WAITFORONE, nullptr ) );
+
+  register_read();
+
+  for ( int i = 0; i < count; i++ ) {
+    msghdr & header = batch.headers_[ i ].msg_hdr;
+    check_received_flags( header );
+    batch.timestamps_[ i ] = kernel_timestamp( header );
+    batch.add_records( i, gro_segment_size( header ) );
+  }
+
+  return batch.size();
+}
+
+/* send a prepared array of datagrams, looping until the kernel has taken them all */
+static void send_mmsg( const int fd_num, mmsghdr * const headers, const size_t size )
+{
+  size_t sent = 0;
+
+  while ( sent < size ) {
+    const int count = SystemCall( "sendmmsg",
+				  sendmmsg( fd_num, headers + sent, size - sent, 0 ) );
+
+    for ( int i = 0; i < count; i++ ) {
+      const mmsghdr & header = headers[ sent + i ];
+      if ( header.msg_len != header.msg_hdr.msg_iov->iov_len ) {
+	throw runtime_error( "datagram payload too big for sendmmsg()" );
+      }
     }
-    ts_hdr = CMSG_NXTHDR( &header, ts_hdr );
+
+    sent += count;
   }
+}
 
-  received_datagram ret = { Address( datagram_source_address,
-				     header.msg_namelen ),
-			    timestamp,
-			    string( msg_payload, recv_len ) };
+/* send the reply to each datagram in the batch back to the address it came from */
+void UDPSocket::sendto_batch( DatagramBatch & batch )
+{
+  const unsigned int count = batch.size();
+  if ( count == 0 ) {
+    return;
+  }
 
-  return ret;
+  batch.send_iovecs_.resize( count );
+  batch.send_headers_.resize( count );
+
+  for ( unsigned int i = 0; i < count; i++ ) {
+    const unsigned int slot = batch.records_[ i ].slot;
+    msghdr & header = batch.send_headers_[ i ].msg_hdr;
+    zero( header );
+
+    batch.send_iovecs_[ i ].iov_base = batch.reply( i );
+    batch.send_iovecs_[ i ].iov_len = batch.length( i );
+    header.msg_name = &batch.addresses_[ slot ];
+    header.msg_namelen = batch.headers_[ slot ].msg_hdr.msg_namelen;
+    header.msg_iov = &batch.send_iovecs_[ i ];
+    header.msg_iovlen = 1;
+  }
+
+  send_mmsg( fd_num(), &batch.send_headers_[ 0 ], count );
+
+  register_write();
+}
+
+/* send several datagrams to connected address */
+void UDPSocket::send_batch( const vector<string> & payloads )
+{
+  send_batch( payloads, payloads.size() );
+}
+
+/* where a payload's bytes are */
+static char * payload_data( const string & payload ) { return const_cast<char *>( payload.data() ); }
+static char * payload_data( const Packet & packet ) { return const_cast<char *>( packet.data() ); }
+static size_t payload_length( const string & payload ) { return payload.size(); }
+static size_t payload_length( const Packet & packet ) { return packet.length(); }
+
+/* point the first count send headers at the first count payloads */
+template <typename Payloads>
+void UDPSocket::prepare_batch( const Payloads & payloads, const size_t count )
+{
+  if ( count > payloads.size() ) {
+    throw runtime_error( "send_batch: count exceeds number of payloads" );
+  }
+
+  if ( send_headers_.size() < count ) {
+    send_headers_.resize( count );
+    send_iovecs_.resize( count );
+  }
+
+  for ( unsigned int i = 0; i < count; i++ ) {
+    zero( send_headers_[ i ] );
+    send_iovecs_[ i ].iov_base = payload_data( payloads[ i ] );
+    send_iovecs_[ i ].iov_len = payload_length( payloads[ i ] );
+    send_headers_[ i ].msg_hdr.msg_iov = &send_iovecs_[ i ];
+    send_headers_[ i ].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+/* send the first count datagrams of payloads */
+void UDPSocket::send_batch( const vector<string> & payloads, const size_t count )
+{
+  prepare_batch( payloads, count );
+  send_mmsg( fd_num(), send_headers_.data(), count );
+
+  register_write();
+}
+
+void UDPSocket::send_batch( const vector<Packet> & packets, const size_t count )
+{
+  prepare_batch( packets, count );
+  send_mmsg( fd_num(), send_headers_.data(), count );
+
+  register_write();
+}
+
+/* send several datagrams, each to its own address */
+void UDPSocket::sendto_batch( const vector<pair<Address, string>> & datagrams )
+{
+  if ( send_headers_.size() < datagrams.size() ) {
+    send_headers_.resize( datagrams.size() );
+    send_iovecs_.resize( datagrams.size() );
+  }
+
+  for ( unsigned int i = 0; i < datagrams.size(); i++ ) {
+    const Address & destination = datagrams[ i ].first;
+    const string & payload = datagrams[ i ].second;
+
+    zero( send_headers_[ i ] );
+    send_iovecs_[ i ].iov_base = const_cast<char *>( payload.data() );
+    send_iovecs_[ i ].iov_len = payload.size();
+    send_headers_[ i ].msg_hdr.msg_name = const_cast<sockaddr *>( &destination.to_sockaddr() );
+    send_headers_[ i ].msg_hdr.msg_namelen = destination.size();
+    send_headers_[ i ].msg_hdr.msg_iov = &send_iovecs_[ i ];
+    send_headers_[ i ].msg_hdr.msg_iovlen = 1;
+  }
+
+  send_mmsg( fd_num(), send_headers_.data(), datagrams.size() );
+
+  register_write();
 }
 
 /* send datagram to specified address */
-void UDPSocket::sendto( const Address & destination, const string & payload )
+void UDPSocket::sendto( const Address & destination, const char * const payload, const size_t length )
 {
   const ssize_t bytes_sent =
     SystemCall( "sendto", ::sendto( fd_num(),
-				    payload.data(),
-				    payload.size(),
+				    payload,
+				    length,
 				    0,
 				    &destination.to_sockaddr(),
 				    destination.size() ) );
 
   register_write();
 
-  if ( size_t( bytes_sent ) != payload.size() ) {
+  if ( size_t( bytes_sent ) != length ) {
     throw runtime_error( "datagram payload too big for sendto()" );
   }
 }
 
 /* send datagram to connected address */
-void UDPSocket::send( const string & payload )
+void UDPSocket::send( const char * const payload, const size_t length )
 {
   const ssize_t bytes_sent =
     SystemCall( "send", ::send( fd_num(),
-				payload.data(),
-				payload.size(),
+				payload,
+				length,
 				0 ) );
 
   register_write();
 
-  if ( size_t( bytes_sent ) != payload.size() ) {
+  if ( size_t( bytes_sent ) != length ) {
     throw runtime_error( "datagram payload too big for send()" );
   }
 }
 
+void UDPSocket::sendto( const Address & destination, const string & payload )
+{
+  sendto( destination, payload.data(), payload.size() );
+}
+
+void UDPSocket::send( const string & payload )
+{
+  send( payload.data(), payload.size() );
+}
+
+/* send a pool buffer to specified address */
+void UDPSocket::sendto( const Address & destination, const Packet & packet )
+{
+  sendto( destination, packet.data(), packet.length() );
+}
+
+/* send a pool buffer to connected address */
+void UDPSocket::send( const Packet & packet )
+{
+  send( packet.data(), packet.length() );
+}
+
+/* ancillary data space for one SCM_TXTIME transmit time */
+static const size_t TXTIME_CONTROL_LEN = CMSG_SPACE( sizeof( uint64_t ) );
+
+/* attach an SCM_TXTIME transmit time to an outgoing message */
+static void put_txtime( msghdr & header, char * const control, const uint64_t txtime )
+{
+  header.msg_control = control;
+  header.msg_controllen = TXTIME_CONTROL_LEN;
+
+  cmsghdr * const txtime_hdr = CMSG_FIRSTHDR( &header );
+  txtime_hdr->cmsg_level = SOL_SOCKET;
+  txtime_hdr->cmsg_type = SCM_TXTIME;
+  txtime_hdr->cmsg_len = CMSG_LEN( sizeof( uint64_t ) );
+
+  const uint64_t launch_time = monotonic_ns( txtime );
+  memcpy( CMSG_DATA( txtime_hdr ), &launch_time, sizeof( launch_time ) );
+}
+
+/* send datagram to connected address, to leave at txtime */
+void UDPSocket::send_at( const string & payload, const uint64_t txtime )
+{
+  msghdr header; zero( header );
+  iovec msg_iovec; zero( msg_iovec );
+  char msg_control[ TXTIME_CONTROL_LEN ];
+  zero( msg_control );
+
+  msg_iovec.iov_base = const_cast<char *>( payload.data() );
+  msg_iovec.iov_len = payload.size();
+  header.msg_iov = &msg_iovec;
+  header.msg_iovlen = 1;
+
+  put_txtime( header, msg_control, txtime );
+
+  const ssize_t bytes_sent = SystemCall( "sendmsg", sendmsg( fd_num(), &header, 0 ) );
+
+  register_write();
+
+  if ( size_t( bytes_sent ) != payload.size() ) {
+    throw runtime_error( "datagram payload too big for sendmsg()" );
+  }
+}
+
+/* the longest payload a datagram to the connected address can carry unfragmented */
+size_t UDPSocket::max_payload( void ) const
+{
+  /* the MTU of the route to the connected address */
+  int mtu;
+  socklen_t len = sizeof( mtu );
+  SystemCall( "getsockopt IPV6_MTU",
+	      getsockopt( fd_num(), IPPROTO_IPV6, IPV6_MTU, &mtu, &len ) );
+
+  /* less the IP and UDP headers (an IPv4-mapped address is reached over IPv4) */
+  const Address peer = peer_address();
+  const sockaddr_in6 & peer_in6 = reinterpret_cast<const sockaddr_in6 &>( peer.to_sockaddr() );
+  const bool ipv4 = peer.to_sockaddr().sa_family == AF_INET
+    or IN6_IS_ADDR_V4MAPPED( &peer_in6.sin6_addr );
+  const size_t headers = (ipv4 ? sizeof( iphdr ) : sizeof( ip6_hdr )) + sizeof( udphdr );
+
+  if ( size_t( mtu ) <= headers ) {
+    throw runtime_error( "max_payload: MTU too small for a datagram" );
+  }
+
+  return mtu - headers;
+}
+
+/* send length bytes to connected address as datagrams of segment_size */
+void UDPSocket::send_segmented( const char * const data, const size_t length,
+				const size_t segment_size )
+{
+  msghdr header; zero( header );
+  iovec msg_iovec; zero( msg_iovec );
+  char msg_control[ CMSG_SPACE( sizeof( uint16_t ) ) ];
+  zero( msg_control );
+
+  msg_iovec.iov_base = const_cast<char *>( data );
+  msg_iovec.iov_len = length;
+  header.msg_iov = &msg_iovec;
+  header.msg_iovlen = 1;
+
+  /* attach the segment size */
+  header.msg_control = msg_control;
+  header.msg_controllen = sizeof( msg_control );
+
+  cmsghdr * const segment_hdr = CMSG_FIRSTHDR( &header );
+  segment_hdr->cmsg_level = SOL_UDP;
+  segment_hdr->cmsg_type = UDP_SEGMENT;
+  segment_hdr->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+
+  const uint16_t gso_size = segment_size;
+  memcpy( CMSG_DATA( segment_hdr ), &gso_size, sizeof( gso_size ) );
+
+  const ssize_t bytes_sent = SystemCall( "sendmsg (UDP_SEGMENT)", sendmsg( fd_num(), &header, 0 ) );
+
+  register_write();
+
+  if ( size_t( bytes_sent ) != length ) {
+    throw runtime_error( "segmented payload too big for sendmsg()" );
+  }
+}
+
+/* attach each of the first count send headers' txtime */
+void UDPSocket::attach_txtimes( const vector<uint64_t> & txtimes, const size_t count )
+{
+  if ( count > txtimes.size() ) {
+    throw runtime_error( "send_batch_at: count exceeds number of txtimes" );
+  }
+
+  if ( send_controls_.size() < count * TXTIME_CONTROL_LEN ) {
+    send_controls_.resize( count * TXTIME_CONTROL_LEN );
+  }
+
+  for ( unsigned int i = 0; i < count; i++ ) {
+    put_txtime( send_headers_[ i ].msg_hdr, &send_controls_[ i * TXTIME_CONTROL_LEN ], txtimes[ i ] );
+  }
+}
+
+/* send the first count datagrams of payloads, each at its own txtime */
+void UDPSocket::send_batch_at( const vector<string> & payloads,
+			       const vector<uint64_t> & txtimes,
+			       const size_t count )
+{
+  prepare_batch( payloads, count );
+  attach_txtimes( txtimes, count );
+  send_mmsg( fd_num(), send_headers_.data(), count );
+
+  register_write();
+}
+
+void UDPSocket::send_batch_at( const vector<Packet> & packets,
+			       const vector<uint64_t> & txtimes,
+			       const size_t count )
+{
+  prepare_batch( packets, count );
+  attach_txtimes( txtimes, count );
+  send_mmsg( fd_num(), send_headers_.data(), count );
+
+  register_write();
+}
+
 /* mark the socket as listening for incoming connections */
 void TCPSocket::listen( const int backlog )
 {
@@ -197,8 +675,37 @@ void Socket::set_reuseaddr( void )
   setsockopt( SOL_SOCKET, SO_REUSEADDR, int( true ) );
 }
 
+/* allow several sockets to bind the same port */
+void Socket::set_reuseport( void )
+{
+  setsockopt( SOL_SOCKET, SO_REUSEPORT, int( true ) );
+}
+
 /* turn on timestamps on receipt */
 void UDPSocket::set_timestamps( void )
 {
   setsockopt( SOL_SOCKET, SO_TIMESTAMPNS, int( true ) );
 }
+
+/* let each datagram carry its transmit time */
+void UDPSocket::set_txtime( void )
+{
+  sock_txtime config;
+  zero( config );
+  config.clockid = CLOCK_MONOTONIC;
+  config.flags = 0;
+
+  setsockopt( SOL_SOCKET, SO_TXTIME, config );
+}
+
+/* let the kernel coalesce same-sized incoming datagrams */
+void UDPSocket::set_gro( void )
+{
+  setsockopt( SOL_UDP, UDP_GRO, int( true ) );
+}
+
+/* cap the kernel's pacing rate for this socket */
+void UDPSocket::set_max_pacing_rate( const uint64_t bytes_per_second )
+{
+  setsockopt( SOL_SOCKET, SO_MAX_PACING_RATE, bytes_per_second );
+}
@@ -2,9 +2,13 @@
 #define SOCKET_HH
 
 #include <functional>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include "address.hh"
 #include "file_descriptor.hh"
+#include "packet_pool.hh"
 
 /* class for network sockets (UDP, TCP, etc.) */
 class Socket : public FileDescriptor
@@ -38,33 +42,204 @@ public:
 
   /* allow local address to be reused sooner, at the cost of some robustness */
   void set_reuseaddr( void );
+
+  /* allow several sockets to bind the same port, with the kernel
+     spreading incoming flows among them */
+  void set_reuseport( void );
+};
+
+/* reusable storage for a batch of datagrams, so that a batch can be
+   received (and sent back out) without allocating on every call.
+
+   Each slot receives one datagram, or (with UDP_GRO) several
+   coalesced datagrams of the same size, which are split back
+   into separate records sharing the slot's timestamp and source.
+
+   Replies are assembled over the datagrams themselves, unless the
+   batch is given a reply_size: then each datagram gets its own
+   space of that size (for when a split-up datagram may be shorter
+   than its reply). */
+class DatagramBatch
+{
+  friend class UDPSocket;
+
+private:
+  /* one received datagram */
+  struct Record
+  {
+    unsigned int slot;
+    size_t offset, length;
+  };
+
+  size_t slot_size_;
+  size_t reply_size_;
+
+  std::vector<char> payloads_;
+  std::vector<char> replies_;
+  std::vector<char> controls_;
+  std::vector<Address::raw> addresses_;
+  std::vector<uint64_t> timestamps_;
+  std::vector<iovec> iovecs_;
+  std::vector<mmsghdr> headers_;
+
+  std::vector<Record> records_;
+
+  /* for sending the records back out */
+  std::vector<iovec> send_iovecs_;
+  std::vector<mmsghdr> send_headers_;
+
+  /* reset every slot to receive a full-sized datagram */
+  void prepare_receive( void );
+
+  /* split what the slot received into records of segment_size (0: just one) */
+  void add_records( const unsigned int slot, const size_t segment_size );
+
+public:
+  DatagramBatch( const unsigned int capacity, const size_t slot_size = 65536,
+		 const size_t reply_size = 0 );
+
+  /* accessors: capacity() counts slots (receive calls), size() datagrams */
+  unsigned int capacity( void ) const { return headers_.size(); }
+  unsigned int size( void ) const { return records_.size(); }
+  size_t slot_size( void ) const { return slot_size_; }
+
+  /* the nth datagram in the batch */
+  char * payload( const unsigned int n );
+  size_t length( const unsigned int n ) const { return records_.at( n ).length; }
+  uint64_t timestamp( const unsigned int n ) const { return timestamps_.at( records_.at( n ).slot ); }
+  Address address( const unsigned int n ) const;
+
+  /* where the reply to the nth datagram is assembled (without a
+     reply_size, the datagram itself) */
+  char * reply( const unsigned int n );
+
+  /* how long that reply may grow (up to the next datagram in its slot,
+     or the reply_size) */
+  size_t room( const unsigned int n ) const;
+
+  /* set the length of the reply to the nth datagram before sending it back out */
+  void set_length( const unsigned int n, const size_t length );
+
+  /* forbid copying, since the headers point into the other members */
+  DatagramBatch( const DatagramBatch & other ) = delete;
+  DatagramBatch & operator=( const DatagramBatch & other ) = delete;
 };
 
 /* UDP socket */
 class UDPSocket : public Socket
 {
+private:
+  /* reusable space for assembling outgoing batches, so that
+     sending a batch doesn't allocate once these have grown */
+  std::vector<mmsghdr> send_headers_;
+  std::vector<iovec> send_iovecs_;
+  std::vector<char> send_controls_;
+
+  /* point the first count send headers at the first count payloads */
+  template <typename Payloads>
+  void prepare_batch( const Payloads & payloads, const size_t count );
+
+  /* give each of them an SCM_TXTIME transmit time */
+  void attach_txtimes( const std::vector<uint64_t> & txtimes, const size_t count );
+
 public:
-  UDPSocket() : Socket( AF_INET6, SOCK_DGRAM ) {}
+  UDPSocket()
+    : Socket( AF_INET6, SOCK_DGRAM ), send_headers_(), send_iovecs_(), send_controls_()
+  {}
 
+  /* timestamps are in nanoseconds on the timestamp_ns() timescale */
   struct received_datagram {
     Address source_address;
     uint64_t timestamp;
     std::string payload;
   };
 
+  /* a datagram received into a caller-owned buffer */
+  struct received_datagram_view {
+    Address source_address;
+    uint64_t timestamp;
+    char * payload;
+    size_t length;
+  };
+
   /* receive datagram, timestamp, and where it came from */
   received_datagram recv( void );
 
+  /* receive datagram into a caller-owned buffer, without allocating */
+  received_datagram_view recv( char * const buffer, const size_t capacity );
+
+  /* receive between one and batch.capacity() datagrams into the batch;
+     returns the number received */
+  unsigned int recv_batch( DatagramBatch & batch );
+
   /* send datagram to specified address */
   void sendto( const Address & peer, const std::string & payload );
 
   /* send datagram to connected address */
   void send( const std::string & payload );
 
+  /* ... from a pool buffer */
+  void sendto( const Address & peer, const Packet & packet );
+  void send( const Packet & packet );
+
+  /* ... from any buffer */
+  void sendto( const Address & peer, const char * const payload, const size_t length );
+  void send( const char * const payload, const size_t length );
+
+  /* send several datagrams to connected address with as few syscalls as possible */
+  void send_batch( const std::vector<std::string> & payloads );
+
+  /* send the first count datagrams of payloads */
+  void send_batch( const std::vector<std::string> & payloads, const size_t count );
+  void send_batch( const std::vector<Packet> & packets, const size_t count );
+
+  /* send datagram to connected address, to leave at txtime
+     (a timestamp_ns() value; requires set_txtime()) */
+  void send_at( const std::string & payload, const uint64_t txtime );
+
+  /* the longest payload a datagram to the connected address can
+     carry without being fragmented (as far as the kernel knows) */
+  size_t max_payload( void ) const;
+
+  /* send length bytes to connected address as datagrams of segment_size
+     (the last may be shorter), split up by the kernel (UDP_SEGMENT) */
+  void send_segmented( const char * const data, const size_t length,
+		       const size_t segment_size );
+
+  /* send the first count datagrams of payloads, each at its own txtime */
+  void send_batch_at( const std::vector<std::string> & payloads,
+		      const std::vector<uint64_t> & txtimes,
+		      const size_t count );
+  void send_batch_at( const std::vector<Packet> & packets,
+		      const std::vector<uint64_t> & txtimes,
+		      const size_t count );
+
+  /* send several datagrams, each to its own address */
+  void sendto_batch( const std::vector<std::pair<Address, std::string>> & datagrams );
+
+  /* send each datagram in the batch back to the address it came from */
+  void sendto_batch( DatagramBatch & batch );
+
   /* turn on timestamps on receipt */
   void set_timestamps( void );
+
+  /* let each datagram carry its transmit time (SO_TXTIME), for the
+     fq or etf qdisc to release it then instead of immediately */
+  void set_txtime( void );
+
+  /* cap the kernel's pacing rate for this socket (enforced by fq) */
+  void set_max_pacing_rate( const uint64_t bytes_per_second );
+
+  /* let the kernel coalesce same-sized incoming datagrams (UDP_GRO);
+     recv_batch( DatagramBatch & ) splits them up again, but the other
+     receive methods would see them coalesced */
+  void set_gro( void );
 };
 
+/* the SO_TIMESTAMPNS timestamp in a received message's ancillary
+   data, on the timestamp_ns() timescale (or -1 if there is none) */
+uint64_t kernel_timestamp( msghdr & header );
+
 /* TCP socket */
 class TCPSocket : public Socket
 {
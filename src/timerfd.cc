@@ -0,0 +1,82 @@
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "timerfd.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* nanoseconds per second */
+static const uint64_t BILLION = 1000000000;
+
+static timespec to_timespec( const uint64_t nanos )
+{
+  timespec ret;
+  ret.tv_sec = nanos / BILLION;
+  ret.tv_nsec = nanos % BILLION;
+  return ret;
+}
+
+Timerfd::Timerfd()
+  : FileDescriptor( SystemCall( "timerfd_create",
+				timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) )
+{}
+
+/* fire once, delay_ns nanoseconds from now */
+void Timerfd::arm( const uint64_t delay_ns )
+{
+  itimerspec spec;
+  zero( spec );
+
+  /* an all-zero it_value would disarm the timer instead */
+  spec.it_value = to_timespec( max( delay_ns, uint64_t( 1 ) ) );
+
+  SystemCall( "timerfd_settime", timerfd_settime( fd_num(), 0, &spec, nullptr ) );
+}
+
+/* fire once, at an absolute CLOCK_MONOTONIC time */
+void Timerfd::arm_at( const uint64_t monotonic_ns )
+{
+  itimerspec spec;
+  zero( spec );
+
+  spec.it_value = to_timespec( max( monotonic_ns, uint64_t( 1 ) ) );
+
+  SystemCall( "timerfd_settime", timerfd_settime( fd_num(), TFD_TIMER_ABSTIME, &spec, nullptr ) );
+}
+
+/* fire every interval_ns nanoseconds */
+void Timerfd::arm_periodic( const uint64_t interval_ns )
+{
+  itimerspec spec;
+  zero( spec );
+
+  spec.it_value = to_timespec( max( interval_ns, uint64_t( 1 ) ) );
+  spec.it_interval = spec.it_value;
+
+  SystemCall( "timerfd_settime", timerfd_settime( fd_num(), 0, &spec, nullptr ) );
+}
+
+/* stop the timer */
+void Timerfd::disarm( void )
+{
+  itimerspec spec;
+  zero( spec );
+
+  SystemCall( "timerfd_settime", timerfd_settime( fd_num(), 0, &spec, nullptr ) );
+}
+
+/* consume the expirations so far */
+uint64_t Timerfd::read_expirations( void )
+{
+  uint64_t expirations = 0;
+
+  const ssize_t bytes_read = ::read( fd_num(), &expirations, sizeof( expirations ) );
+  if ( bytes_read < 0 and errno != EAGAIN ) {
+    throw unix_error( "read (timerfd)" );
+  }
+
+  register_read();
+
+  return bytes_read == sizeof( expirations ) ? expirations : 0;
+}
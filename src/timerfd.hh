@@ -0,0 +1,32 @@
+#ifndef TIMERFD_HH
+#define TIMERFD_HH
+
+#include <cstdint>
+
+#include "file_descriptor.hh"
+
+/* timerfd: a file descriptor that becomes readable when a
+   (CLOCK_MONOTONIC) timer expires, so timers can be polled */
+class Timerfd : public FileDescriptor
+{
+public:
+  Timerfd();
+
+  /* fire once, delay_ns nanoseconds from now */
+  void arm( const uint64_t delay_ns );
+
+  /* fire once, at an absolute CLOCK_MONOTONIC time in nanoseconds
+     (straight away if it has already passed) */
+  void arm_at( const uint64_t monotonic_ns );
+
+  /* fire every interval_ns nanoseconds, starting interval_ns from now */
+  void arm_periodic( const uint64_t interval_ns );
+
+  /* stop the timer */
+  void disarm( void );
+
+  /* consume the expirations so far (without blocking), returning how many */
+  uint64_t read_expirations( void );
+};
+
+#endif /* TIMERFD_HH */
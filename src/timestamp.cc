@@ -1,4 +1,5 @@
 #include <ctime>
+#include <atomic>
 
 #include "timestamp.hh"
 #include "util.hh"
@@ -9,28 +10,96 @@ static const uint64_t MILLION = 1000000;
 /* nanoseconds per second */
 static const uint64_t BILLION = 1000 * MILLION;
 
+/* whether to truncate timestamps to whole milliseconds */
+static std::atomic<bool> millisecond_timestamps( false );
+
 /* helper functions */
-static timespec current_time( void )
+static timespec current_time( const clockid_t clock )
 {
   timespec ret;
-  SystemCall( "clock_gettime", clock_gettime( CLOCK_REALTIME, &ret ) );
+  SystemCall( "clock_gettime", clock_gettime( clock, &ret ) );
   return ret;
 }
 
-static uint64_t timestamp_ms_raw( const timespec & ts )
+static uint64_t timestamp_ns_raw( const timespec & ts )
+{
+  return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+static uint64_t quantize( const uint64_t nanos )
+{
+  return millisecond_timestamps ? nanos - nanos % MILLION : nanos;
+}
+
+/* the start of the program (on the monotonic clock) */
+struct Epoch
+{
+  uint64_t monotonic;
+
+  Epoch()
+    : monotonic( timestamp_ns_raw( current_time( CLOCK_MONOTONIC ) ) )
+  {}
+};
+
+static const Epoch & epoch( void )
+{
+  const static Epoch the_epoch;
+  return the_epoch;
+}
+
+/* sample the epoch at startup, before any packet can be timestamped */
+static const Epoch & startup_epoch __attribute__((unused)) = epoch();
+
+/* Current time in nanoseconds since the start of the program */
+uint64_t timestamp_ns( void )
 {
-  const uint64_t nanos = ts.tv_sec * BILLION + ts.tv_nsec;
-  return nanos / MILLION;
+  const uint64_t start = epoch().monotonic;
+  return quantize( timestamp_ns_raw( current_time( CLOCK_MONOTONIC ) ) - start );
+}
+
+/* oldest a kernel timestamp is believed to be; anything older (or
+   in the future) says the realtime clock was stepped in between */
+static const uint64_t MAX_KERNEL_TIMESTAMP_AGE = 10 * BILLION;
+
+/* Convert a recent CLOCK_REALTIME timestamp to the timestamp_ns() timescale */
+uint64_t timestamp_ns( const timespec & ts )
+{
+  /* how long ago it was, subtracted from the monotonic time now
+     (so only a step in the meantime, not since startup, skews it) */
+  const uint64_t realtime_now = timestamp_ns_raw( current_time( CLOCK_REALTIME ) );
+  const uint64_t now = timestamp_ns_raw( current_time( CLOCK_MONOTONIC ) ) - epoch().monotonic;
+  const uint64_t stamped = timestamp_ns_raw( ts );
+
+  if ( stamped > realtime_now ) {
+    return quantize( now );
+  }
+
+  const uint64_t age = realtime_now - stamped;
+  if ( age > MAX_KERNEL_TIMESTAMP_AGE or age > now ) {
+    return quantize( now );
+  }
+
+  return quantize( now - age );
+}
+
+/* Convert a timestamp_ns() value to absolute CLOCK_MONOTONIC nanoseconds */
+uint64_t monotonic_ns( const uint64_t timestamp )
+{
+  return timestamp + epoch().monotonic;
 }
 
 /* Current time in milliseconds since the start of the program */
 uint64_t timestamp_ms( void )
 {
-  return timestamp_ms( current_time() );
+  return timestamp_ns() / MILLION;
 }
 
 uint64_t timestamp_ms( const timespec & ts )
 {
-  const static uint64_t EPOCH = timestamp_ms_raw( current_time() );
-  return timestamp_ms_raw( ts ) - EPOCH;
+  return timestamp_ns( ts ) / MILLION;
+}
+
+void set_millisecond_timestamps( const bool enabled )
+{
+  millisecond_timestamps = enabled;
 }
@@ -4,8 +4,28 @@
 #include <ctime>
 #include <cstdint>
 
+/* Current time in nanoseconds since the start of the program
+   (from the monotonic clock) */
+uint64_t timestamp_ns( void );
+
+/* Convert a recent CLOCK_REALTIME timestamp (e.g. a kernel
+   SO_TIMESTAMPNS receive timestamp) to the same timescale as
+   timestamp_ns(). It is measured back from the current time on both
+   clocks, so a step in the realtime clock since startup doesn't skew
+   it; one that makes it implausible (in the future, more than 10 s
+   old, or before startup) gives the current time instead. */
+uint64_t timestamp_ns( const timespec & ts );
+
+/* Convert a timestamp_ns() value to absolute CLOCK_MONOTONIC
+   nanoseconds, for kernel interfaces such as SO_TXTIME */
+uint64_t monotonic_ns( const uint64_t timestamp );
+
 /* Current time in milliseconds since the start of the program */
 uint64_t timestamp_ms( void );
 uint64_t timestamp_ms( const timespec & ts );
 
+/* Compatibility mode: truncate every timestamp_ns() value to a whole
+   millisecond, reproducing the old millisecond-quantised timestamps */
+void set_millisecond_timestamps( const bool enabled );
+
 #endif /* TIMESTAMP_HH */
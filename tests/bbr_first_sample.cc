@@ -0,0 +1,54 @@
+/* a BBR flow whose first RTT sample arrives long after the clock's
+   epoch (more than its min_rtt_window_s) has no minimum RTT to expire
+   yet, so it must stay in Startup just like a flow started at once:
+   the two are fed the same datagrams and acks, and must agree on the
+   window and pacing rate throughout (ProbeRTT would cut both) */
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "controller.hh"
+
+using namespace std;
+
+static const uint64_t MILLISECOND = 1000000;
+static const uint64_t DATAGRAM_LENGTH = 1400;
+
+int main( void )
+{
+  const ControllerParams params;
+  unique_ptr<Controller> early = Controller::make( "bbr", false, params );
+  unique_ptr<Controller> late = Controller::make( "bbr", false, params );
+
+  const uint64_t early_start = 1000 * MILLISECOND;
+  const uint64_t late_start = 11000 * MILLISECOND;
+
+  /* a datagram every millisecond, each acked 20 ms later */
+  for ( uint64_t n = 0; n < 100; n++ ) {
+    early->datagram_was_sent( n, early_start + n * MILLISECOND );
+    late->datagram_was_sent( n, late_start + n * MILLISECOND );
+
+    if ( n < 20 ) {
+      continue;
+    }
+
+    const uint64_t acked = n - 20;
+    early->ack_received( acked, early_start + acked * MILLISECOND, 0,
+			 early_start + n * MILLISECOND, DATAGRAM_LENGTH );
+    late->ack_received( acked, late_start + acked * MILLISECOND, 0,
+			late_start + n * MILLISECOND, DATAGRAM_LENGTH );
+
+    if ( early->window_size() != late->window_size()
+	 or early->pacing_rate() != late->pacing_rate() ) {
+      cerr << "after the ack for datagram " << acked << ", the flow started at "
+	   << late_start / MILLISECOND << " ms has window " << late->window_size()
+	   << " and pacing rate " << late->pacing_rate() << ", but the one started at "
+	   << early_start / MILLISECOND << " ms has " << early->window_size()
+	   << " and " << early->pacing_rate() << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
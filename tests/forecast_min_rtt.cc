@@ -0,0 +1,42 @@
+/* the forecast controller sizes its window to the minimum RTT over
+   the last min_rtt_window_s seconds: after the path's RTT grows from
+   20 ms to 200 ms, the window must grow with it once the 20 ms
+   samples have aged out (it stayed sized to 20 ms for good before) */
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "controller.hh"
+
+using namespace std;
+
+static const uint64_t MILLISECOND = 1000000;
+static const uint64_t DATAGRAM_LENGTH = 1000;
+
+/* 1000 datagrams per second */
+static const uint64_t FORECAST = 1000 * DATAGRAM_LENGTH;
+
+int main( void )
+{
+  ControllerParams params;
+  params.set( "target_ms=0" );
+  params.set( "min_rtt_window_s=1" );
+  unique_ptr<Controller> controller = Controller::make( "forecast", false, params );
+
+  /* an ack every 10 ms for 5 s, each with its RTT and a forecast */
+  for ( uint64_t now = 1000 * MILLISECOND; now < 6000 * MILLISECOND; now += 10 * MILLISECOND ) {
+    const uint64_t rtt = (now < 2000 * MILLISECOND ? 20 : 200) * MILLISECOND;
+    controller->ack_received( now, now - rtt, 0, now, DATAGRAM_LENGTH );
+    controller->forecast_received( FORECAST, now );
+  }
+
+  /* 1000 datagrams per second over 200 ms */
+  if ( controller->window_size() != 200 ) {
+    cerr << "window " << controller->window_size()
+	 << " datagrams, where a 200 ms RTT needs 200" << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
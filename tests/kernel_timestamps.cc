@@ -0,0 +1,54 @@
+/* converting realtime (kernel) timestamps to the timestamp_ns()
+   timescale: a recent one lands where the monotonic clock says it
+   was, and an implausible one (from a realtime step) reads as now
+   rather than wrapping around */
+
+#include <cstdlib>
+#include <iostream>
+
+#include "timestamp.hh"
+
+using namespace std;
+
+static const uint64_t MILLISECOND = 1000000;
+
+/* the realtime clock, offset by some nanoseconds */
+static timespec realtime( const int64_t offset )
+{
+  timespec ts;
+  clock_gettime( CLOCK_REALTIME, &ts );
+  const int64_t nanos = int64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec + offset;
+  ts.tv_sec = nanos / 1000000000;
+  ts.tv_nsec = nanos % 1000000000;
+  return ts;
+}
+
+/* whether the converted timestamp is within a millisecond of expected */
+static bool check( const string & what, const timespec & ts, const int64_t expected )
+{
+  const int64_t converted = timestamp_ns( ts );
+  if ( converted < expected - int64_t( MILLISECOND ) or converted > expected + int64_t( MILLISECOND ) ) {
+    cerr << what << ": converted to " << converted << ", expected about " << expected << endl;
+    return false;
+  }
+
+  return true;
+}
+
+int main( void )
+{
+  /* let the program have run a while, so there is some past to land in */
+  timespec pause = { 0, int( 50 * MILLISECOND ) };
+  nanosleep( &pause, nullptr );
+
+  bool ok = true;
+  ok &= check( "now", realtime( 0 ), timestamp_ns() );
+  ok &= check( "20 ms ago", realtime( -20 * MILLISECOND ), timestamp_ns() - 20 * MILLISECOND );
+  ok &= check( "in the future", realtime( 1000 * MILLISECOND ), timestamp_ns() );
+  ok &= check( "an hour ago", realtime( -3600000 * MILLISECOND ), timestamp_ns() );
+
+  timespec ancient = { 0, 0 };
+  ok &= check( "1970", ancient, timestamp_ns() );
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,73 @@
+/* leave more holes than the receiver tracks SACK ranges for before
+   the sender hears a thing (the acks are lost until then), and check
+   that the sender still presumes every missing datagram lost, rather
+   than being told they arrived, and no datagram it got an ack for */
+
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <vector>
+
+#include "scoreboard.hh"
+
+using namespace std;
+
+static const uint64_t MILLISECOND = 1000000;
+
+/* every fourth datagram goes missing, leaving 40 holes, and
+   the acks for all the datagrams up to the last hole are lost */
+static const uint64_t DATAGRAMS = 200;
+static const unsigned int HOLES = 40;
+static const uint64_t FIRST_ACKED = 4 * HOLES;
+
+static bool dropped( const uint64_t sequence_number )
+{
+  return sequence_number % 4 == 1 and sequence_number / 4 < HOLES;
+}
+
+int main( void )
+{
+  ReceiveHistory history;
+  Scoreboard scoreboard;
+  vector<LostDatagram> lost;
+  set<uint64_t> presumed_lost;
+
+  /* a datagram every millisecond, each acked (if it arrives) 20 ms later */
+  for ( uint64_t n = 0; n < DATAGRAMS; n++ ) {
+    scoreboard.sent( n, n * MILLISECOND );
+  }
+
+  for ( uint64_t n = 0; n < DATAGRAMS; n++ ) {
+    const uint64_t now = (n + 20) * MILLISECOND;
+
+    if ( dropped( n ) ) {
+      continue;
+    }
+
+    history.received( n );
+    if ( n >= FIRST_ACKED ) {
+      scoreboard.ack_received( n, n * MILLISECOND, now, history.sack( n ) );
+    }
+
+    scoreboard.detect_losses( now, lost );
+    for ( const auto & datagram : lost ) {
+      presumed_lost.insert( datagram.sequence_number );
+    }
+  }
+
+  /* (whether a datagram that arrived, but whose ack was lost, is
+     presumed lost depends on whether a SACK range still covered it) */
+  bool ok = true;
+  for ( uint64_t n = 0; n < DATAGRAMS; n++ ) {
+    const bool missing = presumed_lost.count( n );
+    if ( dropped( n ) and not missing ) {
+      cerr << "datagram " << n << " went missing, but the sender didn't presume it lost" << endl;
+      ok = false;
+    } else if ( n >= FIRST_ACKED and missing ) {
+      cerr << "datagram " << n << " was acked, but the sender presumed it lost" << endl;
+      ok = false;
+    }
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+# run the sender against a receiver over loopback for a few seconds,
+# with a fixed window (so its buffers stop growing once it is full),
+# and check from the sender's event trace that once the first couple
+# of once-a-second allocation reports are past, it doesn't allocate
+
+dir=../datagrump
+port=$(( 20000 + $$ % 20000 ))
+trace=steady_state_allocations.$$.trace
+csv=steady_state_allocations.$$.csv
+
+$dir/receiver $port > /dev/null 2>&1 &
+receiver=$!
+trap 'kill $receiver; rm -f $trace $csv' EXIT
+sleep 1
+
+status=0
+for options in "" "flows=4 gso=1"; do
+    echo "sender $options"
+
+    timeout 5 $dir/sender ::1 $port trace=$trace \
+	cc=aimd increase=0 initial_window=32 $options > /dev/null
+    $dir/trace2csv $trace > $csv || exit 1
+
+    # (columns: time_ns,thread,event,value,x,...; x counts the
+    # allocations since the report before)
+    if ! awk -F, '$3 == "allocations" { n++; print "  report " n ": " $5 " allocations";
+			if ( n > 2 ) { checked++; if ( $5 != 0 ) moved = 1 } }
+		  END { exit ( checked < 2 or moved ) }' $csv; then
+	echo "the sender allocated after warming up (or didn't report)"
+	status=1
+    fi
+done
+
+exit $status
@@ -0,0 +1,117 @@
+/* send a batch of datagrams with spaced-out launch times (SO_TXTIME)
+   over the loopback interface, and check when they arrive: with
+   "paced" (the fq qdisc installed on lo), no earlier than their
+   launch times; with "unpaced" (no qdisc), straight away, since
+   the kernel then ignores the launch times without complaint.
+
+   Either way, a launch time on a socket that never asked for them
+   must fail as an exception, leaving the socket usable.
+
+   (run by txtime_fq.sh, which sets up the loopback interface) */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "socket.hh"
+#include "poller.hh"
+#include "timestamp.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+static const unsigned int BATCH_SIZE = 10;
+
+/* between launch times, and before the first of them */
+static const uint64_t SPACING = 2000000;
+static const uint64_t LEAD_TIME = 5000000;
+
+/* how early a datagram may arrive (clock granularity) */
+static const uint64_t TOLERANCE = 100000;
+
+/* receive count datagrams, returning their arrival timestamps */
+static vector<uint64_t> receive( UDPSocket & socket, const unsigned int count )
+{
+  vector<uint64_t> arrivals;
+
+  Poller poller;
+  poller.add_action( Poller::Action( socket, Direction::In, [&] () {
+	arrivals.push_back( socket.recv().timestamp );
+	return ResultType::Continue;
+      } ) );
+
+  while ( arrivals.size() < count ) {
+    if ( poller.poll( 1000 ).result == PollResult::Timeout ) {
+      throw runtime_error( "timed out after " + to_string( arrivals.size() ) + " datagrams" );
+    }
+  }
+
+  return arrivals;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc != 2 or (string( argv[ 1 ] ) != "paced" and string( argv[ 1 ] ) != "unpaced") ) {
+    cerr << "Usage: " << argv[ 0 ] << " paced|unpaced" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const bool paced = string( argv[ 1 ] ) == "paced";
+
+  UDPSocket receiver;
+  receiver.set_timestamps();
+  receiver.bind( Address( "::1", 0 ) );
+
+  UDPSocket sender;
+  sender.connect( receiver.local_address() );
+
+  /* without set_txtime(), the kernel refuses a launch time */
+  try {
+    sender.send_at( "early", timestamp_ns() );
+    cerr << "send_at() succeeded without set_txtime()" << endl;
+    return EXIT_FAILURE;
+  } catch ( const unix_error & e ) {
+    cerr << "without set_txtime(): " << e.what() << endl;
+  }
+
+  /* ... and the socket carries on as before */
+  sender.send( "plain" );
+  receive( receiver, 1 );
+
+  sender.set_txtime();
+
+  const vector<string> payloads( BATCH_SIZE, string( 100, 'x' ) );
+  vector<uint64_t> launch_times;
+  const uint64_t first = timestamp_ns() + LEAD_TIME;
+  for ( unsigned int i = 0; i < BATCH_SIZE; i++ ) {
+    launch_times.push_back( first + i * SPACING );
+  }
+
+  sender.send_batch_at( payloads, launch_times, BATCH_SIZE );
+  const vector<uint64_t> arrivals = receive( receiver, BATCH_SIZE );
+
+  bool ok = true;
+  for ( unsigned int i = 0; i < BATCH_SIZE; i++ ) {
+    const int64_t lateness = arrivals[ i ] - launch_times[ i ];
+    cerr << "datagram " << i << " arrived " << lateness / 1000 << " us after its launch time" << endl;
+
+    if ( paced and lateness + int64_t( TOLERANCE ) < 0 ) {
+      cerr << "... which is too early" << endl;
+      ok = false;
+    }
+  }
+
+  /* without fq, the whole batch goes out at once */
+  if ( not paced and arrivals.back() >= launch_times.back() ) {
+    cerr << "launch times were kept with no qdisc to keep them (is fq installed?)" << endl;
+    ok = false;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
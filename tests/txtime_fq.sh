@@ -0,0 +1,24 @@
+#!/bin/sh
+
+# check kernel pacing (SO_TXTIME) over a loopback interface of its own,
+# in a new network namespace: first with no qdisc, then with fq
+# (exits 77, for skipped, if either can't be set up)
+
+ns=datagrump-txtime-$$
+
+if ! ip netns add $ns 2> /dev/null; then
+    echo "can't create a network namespace (needs root)"
+    exit 77
+fi
+trap 'ip netns delete $ns' EXIT
+
+ip netns exec $ns ip link set lo up || exit 1
+
+ip netns exec $ns ./txtime_check unpaced || exit 1
+
+if ! ip netns exec $ns tc qdisc replace dev lo root fq; then
+    echo "can't install the fq qdisc"
+    exit 77
+fi
+
+ip netns exec $ns ./txtime_check paced || exit 1